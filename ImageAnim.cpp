@@ -2,6 +2,15 @@
 
 #include "gifldr.hpp"
 #include "PaletteGen.hpp"
+#include <algorithm>
+#include <atomic>
+#include <sstream>
+#include <thread>
+#include <type_traits>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 namespace ImageAnimation
 {
@@ -13,6 +22,16 @@ namespace ImageAnimation
 	{
 	}
 
+	ImageAnimFrame::ImageAnimFrame(Image_RGBA8&& c, int Duration) noexcept :
+		Image_RGBA8(std::move(c)), Duration(Duration)
+	{
+	}
+
+	// 帧存放在 std::vector 里，只有移动构造是 noexcept 时扩容才会移动帧，否则会复制每一帧的像素
+	static_assert(std::is_nothrow_move_constructible_v<ImageAnimFrame>);
+	static_assert(std::is_nothrow_move_assignable_v<ImageAnimFrame>);
+	static_assert(std::is_nothrow_move_constructible_v<ImageAnim>);
+
 	int ImageAnimFrame::GetDuration() const
 	{
 		return Duration;
@@ -79,40 +98,6 @@ namespace ImageAnimation
 		SaveGIF(ofs, options);
 	}
 
-	using PaletteToIndexMap = std::array<std::array<std::array<int, 256>, 256>, 256>;
-	static std::shared_ptr<PaletteToIndexMap> BuildPaletteToIndexMap(const ColorTableItem* ColorTable, int NumColors)
-	{
-		auto ret = std::make_shared<PaletteToIndexMap>();
-
-#pragma omp parallel for
-		for (int R = 0; R < 256; R++)
-		{
-			for (int G = 0; G < 256; G++)
-			{
-				for (int B = 0; B < 256; B++)
-				{
-					int MinDiff = 0x7fffffff;
-					int MinDiffI = 0;
-					for (int i = 0; i < NumColors; i++)
-					{
-						int RD = R - ColorTable[i].R;
-						int GD = G - ColorTable[i].G;
-						int BD = B - ColorTable[i].B;
-						int Diff = RD * RD + GD * GD + BD * BD;
-						if (Diff < MinDiff)
-						{
-							MinDiff = Diff;
-							MinDiffI = i;
-						}
-					}
-					(*ret)[B][G][R] = MinDiffI;
-				}
-			}
-		}
-
-		return ret;
-	}
-
 	static const uint8_t DitherMatrix[16][16] =
 	{
 		{0x00, 0xEB, 0x3B, 0xDB, 0x0F, 0xE7, 0x37, 0xD7, 0x02, 0xE8, 0x38, 0xD9, 0x0C, 0xE5, 0x34, 0xD5},
@@ -226,42 +211,227 @@ namespace ImageAnimation
 		}
 	};
 
-	void ImageAnim::SaveGIF(std::ostream& ofs, SaveGIFOptions options) const
+	// 调色板，以及从颜色到调色板索引的映射表
+	struct GIFPalette
 	{
-		ofs.write("GIF89a", 6);
+		std::shared_ptr<ColorTableArray> ColorTable = nullptr;
+		std::shared_ptr<NearestColorLookup> ColorMap = nullptr;
+		std::shared_ptr<PaletteSearch> Search = nullptr;
+		bool IsExact = false;
 
-		std::shared_ptr<ColorTableArray> GlobalColorTable = nullptr;
-		std::shared_ptr<PaletteToIndexMap> GlobalColorTableMap = nullptr;
-		bool GlobalColorTableIsExact = false;
+		inline uint8_t GetNearest(int R, int G, int B) const
+		{
+			return ColorMap ? ColorMap->GetNearest(R, G, B) : Search->GetNearest(R, G, B);
+		}
+	};
 
-		if (!options.UseLocalPalettes)
+	// 要映射的像素较少时暴力搜索最近颜色，否则建表查找
+	static std::shared_ptr<GIFPalette> BuildGIFPalette(const std::vector<PaletteItem>& Palette, bool IsExact, size_t NumPixels)
+	{
+		auto ret = std::make_shared<GIFPalette>();
+		ret->ColorTable = std::make_shared<ColorTableArray>();
+		for (size_t i = 0; i < Palette.size(); i++)
 		{
-			GlobalColorTable = std::make_shared<ColorTableArray>();
+			auto& Color = Palette[i];
+			ret->ColorTable.get()->operator[](i) = ColorTableItem(Color.R, Color.G, Color.B);
+		}
+		if (NumPixels >= NearestColorLookup::MinPixelsForLookup)
+			ret->ColorMap = std::make_shared<NearestColorLookup>(Palette);
+		else
+			ret->Search = std::make_shared<PaletteSearch>(Palette);
+		ret->IsExact = IsExact;
+		return ret;
+	}
 
-			auto PalGen = PaletteGenerator(256);
-			for (auto& Frame : Frames)
+	// 有序抖动矩阵在 (x, y) 处的偏移量
+	static int GetOrderedDither(int x, int y)
+	{
+		int D = DitherMatrix[y & 0xF][x & 0xF];
+		return D * 32 / 256 - 16;
+	}
+
+	// 把一帧图像映射为调色板索引，按选项做有序抖动与 Floyd-Steinberg 误差扩散
+	static void MapFrameToIndices(const ImageAnimFrame& Frame, const GIFPalette& Palette, const SaveGIFOptions& options, DataSubBlock& FrameData)
+	{
+		auto Width = int(Frame.GetWidth());
+		auto Height = int(Frame.GetHeight());
+		auto& ColorTable = *Palette.ColorTable;
+
+		FrameData.resize(size_t(Width) * Height);
+		if (!Width || !Height) return;
+
+		if (Palette.IsExact || !options.UseFloydSteinberg)
+		{
+			// 没有误差扩散时像素之间互不相关，直接按行并行
+#pragma omp parallel for
+			for (int y = 0; y < Height; y++)
 			{
-				for (int y = 0; y < int(Frame.GetHeight()); y++)
+				auto DstRowPtr = &FrameData[size_t(y) * Width];
+				auto SrcRowPtr = Frame.GetBitmapRowPtr(y);
+				for (int x = 0; x < Width; x++)
 				{
-					auto rowptr = Frame.GetBitmapRowPtr(y);
-					for (int x = 0; x < int(Frame.GetWidth()); x++)
+					auto& SrcPix = SrcRowPtr[x];
+					RGBInt SrcRGB =
 					{
-						auto& Pix = rowptr[x];
-						PalGen.AddPixel(Pix.R, Pix.G, Pix.B);
+						SrcPix.R,
+						SrcPix.G,
+						SrcPix.B
+					};
+					if (!Palette.IsExact && options.UseOrderedPattern)
+					{
+						SrcRGB += GetOrderedDither(x, y);
+						SrcRGB.Clamp();
 					}
+					DstRowPtr[x] = uint8_t(Palette.GetNearest(SrcRGB.R, SrcRGB.G, SrcRGB.B));
+				}
+			}
+			return;
+		}
+
+		// Floyd-Steinberg 误差扩散：像素 (x, y) 用到的误差来自 (x - 1, y) 以及上一行的 x - 1 ~ x + 1，
+		// 所以上一行处理到 x + 2 以后这一行就可以处理到 x，各行像波前一样错开着并行，结果与逐行顺序处理完全相同。
+		// 每一行从上一行的误差缓冲读取、往下一行的误差缓冲写入，每一列只写一次；相邻两行至少错开两个像素，两个缓冲轮流使用就不会冲突。
+		constexpr int ProgressStep = 32; // 每处理这么多个像素公布一次进度
+		auto RowErrors = std::array<std::vector<RGBInt>, 2>{ std::vector<RGBInt>(Width), std::vector<RGBInt>(Width) };
+		auto Progress = std::vector<std::atomic<int>>(Height);
+
+#pragma omp parallel for schedule(static, 1)
+		for (int y = 0; y < Height; y++)
+		{
+			auto DstRowPtr = &FrameData[size_t(y) * Width];
+			auto SrcRowPtr = Frame.GetBitmapRowPtr(y);
+			auto& CurErrors = RowErrors[y & 1];
+			auto& NextErrors = RowErrors[(y + 1) & 1];
+			int AboveProgress = y ? 0 : Width;
+
+			auto RightErr = RGBInt(); // 扩散给右边像素的误差
+			auto DownErr = RGBInt(); // 已经累计好的扩散给下一行第 x 列的误差
+			auto DownRightErr = RGBInt(); // 已经累计好的扩散给下一行第 x + 1 列的误差
+			for (int x = 0; x < Width; x++)
+			{
+				int Needed = std::min(x + 2, Width);
+				while (AboveProgress < Needed)
+				{
+					AboveProgress = Progress[y - 1].load(std::memory_order_acquire);
+					if (AboveProgress < Needed) std::this_thread::yield();
 				}
+
+				auto& SrcPix = SrcRowPtr[x];
+				RGBInt SrcRGB =
+				{
+					SrcPix.R,
+					SrcPix.G,
+					SrcPix.B
+				};
+				SrcRGB += RightErr;
+				SrcRGB += CurErrors[x];
+				if (options.UseOrderedPattern) SrcRGB += GetOrderedDither(x, y);
+				RGBInt Clamped = SrcRGB;
+				Clamped.Clamp();
+				int index = Palette.GetNearest(Clamped.R, Clamped.G, Clamped.B);
+				RGBInt NewRGB =
+				{
+					ColorTable[index].R,
+					ColorTable[index].G,
+					ColorTable[index].B
+				};
+				RGBInt ErrRGB = SrcRGB - NewRGB;
+				RightErr = ErrRGB * 7 / 16;
+				if (x) NextErrors[x - 1] = DownErr + ErrRGB * 3 / 16;
+				DownErr = DownRightErr + ErrRGB * 5 / 16;
+				DownRightErr = ErrRGB * 1 / 16;
+				DstRowPtr[x] = uint8_t(index);
+
+				if ((x + 1) % ProgressStep == 0) Progress[y].store(x + 1, std::memory_order_release);
 			}
+			NextErrors[Width - 1] = DownErr;
+			Progress[y].store(Width, std::memory_order_release);
+		}
+	}
 
-			auto Palette = PalGen.GetColors();
-			for (size_t i = 0; i < Palette.size(); i++)
+	void ImageAnim::SaveGIF(std::ostream& ofs, SaveGIFOptions options) const
+	{
+		auto Palette = std::vector<PaletteItem>();
+		bool PaletteIsExact = false;
+
+		if (!options.UseLocalPalettes)
+		{
+			// 先统计所有帧的颜色直方图，每种颜色只交给调色板生成算法一次
+			auto Histogram = ColorHistogram();
+			for (auto& Frame : Frames)
 			{
-				auto& Color = Palette[i];
-				GlobalColorTable.get()->operator[](i) = ColorTableItem(Color.R, Color.G, Color.B);
+				Histogram.AddImage(Frame);
 			}
+			if (!options.Quantizer) options.Quantizer = std::make_shared<OctreeQuantizer>();
+			Palette = options.Quantizer->GetColors(Histogram, 256, PaletteIsExact);
+		}
+
+		auto Encoder = GIFEncoder(ofs, Width, Height, options, Palette, PaletteIsExact);
+		for (auto& Frame : Frames)
+		{
+			// 保存期间帧不会变化，不必复制
+			Encoder.PushFrame(std::shared_ptr<const ImageAnimFrame>(std::shared_ptr<const ImageAnimFrame>(), &Frame));
+		}
+		Encoder.Finalize();
+	}
+
+	static std::unique_ptr<std::ostream> OpenGIFFileForWrite(const std::string& OutputFile)
+	{
+		auto ofs = std::make_unique<std::ofstream>(OutputFile, std::ios::binary);
+		ofs->exceptions(std::ios::badbit | std::ios::failbit);
+		return ofs;
+	}
+
+	GIFEncoder::GIFEncoder(const std::string& OutputFile, uint32_t Width, uint32_t Height, SaveGIFOptions options, const std::vector<PaletteItem>& GlobalPalette, bool GlobalPaletteIsExact) :
+		OwnedStream(OpenGIFFileForWrite(OutputFile)),
+		ofs(*OwnedStream),
+		Width(Width),
+		Height(Height),
+		Options(options)
+	{
+		Init(GlobalPalette, GlobalPaletteIsExact);
+	}
+
+	GIFEncoder::GIFEncoder(std::ostream& ofs, uint32_t Width, uint32_t Height, SaveGIFOptions options, const std::vector<PaletteItem>& GlobalPalette, bool GlobalPaletteIsExact) :
+		ofs(ofs),
+		Width(Width),
+		Height(Height),
+		Options(options)
+	{
+		Init(GlobalPalette, GlobalPaletteIsExact);
+	}
 
-			GlobalColorTableIsExact = PalGen.IsPaletteExactFit();
-			GlobalColorTableMap = BuildPaletteToIndexMap(&GlobalColorTable->front(), int(Palette.size()));
+	GIFEncoder::~GIFEncoder()
+	{
+		try
+		{
+			Finalize();
 		}
+		catch (const std::exception& e)
+		{
+			std::cerr << "GIF: Failed to finalize GIF file: " << e.what() << "\n";
+		}
+		StopWorkers();
+	}
+
+	void GIFEncoder::Init(const std::vector<PaletteItem>& GlobalPalette, bool GlobalPaletteIsExact)
+	{
+		if (!Options.Quantizer) Options.Quantizer = std::make_shared<OctreeQuantizer>();
+		if (!Options.UseLocalPalettes && GlobalPalette.size())
+		{
+			this->GlobalPalette = BuildGIFPalette(GlobalPalette, GlobalPaletteIsExact, SIZE_MAX);
+		}
+
+		// 使用全局调色板但没有给出时，文件头要等到第一帧用它生成调色板后再写
+		if (Options.UseLocalPalettes || this->GlobalPalette) WriteHeader();
+	}
+
+	void GIFEncoder::WriteHeader()
+	{
+		ofs.write("GIF89a", 6);
+
+		std::shared_ptr<ColorTableArray> GlobalColorTable = nullptr;
+		if (GlobalPalette) GlobalColorTable = GlobalPalette->ColorTable;
 
 		auto LSD = LogicalScreenDescriptorType(Width, Height,
 			LogicalScreenDescriptorType::MakeBitfields(GlobalColorTable ?  true: false, 8, false, 256),
@@ -275,7 +445,7 @@ namespace ImageAnimation
 			uint16_t u16;
 		}NumLoops;
 
-		if (options.numLoops) NumLoops.u16 = options.numLoops - 1;
+		if (Options.numLoops) NumLoops.u16 = Options.numLoops - 1;
 		else NumLoops.u16 = 0;
 
 		auto AE = ApplicationExtensionType{ 0x0B, "NETSCAPE", "2.0", {1, NumLoops.u8[0], NumLoops.u8[1]} };
@@ -283,157 +453,270 @@ namespace ImageAnimation
 		Write(ofs, uint8_t(0xFF));
 		AE.WriteFile(ofs);
 
-		auto FramesData = std::vector<DataSubBlock>();
-		FramesData.resize(Frames.size());
+		HeaderWritten = true;
+	}
+
+	void GIFEncoder::PushFrame(const ImageAnimFrame& Frame)
+	{
+		PushFrame(std::make_shared<const ImageAnimFrame>(Frame));
+	}
 
-		bool DoFirstFrameHasTransparent = false;
+	void GIFEncoder::PushFrame(std::shared_ptr<const ImageAnimFrame> Frame)
+	{
+		if (Finalized) throw EncodeError("GIF: Can't push frames into a finalized GIF encoder.");
+		if (Frame->GetWidth() != Width || Frame->GetHeight() != Height)
+		{
+			throw std::invalid_argument(std::string("GIF: Frame size ") + std::to_string(Frame->GetWidth()) + "x" + std::to_string(Frame->GetHeight()) + " does not match the GIF size " + std::to_string(Width) + "x" + std::to_string(Height) + ".");
+		}
 
-		for (size_t i = 0; i < Frames.size(); i++)
+		if (!HeaderWritten)
+		{ // 用第一帧生成全局调色板
+			bool PaletteIsExact = false;
+			auto Palette = QuantizeColors(*Frame, 256, *Options.Quantizer, PaletteIsExact);
+			GlobalPalette = BuildGIFPalette(Palette, PaletteIsExact, SIZE_MAX);
+			WriteHeader();
+		}
+
+		// 流水线满了就先写入最早的帧，腾出位置
+		if (Workers.empty()) StartWorkers();
+		WriteEncodedFrames(GetMaxFramesInFlight());
+
+		auto Pending = PendingFrame();
+		Pending.Duration = Frame->GetDuration() < 0 ? Options.Interval : Frame->GetDuration();
+		Pending.Source = std::move(Frame);
+		if (!Options.UseLocalPalettes) Pending.Palette = GlobalPalette;
 		{
-			auto& Frame = Frames[i];
-			uint8_t Bitfields = 0;
+			auto Lock = std::lock_guard(Mutex);
+			PendingFrames.push_back(std::move(Pending));
+		}
+		WorkReady.notify_one();
+		NumFrames++;
+	}
+
+	size_t GIFEncoder::GetMaxFramesInFlight() const
+	{
+		if (Options.MaxFramesInFlight > 0) return size_t(Options.MaxFramesInFlight);
+		return std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	std::string GIFEncoder::EncodeFrame(const PendingFrame& Frame, const std::vector<uint8_t>& PrevIndices) const
+	{
+		auto& CurIndices = *Frame.Indices;
+
+		uint8_t Bitfields = 0;
 
-			Bitfields = GraphicControlExtensionType::MakeBitfields(GraphicControlExtensionType::DisposalMethodEnum::DoNotDispose, false, true);
+		Bitfields = GraphicControlExtensionType::MakeBitfields(GraphicControlExtensionType::DisposalMethodEnum::DoNotDispose, false, true);
 
-			auto GCE = GraphicControlExtensionType(4, Bitfields,
-				Frame.GetDuration() < 0 ? options.Interval : Frame.GetDuration(),
-				0xFF);
+		auto GCE = GraphicControlExtensionType(4, Bitfields, Frame.Duration, 0xFF);
 
-			std::shared_ptr<ColorTableArray> LocalColorTable = nullptr;
-			std::shared_ptr<PaletteToIndexMap> ColorTableMap = nullptr;
-			bool ColorTableIsExact = false;
-			if (options.UseLocalPalettes)
+		// 与上一帧相同的像素使用透明色，并且只写入发生变化的像素所在的矩形区域。第一帧没有上一帧，写入整幅图像
+		uint32_t Left = 0, Top = 0, Right = Width, Bottom = Height;
+		DataSubBlock OFD;
+		if (PrevIndices.size() && !Options.UseLocalPalettes)
+		{
+			Left = Width; Top = Height; Right = 0; Bottom = 0;
+			for (uint32_t y = 0; y < Height; y++)
 			{
-				auto Palette = PaletteGenerator::GetColors(Frame, 256, ColorTableIsExact);
-				LocalColorTable = std::make_shared<ColorTableArray>();
-				for (size_t i = 0; i < Palette.size(); i++)
-				{
-					auto& Color = Palette[i];
-					LocalColorTable.get()->operator[](i) = ColorTableItem(Color.R, Color.G, Color.B);
-				}
-				ColorTableMap = BuildPaletteToIndexMap(&LocalColorTable->front(), int(Palette.size()));
+				auto CurRowPtr = &CurIndices[size_t(y) * Width];
+				auto LstRowPtr = &PrevIndices[size_t(y) * Width];
+				uint32_t x0 = 0, x1 = Width;
+				while (x0 < Width && CurRowPtr[x0] == LstRowPtr[x0]) x0++;
+				if (x0 == Width) continue;
+				while (CurRowPtr[x1 - 1] == LstRowPtr[x1 - 1]) x1--;
+				Left = std::min(Left, x0);
+				Right = std::max(Right, x1);
+				Top = std::min(Top, y);
+				Bottom = y + 1;
+			}
+
+			// 与上一帧完全相同时，写入一个透明像素以保留这一帧的时长
+			if (Right <= Left)
+			{
+				Left = 0; Top = 0; Right = 1; Bottom = 1;
 			}
-			else
+
+			auto RectWidth = Right - Left;
+			OFD.resize(size_t(RectWidth) * (Bottom - Top));
+			for (uint32_t y = Top; y < Bottom; y++)
 			{
-				LocalColorTable = GlobalColorTable;
-				ColorTableMap = GlobalColorTableMap;
-				ColorTableIsExact = GlobalColorTableIsExact;
+				auto DstRowPtr = &OFD[size_t(y - Top) * RectWidth];
+				auto CurRowPtr = &CurIndices[size_t(y) * Width + Left];
+				auto LstRowPtr = &PrevIndices[size_t(y) * Width + Left];
+				for (uint32_t x = 0; x < RectWidth; x++)
+				{
+					DstRowPtr[x] = CurRowPtr[x] == LstRowPtr[x] ? 0xFF : CurRowPtr[x];
+				}
 			}
+		}
+		else
+		{
+			OFD = CurIndices;
+		}
 
-			auto& ColorTable = *LocalColorTable;
-			auto& ColorMap = *ColorTableMap;
+		auto ID = ImageDescriptorType
+		{
+			uint16_t(Left), uint16_t(Top),
+			uint16_t(Right - Left), uint16_t(Bottom - Top),
+			ImageDescriptorType::MakeBitfields(Options.UseLocalPalettes, false, false, 256),
+			Frame.Palette->ColorTable,
+			std::move(OFD)
+		};
+
+		auto ss = std::ostringstream(std::ios::binary);
+		Write(ss, uint8_t(0x21));
+		Write(ss, uint8_t(0xF9));
+		GCE.WriteFile(ss);
+
+		Write(ss, uint8_t(0x2C));
+		ID.WriteFile(ss, 8);
+		return ss.str();
+	}
 
-			auto& FrameData = FramesData[i];
-			FrameData.resize(size_t(Width) * Height);
+	void GIFEncoder::StartWorkers()
+	{
+		auto NumWorkers = std::min(GetMaxFramesInFlight(), size_t(std::max(1u, std::thread::hardware_concurrency())));
 
-			DataSubBlock* LastFramePtr = nullptr;
-			if (i) LastFramePtr = &FramesData[i - 1];
-			else LastFramePtr = &FramesData[i];
+		// 几个工作线程同时映射不同的帧，每一帧内部用的 OpenMP 线程相应减少，总数与调用者的设置相当
+#ifdef _OPENMP
+		WorkerThreads = std::max(1, omp_get_max_threads() / int(NumWorkers));
+#endif
+		for (size_t i = 0; i < NumWorkers; i++)
+		{
+			Workers.emplace_back(&GIFEncoder::WorkerProc, this);
+		}
+	}
 
-			auto& LastFrame = *LastFramePtr;
+	void GIFEncoder::StopWorkers()
+	{
+		{
+			auto Lock = std::lock_guard(Mutex);
+			StopRequested = true;
+		}
+		WorkReady.notify_all();
+		for (auto& Worker : Workers)
+		{
+			Worker.join();
+		}
+		Workers.clear();
+	}
 
-			auto NextPix = RGBInt();
-			auto NextLine = std::vector<RGBInt>();
-			NextLine.resize(Width);
-			auto DownPix = std::array<RGBInt, 3>();
+	// 在锁内挑一件工作：优先压缩最早的、自身与上一帧都已经映射好的帧，让帧尽早写出、释放内存；没有的话映射最早的还没有映射的帧
+	bool GIFEncoder::TakeTask(PendingFrame*& ToMap, PendingFrame*& ToEncode, IndicesPtr& PrevIndices)
+	{
+		for (size_t i = 0; i < PendingFrames.size(); i++)
+		{
+			auto& Frame = PendingFrames[i];
+			if (!Frame.Indices || Frame.Encoding) continue;
+			auto& Prev = i ? PendingFrames[i - 1].Indices : LastFrameIndices;
+			if (i && !Prev && !Options.UseLocalPalettes) continue;
+			Frame.Encoding = true;
+			ToEncode = &Frame;
+			PrevIndices = Prev;
+			return true;
+		}
+		for (auto& Frame : PendingFrames)
+		{
+			if (Frame.Mapping) continue;
+			Frame.Mapping = true;
+			ToMap = &Frame;
+			return true;
+		}
+		return false;
+	}
 
-			for (int y = 0; y < int(Height); y++)
+	void GIFEncoder::WorkerProc()
+	{
+#ifdef _OPENMP
+		omp_set_num_threads(WorkerThreads);
+#endif
+		static const std::vector<uint8_t> NoIndices;
+		auto Lock = std::unique_lock(Mutex);
+		for (;;)
+		{
+			PendingFrame* ToMap = nullptr;
+			PendingFrame* ToEncode = nullptr;
+			IndicesPtr PrevIndices = nullptr;
+			WorkReady.wait(Lock, [&]() { return StopRequested || TakeTask(ToMap, ToEncode, PrevIndices); });
+			if (!ToMap && !ToEncode) return;
+
+			// 在 deque 首尾增删不会移动其它元素，写入线程只移走压缩好的帧，所以解锁期间指针一直有效
+			try
 			{
-				auto DstRowPtr = &FrameData[y * Width];
-				auto SrcRowPtr = Frame.GetBitmapRowPtr(y);
-				auto LstRowPtr = &LastFrame[y * Width];
-				for (int x = 0; x < int(Width); x++)
+				if (ToEncode)
 				{
-					auto& SrcPix = SrcRowPtr[x];
-					RGBInt SrcRGB =
-					{
-						SrcPix.R,
-						SrcPix.G,
-						SrcPix.B
-					};
-					if (ColorTableIsExact)
-					{
-						DstRowPtr[x] = uint8_t(ColorMap[SrcRGB.B][SrcRGB.G][SrcRGB.R]);
-					}
-					else
-					{
-						if (options.UseFloydSteinberg)
-						{
-							SrcRGB += NextPix;
-							SrcRGB += NextLine[x];
-							if (options.UseOrderedPattern)
-							{
-								int D = DitherMatrix[y & 0xF][x & 0xF];
-								D = D * 32 / 256 - 16;
-								SrcRGB += D;
-							}
-							RGBInt Clamped = SrcRGB;
-							Clamped.Clamp();
-							int index = ColorMap[Clamped.B][Clamped.G][Clamped.R];
-							RGBInt NewRGB =
-							{
-								ColorTable[index].R,
-								ColorTable[index].G,
-								ColorTable[index].B
-							};
-							RGBInt ErrRGB = SrcRGB - NewRGB;
-							NextPix = ErrRGB * 7 / 16;
-							if (x) NextLine[x - 1] = DownPix[0];
-							DownPix[0] = DownPix[1] + ErrRGB * 3 / 16;
-							DownPix[1] = DownPix[2] + ErrRGB * 5 / 16;
-							DownPix[2] = ErrRGB * 1 / 16;
-							DstRowPtr[x] = uint8_t(index);
-						}
-						else if (options.UseOrderedPattern)
-						{
-							int D = DitherMatrix[y & 0xF][x & 0xF];
-							D = D * 32 / 256 - 16;
-							SrcRGB += D;
-							SrcRGB.Clamp();
-							DstRowPtr[x] = uint8_t(ColorMap[SrcRGB.B][SrcRGB.G][SrcRGB.R]);
-						}
-						else
-						{
-							DstRowPtr[x] = uint8_t(ColorMap[SrcRGB.B][SrcRGB.G][SrcRGB.R]);
-						}
-					}
+					Lock.unlock();
+					auto Block = EncodeFrame(*ToEncode, PrevIndices ? *PrevIndices : NoIndices);
+					Lock.lock();
+					ToEncode->Block = std::move(Block);
+					ToEncode->Encoded = true;
 				}
-			}
-
-			DataSubBlock OFD = FrameData;
-			if (i && !options.UseLocalPalettes)
-			{
-				for (int y = 0; y < int(Height); y++)
+				else
 				{
-					auto DstRowPtr = &OFD[y * Width];
-					auto LstRowPtr = &LastFrame[y * Width];
-					for (int x = 0; x < int(Width); x++)
+					auto Source = ToMap->Source;
+					auto Palette = ToMap->Palette;
+					Lock.unlock();
+					if (!Palette)
 					{
-						if (DstRowPtr[x] == LstRowPtr[x])
-						{
-							DstRowPtr[x] = 0xFF;
-						}
+						bool PaletteIsExact = false;
+						auto LocalPalette = QuantizeColors(*Source, 256, *Options.Quantizer, PaletteIsExact);
+						Palette = BuildGIFPalette(LocalPalette, PaletteIsExact, size_t(Width) * Height);
 					}
+					auto Indices = std::make_shared<std::vector<uint8_t>>();
+					MapFrameToIndices(*Source, *Palette, Options, *Indices);
+					Source = nullptr;
+					Lock.lock();
+					ToMap->Palette = std::move(Palette);
+					ToMap->Indices = std::move(Indices);
+					ToMap->Source = nullptr;
 				}
 			}
-
-			auto ID = ImageDescriptorType
+			catch (...)
 			{
-				0, 0,
-				uint16_t(Width), uint16_t(Height),
-				ImageDescriptorType::MakeBitfields(options.UseLocalPalettes, false, false, 256),
-				LocalColorTable,
-				std::move(OFD)
-			};
+				if (!Lock.owns_lock()) Lock.lock();
+				if (!WorkerError) WorkerError = std::current_exception();
+			}
 
-			Write(ofs, uint8_t(0x21));
-			Write(ofs, uint8_t(0xF9));
-			GCE.WriteFile(ofs);
+			// 映射好一帧可能让它自己和下一帧可以压缩
+			WorkReady.notify_all();
+			FrameDone.notify_all();
+		}
+	}
 
-			Write(ofs, uint8_t(0x2C));
-			ID.WriteFile(ofs, 8);
+	// 按顺序写入已经压缩好的帧，直到流水线里的帧少于 MaxInFlight。写入时不持有锁，工作线程可以继续
+	void GIFEncoder::WriteEncodedFrames(size_t MaxInFlight)
+	{
+		auto Lock = std::unique_lock(Mutex);
+		for (;;)
+		{
+			if (WorkerError) std::rethrow_exception(WorkerError);
+			if (PendingFrames.size() && PendingFrames.front().Encoded)
+			{
+				auto Block = std::move(PendingFrames.front().Block);
+				LastFrameIndices = std::move(PendingFrames.front().Indices);
+				PendingFrames.pop_front();
+				Lock.unlock();
+				ofs.write(Block.data(), Block.size());
+				Lock.lock();
+				continue;
+			}
+			if (PendingFrames.size() < MaxInFlight) return;
+			FrameDone.wait(Lock);
 		}
+	}
 
+	void GIFEncoder::Finalize()
+	{
+		if (Finalized) return;
+		Finalized = true;
+		if (!HeaderWritten) WriteHeader();
+		WriteEncodedFrames(1);
+		StopWorkers();
 		Write(ofs, uint8_t(0x3B));
+		ofs.flush();
+	}
+
+	size_t GIFEncoder::GetNumFrames() const
+	{
+		return NumFrames;
 	}
 }
@@ -1,8 +1,14 @@
 #pragma once
 
 #include "unibmp.hpp"
+#include "PaletteGen.hpp"
 
+#include <condition_variable>
+#include <deque>
+#include <exception>
 #include <fstream>
+#include <mutex>
+#include <thread>
 
 namespace ImageAnimation
 {
@@ -15,6 +21,7 @@ namespace ImageAnimation
 
 	public:
 		ImageAnimFrame(const Image_RGBA8& c, int Duration);
+		ImageAnimFrame(Image_RGBA8&& c, int Duration) noexcept;
 
 		using Image_RGBA8::Image;
 		int GetDuration() const;
@@ -25,8 +32,10 @@ namespace ImageAnimation
 		bool UseLocalPalettes = false;
 		bool UseOrderedPattern = true;
 		bool UseFloydSteinberg = true;
+		std::shared_ptr<const PaletteGeneratorLib::ColorQuantizer> Quantizer = std::make_shared<PaletteGeneratorLib::OctreeQuantizer>(); // 生成调色板的算法，为空时使用八叉树
 		int Interval = 1;
 		int numLoops = 0;
+		int MaxFramesInFlight = 0; // 编码流水线里同时存在的帧数上限，0 表示按 CPU 核数决定。决定了编码时额外占用的内存
 	};
 
 	class ImageAnim
@@ -50,4 +59,78 @@ namespace ImageAnimation
 		void SaveGIF(const std::string& OutputFile, SaveGIFOptions options) const;
 		void SaveGIF(std::ostream& ofs, SaveGIFOptions options) const;
 	};
+
+	// 调色板及其颜色索引映射表，定义在 ImageAnim.cpp
+	struct GIFPalette;
+
+	// 流式 GIF 编码器：逐帧压入，最后结束。只保留上一帧的索引数据用于透明差分，内存占用与帧数无关。
+	// 使用全局调色板但没有给出时，用第一帧生成全局调色板。
+	// 编码是一条流水线：后台线程把压入的帧映射为调色板索引（生成局部调色板、抖动），再与上一帧差分、LZW 压缩，压缩好的帧由调用者的线程按顺序写入。
+	// 一帧的压缩与后面几帧的映射同时进行。流水线里最多有 `SaveGIFOptions::MaxFramesInFlight` 帧，满了以后 PushFrame() 等到最早的一帧写入为止。输出与逐帧处理相同。
+	class GIFEncoder
+	{
+	protected:
+		std::unique_ptr<std::ostream> OwnedStream = nullptr;
+		std::ostream& ofs;
+		uint32_t Width;
+		uint32_t Height;
+		SaveGIFOptions Options;
+
+		using IndicesPtr = std::shared_ptr<const std::vector<uint8_t>>;
+
+		// 流水线里的一帧：映射之前持有源图像，映射之后持有调色板索引，压缩之后持有要写入的数据块
+		struct PendingFrame
+		{
+			std::shared_ptr<const ImageAnimFrame> Source;
+			std::shared_ptr<GIFPalette> Palette;
+			IndicesPtr Indices;
+			std::string Block;
+			int Duration;
+			bool Mapping = false;
+			bool Encoding = false;
+			bool Encoded = false;
+		};
+
+		std::shared_ptr<GIFPalette> GlobalPalette = nullptr;
+		IndicesPtr LastFrameIndices; // 最后写入的一帧的索引
+		std::deque<PendingFrame> PendingFrames;
+		size_t NumFrames = 0;
+		bool HeaderWritten = false;
+		bool Finalized = false;
+
+		// 以下成员由 Mutex 保护。WorkReady 通知工作线程有帧可以映射或压缩，FrameDone 通知写入线程有帧处理完
+		std::vector<std::thread> Workers;
+		std::mutex Mutex;
+		std::condition_variable WorkReady;
+		std::condition_variable FrameDone;
+		std::exception_ptr WorkerError = nullptr;
+		bool StopRequested = false;
+		int WorkerThreads = 1; // 每个工作线程映射一帧时使用的 OpenMP 线程数
+
+		void Init(const std::vector<PaletteGeneratorLib::PaletteItem>& GlobalPalette, bool GlobalPaletteIsExact);
+		void WriteHeader();
+		size_t GetMaxFramesInFlight() const;
+		std::string EncodeFrame(const PendingFrame& Frame, const std::vector<uint8_t>& PrevIndices) const;
+		void StartWorkers();
+		void StopWorkers();
+		void WorkerProc();
+		bool TakeTask(PendingFrame*& ToMap, PendingFrame*& ToEncode, IndicesPtr& PrevIndices);
+		void WriteEncodedFrames(size_t MaxInFlight);
+
+	public:
+		GIFEncoder(const std::string& OutputFile, uint32_t Width, uint32_t Height, SaveGIFOptions options, const std::vector<PaletteGeneratorLib::PaletteItem>& GlobalPalette = {}, bool GlobalPaletteIsExact = false);
+		GIFEncoder(std::ostream& ofs, uint32_t Width, uint32_t Height, SaveGIFOptions options, const std::vector<PaletteGeneratorLib::PaletteItem>& GlobalPalette = {}, bool GlobalPaletteIsExact = false);
+		GIFEncoder(const GIFEncoder&) = delete;
+		GIFEncoder& operator=(const GIFEncoder&) = delete;
+		~GIFEncoder();
+
+		// 复制一份帧交给流水线
+		void PushFrame(const ImageAnimFrame& Frame);
+
+		// 直接把帧交给流水线，不复制像素。这一帧写入之前不能修改它
+		void PushFrame(std::shared_ptr<const ImageAnimFrame> Frame);
+
+		void Finalize();
+		size_t GetNumFrames() const;
+	};
 };
@@ -1,22 +1,30 @@
 #include "PaletteGen.hpp"
 
 #include <assert.h>
+#include <algorithm>
+#include <cstdlib>
+#include <stdexcept>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define PALETTEGEN_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#else
+#define PALETTEGEN_X86 0
+#endif
+
+// GCC 与 Clang 需要给使用 SSE4.1 / AVX2 指令的函数单独指定指令集，MSVC 不需要
+#if defined(__GNUC__) || defined(__clang__)
+#define PALETTEGEN_TARGET(isa) __attribute__((target(isa)))
+#else
+#define PALETTEGEN_TARGET(isa)
+#endif
 
 namespace PaletteGeneratorLib
 {
-	static size_t GetNumColors(ColorNode& Node)
-	{
-		if (Node.IsLeaf) return 1;
-		
-		size_t ret = 0;
-		for (int i = 0; i < 8; i++)
-		{
-			if (Node.SubNodes[i] == nullptr) continue;
-			ret += GetNumColors(*Node.SubNodes[i]);
-		}
-		return ret;
-	}
-
 	bool PaletteItem::operator<(const PaletteItem& Other) const
 	{
 		return ToRGBA(0) < Other.ToRGBA(0);
@@ -52,8 +60,37 @@ namespace PaletteGeneratorLib
 		return ret.u32;
 	}
 
-	bool PaletteGenerator::ReduceNode(ColorNode& Node)
+	uint32_t PaletteGenerator::NewNode()
+	{
+		if (FreeNodes)
+		{
+			auto Index = FreeNodes;
+			FreeNodes = Nodes[Index].NextNode;
+			Nodes[Index] = ColorNode();
+			return Index;
+		}
+		Nodes.emplace_back();
+		return uint32_t(Nodes.size() - 1);
+	}
+
+	void PaletteGenerator::FreeNode(uint32_t Index)
+	{
+		Nodes[Index].NextNode = FreeNodes;
+		FreeNodes = Index;
+	}
+
+	void PaletteGenerator::AddReducible(int Level, uint32_t Index)
+	{
+		auto& Node = Nodes[Index];
+		if (Node.IsReducible) return;
+		Node.IsReducible = true;
+		Node.NextNode = ReducibleHead[Level];
+		ReducibleHead[Level] = Index;
+	}
+
+	bool PaletteGenerator::ReduceNode(uint32_t Index)
 	{
+		auto& Node = Nodes[Index];
 		if (Node.IsLeaf)
 		{
 			return false;
@@ -63,14 +100,16 @@ namespace PaletteGeneratorLib
 			auto PrevNumColors = NumColors;
 			for (int j = 0; j < 8; j++)
 			{
-				if (!Node.SubNodes[j]) continue;
-				auto& Sub = *Node.SubNodes[j];
-				if (!Sub.IsLeaf) ReduceNode(Sub);
+				auto SubIndex = Node.SubNodes[j];
+				if (!SubIndex) continue;
+				auto& Sub = Nodes[SubIndex];
+				if (!Sub.IsLeaf) ReduceNode(SubIndex);
 				Node.RSum += Sub.RSum;
 				Node.GSum += Sub.GSum;
 				Node.BSum += Sub.BSum;
 				Node.NumPixels += Sub.NumPixels;
-				Node.SubNodes[j].reset();
+				Node.SubNodes[j] = 0;
+				FreeNode(SubIndex);
 				NumColors -= 1;
 			}
 			Node.IsLeaf = true;
@@ -79,27 +118,22 @@ namespace PaletteGeneratorLib
 		}
 	}
 
+	// 合并最深一层的一个可合并节点，没有可合并的节点时返回 false
 	bool PaletteGenerator::ReduceTree()
 	{
-		int MaxLevel = 0;
-		ColorNode* NodePtr = nullptr;
-
 		DoPaletteExactFit = false;
 
-		int i;
-		for (i = 0; i < 8; i++)
+		for (int i = 0; i < 8; i++)
 		{
-			if (!ReducibleNodes[i].size()) continue;
-			auto it = ReducibleNodes[i].begin();
-			NodePtr = *it;
-			ReducibleNodes[i].erase(it);
-			break;
+			if (!ReducibleHead[i]) continue;
+			auto Index = ReducibleHead[i];
+			auto& Node = Nodes[Index];
+			ReducibleHead[i] = Node.NextNode;
+			Node.IsReducible = false;
+			ReduceNode(Index);
+			return true;
 		}
-		assert(i < 8);
-		if (NodePtr)
-			return ReduceNode(*NodePtr);
-		else
-			return false;
+		return false;
 	}
 
 	PaletteGenerator::PaletteGenerator(size_t MaxColors) :
@@ -109,7 +143,12 @@ namespace PaletteGeneratorLib
 
 	void PaletteGenerator::AddPixel(uint8_t R, uint8_t G, uint8_t B)
 	{
-		ColorNode* NodePtr = &RootNode;
+		AddPixel(R, G, B, 1);
+	}
+
+	void PaletteGenerator::AddPixel(uint8_t R, uint8_t G, uint8_t B, uint64_t Count)
+	{
+		uint32_t NodeIndex = 0;
 		int i;
 		for (i = 7; i >= 0; i--)
 		{
@@ -118,24 +157,26 @@ namespace PaletteGeneratorLib
 				(((G >> i) & 1) << 1) |
 				(((B >> i) & 1) << 2);
 
-			if (!NodePtr->IsLeaf)
+			if (!Nodes[NodeIndex].IsLeaf)
 			{
 				bool NodeCreated = false;
-				if (!NodePtr->SubNodes[index])
+				auto SubIndex = Nodes[NodeIndex].SubNodes[index];
+				if (!SubIndex)
 				{
 					NodeCreated = true;
-					NodePtr->SubNodes[index] = std::make_shared<ColorNode>();
+					SubIndex = NewNode(); // 可能导致节点池重新分配，之后才能再取节点的引用
+					Nodes[NodeIndex].SubNodes[index] = SubIndex;
 				}
-				NodePtr = NodePtr->SubNodes[index].get();
+				NodeIndex = SubIndex;
 				if (i == 0)
 				{
-					NodePtr->IsLeaf = true;
+					Nodes[NodeIndex].IsLeaf = true;
 					if (NodeCreated) NumColors++;
 					break;
 				}
-				else
+				else if (!Nodes[NodeIndex].IsLeaf)
 				{
-					ReducibleNodes[i].insert(NodePtr);
+					AddReducible(i, NodeIndex);
 				}
 			}
 			else
@@ -144,26 +185,26 @@ namespace PaletteGeneratorLib
 			}
 		}
 		assert(i >= 0);
-		auto& Node = *NodePtr;
-		Node.RSum += R;
-		Node.GSum += G;
-		Node.BSum += B;
-		Node.NumPixels++;
-		NumPixels++;
-		for(int i = 0; i < 8; i++)
+		auto& Node = Nodes[NodeIndex];
+		Node.RSum += R * Count;
+		Node.GSum += G * Count;
+		Node.BSum += B * Count;
+		Node.NumPixels += Count;
+		NumPixels += Count;
+		while (NumColors > MaxColors)
 		{
-			if (NumColors > MaxColors) ReduceTree();
-			else break;
+			if (!ReduceTree()) break;
 		}
 	}
 
-	void PaletteGenerator::GetColors(const ColorNode& Node, std::vector<PaletteItem>& Palette)
+	void PaletteGenerator::GetColors(uint32_t Index, std::vector<PaletteItem>& Palette) const
 	{
+		auto& Node = Nodes[Index];
 		for (int i = 0; i < 8; i++)
 		{
 			if (Node.SubNodes[i])
 			{
-				auto& SubNode = *Node.SubNodes[i];
+				auto& SubNode = Nodes[Node.SubNodes[i]];
 				if (SubNode.IsLeaf)
 				{
 					Palette.push_back(PaletteItem
@@ -175,16 +216,24 @@ namespace PaletteGeneratorLib
 				}
 				else
 				{
-					GetColors(SubNode, Palette);
+					GetColors(Node.SubNodes[i], Palette);
 				}
 			}
 		}
 	}
 
+	void PaletteGenerator::AddColors(const ColorHistogram& Histogram)
+	{
+		for (auto& Color : Histogram.GetColors())
+		{
+			AddPixel(Color.R, Color.G, Color.B, Color.Count);
+		}
+	}
+
 	std::vector<PaletteItem> PaletteGenerator::GetColors()
 	{
 		auto Palette = std::vector<PaletteItem>();
-		GetColors(RootNode, Palette);
+		GetColors(0, Palette);
 		return Palette;
 	}
 	bool PaletteGenerator::IsPaletteExactFit() const
@@ -193,17 +242,603 @@ namespace PaletteGeneratorLib
 	}
 	std::vector<PaletteItem> PaletteGenerator::GetColors(const UniformBitmap::Image_RGBA8& image, size_t MaxColors, bool& PaletteIsExact)
 	{
-		auto PalGen = PaletteGenerator(MaxColors);
-		for (int y = 0; y < int(image.GetHeight()); y++)
+		// 先多线程统计每种颜色的像素数，再把每种颜色只往八叉树里加一次
+		return QuantizeColors(image, MaxColors, OctreeQuantizer(), PaletteIsExact);
+	}
+
+	ColorHistogram::ColorHistogram() :
+		BucketOffsets(NumBuckets),
+		Counts(BucketSize)
+	{
+	}
+
+	uint32_t& ColorHistogram::GetCount(uint8_t R, uint8_t G, uint8_t B)
+	{
+		auto Bucket =
+			(size_t(R >> SubBits) << (BucketBits * 0)) |
+			(size_t(G >> SubBits) << (BucketBits * 1)) |
+			(size_t(B >> SubBits) << (BucketBits * 2));
+		auto Sub =
+			(size_t(R & ((1 << SubBits) - 1)) << (SubBits * 0)) |
+			(size_t(G & ((1 << SubBits) - 1)) << (SubBits * 1)) |
+			(size_t(B & ((1 << SubBits) - 1)) << (SubBits * 2));
+		auto& Offset = BucketOffsets[Bucket];
+		if (!Offset)
+		{
+			Offset = uint32_t(Counts.size());
+			Counts.resize(Counts.size() + BucketSize);
+		}
+		return Counts[Offset + Sub];
+	}
+
+	void ColorHistogram::AddColor(uint8_t R, uint8_t G, uint8_t B, uint32_t Count)
+	{
+		if (!Count) return;
+		auto& Slot = GetCount(R, G, B);
+		if (!Slot) NumColors++;
+		Slot += Count;
+	}
+
+	void ColorHistogram::AddPixels(const UniformBitmap::Pixel_RGBA8* Pixels, size_t Count)
+	{
+		// 相邻像素经常是同一种颜色，连续相同的像素只计数一次
+		size_t i = 0;
+		while (i < Count)
+		{
+			auto& Pix = Pixels[i];
+			uint32_t RunLength = 1;
+			while (i + RunLength < Count && Pixels[i + RunLength].R == Pix.R && Pixels[i + RunLength].G == Pix.G && Pixels[i + RunLength].B == Pix.B) RunLength++;
+			AddColor(Pix.R, Pix.G, Pix.B, RunLength);
+			i += RunLength;
+		}
+	}
+
+	void ColorHistogram::Merge(const ColorHistogram& Other)
+	{
+		for (size_t Bucket = 0; Bucket < NumBuckets; Bucket++)
+		{
+			auto OtherOffset = Other.BucketOffsets[Bucket];
+			if (!OtherOffset) continue;
+			auto& Offset = BucketOffsets[Bucket];
+			if (!Offset)
+			{
+				Offset = uint32_t(Counts.size());
+				Counts.resize(Counts.size() + BucketSize);
+			}
+			for (size_t Sub = 0; Sub < BucketSize; Sub++)
+			{
+				auto Count = Other.Counts[OtherOffset + Sub];
+				if (!Count) continue;
+				auto& Slot = Counts[Offset + Sub];
+				if (!Slot) NumColors++;
+				// 合并多帧的直方图时计数可能超过 32 位，饱和即可，不影响调色板
+				Slot = uint32_t(std::min<uint64_t>(uint64_t(Slot) + Count, UINT32_MAX));
+			}
+		}
+	}
+
+	void ColorHistogram::AddImage(const UniformBitmap::Image_RGBA8& image)
+	{
+		auto Width = size_t(image.GetWidth());
+		auto Height = int(image.GetHeight());
+#pragma omp parallel
+		{
+			auto Local = ColorHistogram();
+#pragma omp for nowait
+			for (int y = 0; y < Height; y++)
+			{
+				Local.AddPixels(image.GetBitmapRowPtr(y), Width);
+			}
+#pragma omp critical
+			Merge(Local);
+		}
+	}
+
+	size_t ColorHistogram::GetNumColors() const
+	{
+		return NumColors;
+	}
+
+	std::vector<ColorHistogram::ColorCount> ColorHistogram::GetColors() const
+	{
+		constexpr int SubMask = (1 << SubBits) - 1;
+		constexpr int BucketMask = (1 << BucketBits) - 1;
+		auto ret = std::vector<ColorCount>();
+		ret.reserve(NumColors);
+		for (size_t Bucket = 0; Bucket < NumBuckets; Bucket++)
+		{
+			auto Offset = BucketOffsets[Bucket];
+			if (!Offset) continue;
+			for (size_t Sub = 0; Sub < BucketSize; Sub++)
+			{
+				auto Count = Counts[Offset + Sub];
+				if (!Count) continue;
+				ret.push_back(ColorCount
+				{
+					uint8_t(((Bucket >> (BucketBits * 0) & BucketMask) << SubBits) | (Sub >> (SubBits * 0) & SubMask)),
+					uint8_t(((Bucket >> (BucketBits * 1) & BucketMask) << SubBits) | (Sub >> (SubBits * 1) & SubMask)),
+					uint8_t(((Bucket >> (BucketBits * 2) & BucketMask) << SubBits) | (Sub >> (SubBits * 2) & SubMask)),
+					Count
+				});
+			}
+		}
+		return ret;
+	}
+
+	NearestColorLookup::NearestColorLookup(const std::vector<PaletteItem>& Palette) :
+		Palette(Palette)
+	{
+		constexpr int CellsPerAxis = 1 << CellBits;
+		constexpr int CellSize = 1 << CellShift;
+		constexpr int NumCells = CellsPerAxis * CellsPerAxis * CellsPerAxis;
+		int NumColors = int(Palette.size());
+		if (NumColors > 256) throw std::invalid_argument("NearestColorLookup: the palette must not have more than 256 colors.");
+		if (!NumColors) throw std::invalid_argument("NearestColorLookup: the palette is empty.");
+
+		// 每个通道上，调色板颜色到每一格的最近、最远距离的平方。三个通道相加就是到格子的最近、最远距离的平方
+		auto AxisMinDist = std::vector<std::array<std::array<int, 256>, CellsPerAxis>>(3);
+		auto AxisMaxDist = std::vector<std::array<std::array<int, 256>, CellsPerAxis>>(3);
+		for (int i = 0; i < NumColors; i++)
+		{
+			int Channels[3] = { Palette[i].R, Palette[i].G, Palette[i].B };
+			for (int c = 0; c < 3; c++)
+			{
+				int v = Channels[c];
+				for (int Cell = 0; Cell < CellsPerAxis; Cell++)
+				{
+					int Lo = Cell * CellSize;
+					int Hi = Lo + CellSize - 1;
+					int DMin = v < Lo ? Lo - v : (v > Hi ? v - Hi : 0);
+					int DMax = std::max(std::abs(v - Lo), std::abs(v - Hi));
+					AxisMinDist[c][Cell][i] = DMin * DMin;
+					AxisMaxDist[c][Cell][i] = DMax * DMax;
+				}
+			}
+		}
+
+		// 格子内任意一点到某个调色板颜色的距离不会超过该颜色的最远距离，
+		// 所以最近距离大于所有颜色的最远距离中的最小值的调色板项不可能成为最近色。
+		auto CellBound = std::vector<int>(NumCells);
+		auto CellCounts = std::vector<uint32_t>(NumCells);
+
+#pragma omp parallel for
+		for (int Cell = 0; Cell < NumCells; Cell++)
+		{
+			auto& RMax = AxisMaxDist[0][Cell >> (CellBits * 2)];
+			auto& GMax = AxisMaxDist[1][(Cell >> CellBits) & (CellsPerAxis - 1)];
+			auto& BMax = AxisMaxDist[2][Cell & (CellsPerAxis - 1)];
+			auto& RMin = AxisMinDist[0][Cell >> (CellBits * 2)];
+			auto& GMin = AxisMinDist[1][(Cell >> CellBits) & (CellsPerAxis - 1)];
+			auto& BMin = AxisMinDist[2][Cell & (CellsPerAxis - 1)];
+			int Bound = 0x7fffffff;
+			for (int i = 0; i < NumColors; i++)
+			{
+				Bound = std::min(Bound, RMax[i] + GMax[i] + BMax[i]);
+			}
+			uint32_t Count = 0;
+			for (int i = 0; i < NumColors; i++)
+			{
+				if (RMin[i] + GMin[i] + BMin[i] <= Bound) Count++;
+			}
+			CellBound[Cell] = Bound;
+			CellCounts[Cell] = Count;
+		}
+
+		CellOffsets.resize(size_t(NumCells) + 1);
+		CellOffsets[0] = 0;
+		for (int Cell = 0; Cell < NumCells; Cell++)
+		{
+			CellOffsets[Cell + 1] = CellOffsets[Cell] + CellCounts[Cell];
+		}
+		Candidates.resize(CellOffsets[NumCells]);
+
+		// 候选项按索引从小到大保存，查找时距离相同就会取索引最小的那个
+#pragma omp parallel for
+		for (int Cell = 0; Cell < NumCells; Cell++)
+		{
+			auto& RMin = AxisMinDist[0][Cell >> (CellBits * 2)];
+			auto& GMin = AxisMinDist[1][(Cell >> CellBits) & (CellsPerAxis - 1)];
+			auto& BMin = AxisMinDist[2][Cell & (CellsPerAxis - 1)];
+			int Bound = CellBound[Cell];
+			auto Dst = &Candidates[CellOffsets[Cell]];
+			for (int i = 0; i < NumColors; i++)
+			{
+				if (RMin[i] + GMin[i] + BMin[i] <= Bound) *Dst++ = uint8_t(i);
+			}
+		}
+	}
+
+	size_t NearestColorLookup::GetNumColors() const
+	{
+		return Palette.size();
+	}
+
+	const std::vector<PaletteItem>& NearestColorLookup::GetPalette() const
+	{
+		return Palette;
+	}
+
+	// 暴力搜索的各个实现。比较的是“距离平方 << 8 | 索引”，这样取最小值时距离相同的会取索引最小的项。
+	// 调色板填充到 16 项的整数倍，填充项的分量为 `SearchPadding`，它的距离总是比真正的调色板项远。
+	constexpr size_t SearchBlockSize = 16;
+	constexpr int16_t SearchPadding = 1023;
+
+	static int SearchNearestScalar(const int16_t* R, const int16_t* G, const int16_t* B, size_t NumEntries, int r, int g, int b)
+	{
+		int MinKey = 0x7fffffff;
+		for (size_t i = 0; i < NumEntries; i++)
+		{
+			int RD = r - R[i];
+			int GD = g - G[i];
+			int BD = b - B[i];
+			int Key = ((RD * RD + GD * GD + BD * BD) << 8) | int(i);
+			MinKey = std::min(MinKey, Key);
+		}
+		return MinKey & 0xFF;
+	}
+
+#if PALETTEGEN_X86
+	PALETTEGEN_TARGET("sse4.1")
+	static int SearchNearestSSE41(const int16_t* R, const int16_t* G, const int16_t* B, size_t NumEntries, int r, int g, int b)
+	{
+		const __m128i vr = _mm_set1_epi16(int16_t(r));
+		const __m128i vg = _mm_set1_epi16(int16_t(g));
+		const __m128i vb = _mm_set1_epi16(int16_t(b));
+		const __m128i Zero = _mm_setzero_si128();
+		const __m128i Step = _mm_set1_epi32(8);
+
+		// 解包后低半部分是第 0~3 项，高半部分是第 4~7 项
+		__m128i IndexLo = _mm_setr_epi32(0, 1, 2, 3);
+		__m128i IndexHi = _mm_setr_epi32(4, 5, 6, 7);
+		__m128i MinKey = _mm_set1_epi32(0x7fffffff);
+		for (size_t i = 0; i < NumEntries; i += 8)
+		{
+			__m128i RD = _mm_sub_epi16(vr, _mm_loadu_si128(reinterpret_cast<const __m128i*>(R + i)));
+			__m128i GD = _mm_sub_epi16(vg, _mm_loadu_si128(reinterpret_cast<const __m128i*>(G + i)));
+			__m128i BD = _mm_sub_epi16(vb, _mm_loadu_si128(reinterpret_cast<const __m128i*>(B + i)));
+			__m128i RGLo = _mm_unpacklo_epi16(RD, GD);
+			__m128i RGHi = _mm_unpackhi_epi16(RD, GD);
+			__m128i BLo = _mm_unpacklo_epi16(BD, Zero);
+			__m128i BHi = _mm_unpackhi_epi16(BD, Zero);
+			__m128i DistLo = _mm_add_epi32(_mm_madd_epi16(RGLo, RGLo), _mm_madd_epi16(BLo, BLo));
+			__m128i DistHi = _mm_add_epi32(_mm_madd_epi16(RGHi, RGHi), _mm_madd_epi16(BHi, BHi));
+			MinKey = _mm_min_epi32(MinKey, _mm_or_si128(_mm_slli_epi32(DistLo, 8), IndexLo));
+			MinKey = _mm_min_epi32(MinKey, _mm_or_si128(_mm_slli_epi32(DistHi, 8), IndexHi));
+			IndexLo = _mm_add_epi32(IndexLo, Step);
+			IndexHi = _mm_add_epi32(IndexHi, Step);
+		}
+		MinKey = _mm_min_epi32(MinKey, _mm_shuffle_epi32(MinKey, _MM_SHUFFLE(1, 0, 3, 2)));
+		MinKey = _mm_min_epi32(MinKey, _mm_shuffle_epi32(MinKey, _MM_SHUFFLE(2, 3, 0, 1)));
+		return _mm_cvtsi128_si32(MinKey) & 0xFF;
+	}
+
+	PALETTEGEN_TARGET("avx2")
+	static int SearchNearestAVX2(const int16_t* R, const int16_t* G, const int16_t* B, size_t NumEntries, int r, int g, int b)
+	{
+		const __m256i vr = _mm256_set1_epi16(int16_t(r));
+		const __m256i vg = _mm256_set1_epi16(int16_t(g));
+		const __m256i vb = _mm256_set1_epi16(int16_t(b));
+		const __m256i Zero = _mm256_setzero_si256();
+		const __m256i Step = _mm256_set1_epi32(16);
+
+		// 解包在每个 128 位内进行，低半部分是第 0~3、8~11 项，高半部分是第 4~7、12~15 项
+		__m256i IndexLo = _mm256_setr_epi32(0, 1, 2, 3, 8, 9, 10, 11);
+		__m256i IndexHi = _mm256_setr_epi32(4, 5, 6, 7, 12, 13, 14, 15);
+		__m256i MinKey = _mm256_set1_epi32(0x7fffffff);
+		for (size_t i = 0; i < NumEntries; i += 16)
+		{
+			__m256i RD = _mm256_sub_epi16(vr, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(R + i)));
+			__m256i GD = _mm256_sub_epi16(vg, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(G + i)));
+			__m256i BD = _mm256_sub_epi16(vb, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(B + i)));
+			__m256i RGLo = _mm256_unpacklo_epi16(RD, GD);
+			__m256i RGHi = _mm256_unpackhi_epi16(RD, GD);
+			__m256i BLo = _mm256_unpacklo_epi16(BD, Zero);
+			__m256i BHi = _mm256_unpackhi_epi16(BD, Zero);
+			__m256i DistLo = _mm256_add_epi32(_mm256_madd_epi16(RGLo, RGLo), _mm256_madd_epi16(BLo, BLo));
+			__m256i DistHi = _mm256_add_epi32(_mm256_madd_epi16(RGHi, RGHi), _mm256_madd_epi16(BHi, BHi));
+			MinKey = _mm256_min_epi32(MinKey, _mm256_or_si256(_mm256_slli_epi32(DistLo, 8), IndexLo));
+			MinKey = _mm256_min_epi32(MinKey, _mm256_or_si256(_mm256_slli_epi32(DistHi, 8), IndexHi));
+			IndexLo = _mm256_add_epi32(IndexLo, Step);
+			IndexHi = _mm256_add_epi32(IndexHi, Step);
+		}
+		__m128i MinKey128 = _mm_min_epi32(_mm256_castsi256_si128(MinKey), _mm256_extracti128_si256(MinKey, 1));
+		MinKey128 = _mm_min_epi32(MinKey128, _mm_shuffle_epi32(MinKey128, _MM_SHUFFLE(1, 0, 3, 2)));
+		MinKey128 = _mm_min_epi32(MinKey128, _mm_shuffle_epi32(MinKey128, _MM_SHUFFLE(2, 3, 0, 1)));
+		return _mm_cvtsi128_si32(MinKey128) & 0xFF;
+	}
+
+	static PaletteSearchISA DetectISA()
+	{
+#if defined(_MSC_VER) && !defined(__clang__)
+		int Info[4];
+		__cpuid(Info, 0);
+		int MaxLeaf = Info[0];
+		__cpuid(Info, 1);
+		bool HasSSE41 = (Info[2] & (1 << 19)) != 0;
+		bool HasAVX = (Info[2] & (1 << 28)) != 0 && (Info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;
+		bool HasAVX2 = false;
+		if (HasAVX && MaxLeaf >= 7)
+		{
+			__cpuidex(Info, 7, 0);
+			HasAVX2 = (Info[1] & (1 << 5)) != 0;
+		}
+#else
+		__builtin_cpu_init();
+		bool HasSSE41 = __builtin_cpu_supports("sse4.1");
+		bool HasAVX2 = __builtin_cpu_supports("avx2");
+#endif
+		if (HasAVX2) return PaletteSearchISA::AVX2;
+		if (HasSSE41) return PaletteSearchISA::SSE41;
+		return PaletteSearchISA::Scalar;
+	}
+#else
+	static PaletteSearchISA DetectISA()
+	{
+		return PaletteSearchISA::Scalar;
+	}
+#endif
+
+	PaletteSearchISA PaletteSearch::GetBestSupportedISA()
+	{
+		static const PaletteSearchISA BestISA = DetectISA();
+		return BestISA;
+	}
+
+	PaletteSearch::PaletteSearch(const std::vector<PaletteItem>& Palette, PaletteSearchISA ISA) :
+		Palette(Palette)
+	{
+		if (Palette.size() > 256) throw std::invalid_argument("PaletteSearch: the palette must not have more than 256 colors.");
+		if (Palette.empty()) throw std::invalid_argument("PaletteSearch: the palette is empty.");
+
+		auto NumEntries = (Palette.size() + SearchBlockSize - 1) / SearchBlockSize * SearchBlockSize;
+		R.resize(NumEntries, SearchPadding);
+		G.resize(NumEntries, SearchPadding);
+		B.resize(NumEntries, SearchPadding);
+		for (size_t i = 0; i < Palette.size(); i++)
+		{
+			R[i] = Palette[i].R;
+			G[i] = Palette[i].G;
+			B[i] = Palette[i].B;
+		}
+
+		auto BestISA = GetBestSupportedISA();
+		if (ISA == PaletteSearchISA::Auto || int(ISA) > int(BestISA)) ISA = BestISA;
+		this->ISA = ISA;
+		switch (ISA)
+		{
+#if PALETTEGEN_X86
+		case PaletteSearchISA::AVX2: Kernel = SearchNearestAVX2; break;
+		case PaletteSearchISA::SSE41: Kernel = SearchNearestSSE41; break;
+#endif
+		default: Kernel = SearchNearestScalar; break;
+		}
+	}
+
+	size_t PaletteSearch::GetNumColors() const
+	{
+		return Palette.size();
+	}
+
+	const std::vector<PaletteItem>& PaletteSearch::GetPalette() const
+	{
+		return Palette;
+	}
+
+	PaletteSearchISA PaletteSearch::GetISA() const
+	{
+		return ISA;
+	}
+
+	uint8_t PaletteSearch::GetNearest(int R, int G, int B) const
+	{
+		return uint8_t(Kernel(this->R.data(), this->G.data(), this->B.data(), this->R.size(), R, G, B));
+	}
+
+	void PaletteSearch::MapPixels(const UniformBitmap::Pixel_RGBA8* Pixels, size_t Count, uint8_t* IndicesOut) const
+	{
+		for (size_t i = 0; i < Count; i++)
+		{
+			auto& Pix = Pixels[i];
+			IndicesOut[i] = uint8_t(Kernel(R.data(), G.data(), B.data(), R.size(), Pix.R, Pix.G, Pix.B));
+		}
+	}
+
+	std::vector<uint8_t> MapImageToPalette(const UniformBitmap::Image_RGBA8& image, const std::vector<PaletteItem>& Palette)
+	{
+		auto Width = size_t(image.GetWidth());
+		auto Height = int(image.GetHeight());
+		auto ret = std::vector<uint8_t>(Width * Height);
+
+		if (Width * Height >= NearestColorLookup::MinPixelsForLookup)
 		{
-			auto rowptr = image.GetBitmapRowPtr(y);
-			for (int x = 0; x < int(image.GetWidth()); x++)
+			auto Lookup = NearestColorLookup(Palette);
+#pragma omp parallel for
+			for (int y = 0; y < Height; y++)
 			{
-				auto& Pix = rowptr[x];
-				PalGen.AddPixel(Pix.R, Pix.G, Pix.B);
+				auto SrcRowPtr = image.GetBitmapRowPtr(y);
+				auto DstRowPtr = &ret[y * Width];
+				for (size_t x = 0; x < Width; x++)
+				{
+					DstRowPtr[x] = Lookup.GetNearest(SrcRowPtr[x].R, SrcRowPtr[x].G, SrcRowPtr[x].B);
+				}
 			}
 		}
+		else
+		{
+			auto Search = PaletteSearch(Palette);
+#pragma omp parallel for
+			for (int y = 0; y < Height; y++)
+			{
+				Search.MapPixels(image.GetBitmapRowPtr(y), Width, &ret[y * Width]);
+			}
+		}
+		return ret;
+	}
+
+	// 中位切分的一个颜色盒，对应 `Colors` 里的一段
+	struct MedianCutBox
+	{
+		size_t Begin;
+		size_t End;
+		uint64_t Count;
+		double Error; // 盒内颜色到平均色的加权误差平方和
+		int Axis; // 方差最大的通道
+		PaletteItem Mean;
+	};
+
+	static MedianCutBox MakeMedianCutBox(const std::vector<ColorHistogram::ColorCount>& Colors, size_t Begin, size_t End)
+	{
+		uint64_t Count = 0;
+		double Sum[3] = {};
+		double SqSum[3] = {};
+		for (size_t i = Begin; i < End; i++)
+		{
+			auto& Color = Colors[i];
+			double Channels[3] = { double(Color.R), double(Color.G), double(Color.B) };
+			Count += Color.Count;
+			for (int c = 0; c < 3; c++)
+			{
+				Sum[c] += Channels[c] * Color.Count;
+				SqSum[c] += Channels[c] * Channels[c] * Color.Count;
+			}
+		}
+
+		auto ret = MedianCutBox{ Begin, End, Count, 0, 0, {} };
+		double MaxVariance = -1;
+		uint8_t Mean[3];
+		for (int c = 0; c < 3; c++)
+		{
+			double Variance = SqSum[c] - Sum[c] * Sum[c] / double(Count);
+			ret.Error += Variance;
+			if (Variance > MaxVariance)
+			{
+				MaxVariance = Variance;
+				ret.Axis = c;
+			}
+			Mean[c] = uint8_t(std::min(255.0, std::floor(Sum[c] / double(Count) + 0.5)));
+		}
+		ret.Mean = PaletteItem{ Mean[0], Mean[1], Mean[2] };
+		return ret;
+	}
+
+	static uint8_t GetChannel(const ColorHistogram::ColorCount& Color, int Axis)
+	{
+		return Axis == 0 ? Color.R : (Axis == 1 ? Color.G : Color.B);
+	}
+
+	MedianCutQuantizer::MedianCutQuantizer(int NumRefinePasses) :
+		NumRefinePasses(NumRefinePasses)
+	{
+	}
+
+	std::vector<PaletteItem> MedianCutQuantizer::GetColors(const ColorHistogram& Histogram, size_t MaxColors, bool& PaletteIsExact) const
+	{
+		auto Colors = Histogram.GetColors();
+		auto Palette = std::vector<PaletteItem>();
+		if (Colors.size() <= MaxColors)
+		{
+			for (auto& Color : Colors) Palette.push_back(PaletteItem{ Color.R, Color.G, Color.B });
+			PaletteIsExact = true;
+			return Palette;
+		}
+		PaletteIsExact = false;
+		if (!MaxColors) return Palette;
+
+		auto Boxes = std::vector<MedianCutBox>();
+		Boxes.push_back(MakeMedianCutBox(Colors, 0, Colors.size()));
+		while (Boxes.size() < MaxColors)
+		{
+			auto Worst = std::max_element(Boxes.begin(), Boxes.end(), [](const MedianCutBox& a, const MedianCutBox& b) { return a.Error < b.Error; });
+			if (Worst->Error <= 0) break;
+
+			auto Box = *Worst;
+			auto Axis = Box.Axis;
+			std::sort(Colors.begin() + Box.Begin, Colors.begin() + Box.End, [Axis](const ColorHistogram::ColorCount& a, const ColorHistogram::ColorCount& b)
+			{
+				return GetChannel(a, Axis) < GetChannel(b, Axis);
+			});
+
+			// 在加权中位数处切开，两边至少各留一种颜色
+			uint64_t Half = Box.Count / 2;
+			uint64_t Accum = 0;
+			auto Split = Box.Begin + 1;
+			for (auto i = Box.Begin; i < Box.End - 1; i++)
+			{
+				Accum += Colors[i].Count;
+				Split = i + 1;
+				if (Accum >= Half) break;
+			}
+
+			*Worst = MakeMedianCutBox(Colors, Box.Begin, Split);
+			Boxes.push_back(MakeMedianCutBox(Colors, Split, Box.End));
+		}
+		for (auto& Box : Boxes) Palette.push_back(Box.Mean);
+
+		// k-means：每种颜色归到最近的调色板项，各线程分别累加后再合并
+		for (int Pass = 0; Pass < NumRefinePasses; Pass++)
+		{
+			auto NumColors = int(Colors.size());
+			auto NumEntries = Palette.size();
+			auto Sums = std::vector<std::array<uint64_t, 4>>(NumEntries);
+			auto Lookup = std::unique_ptr<NearestColorLookup>();
+			auto Search = std::unique_ptr<PaletteSearch>();
+			if (size_t(NumColors) >= NearestColorLookup::MinPixelsForLookup)
+				Lookup = std::make_unique<NearestColorLookup>(Palette);
+			else
+				Search = std::make_unique<PaletteSearch>(Palette);
+
+#pragma omp parallel
+			{
+				auto LocalSums = std::vector<std::array<uint64_t, 4>>(NumEntries);
+#pragma omp for nowait
+				for (int i = 0; i < NumColors; i++)
+				{
+					auto& Color = Colors[i];
+					auto Index = Lookup ? Lookup->GetNearest(Color.R, Color.G, Color.B) : Search->GetNearest(Color.R, Color.G, Color.B);
+					auto& Sum = LocalSums[Index];
+					Sum[0] += uint64_t(Color.R) * Color.Count;
+					Sum[1] += uint64_t(Color.G) * Color.Count;
+					Sum[2] += uint64_t(Color.B) * Color.Count;
+					Sum[3] += Color.Count;
+				}
+#pragma omp critical
+				for (size_t i = 0; i < NumEntries; i++)
+				{
+					for (int c = 0; c < 4; c++) Sums[i][c] += LocalSums[i][c];
+				}
+			}
+
+			bool Changed = false;
+			for (size_t i = 0; i < NumEntries; i++)
+			{
+				auto& Sum = Sums[i];
+				if (!Sum[3]) continue; // 没有颜色归到这一项时保留原来的颜色
+				auto NewColor = PaletteItem
+				{
+					uint8_t((Sum[0] + Sum[3] / 2) / Sum[3]),
+					uint8_t((Sum[1] + Sum[3] / 2) / Sum[3]),
+					uint8_t((Sum[2] + Sum[3] / 2) / Sum[3])
+				};
+				if (NewColor.R != Palette[i].R || NewColor.G != Palette[i].G || NewColor.B != Palette[i].B) Changed = true;
+				Palette[i] = NewColor;
+			}
+			if (!Changed) break;
+		}
+		return Palette;
+	}
+
+	std::vector<PaletteItem> OctreeQuantizer::GetColors(const ColorHistogram& Histogram, size_t MaxColors, bool& PaletteIsExact) const
+	{
+		auto PalGen = PaletteGenerator(MaxColors);
+		PalGen.AddColors(Histogram);
 		PaletteIsExact = PalGen.IsPaletteExactFit();
 		return PalGen.GetColors();
 	}
+
+	std::vector<PaletteItem> QuantizeColors(const UniformBitmap::Image_RGBA8& image, size_t MaxColors, const ColorQuantizer& Quantizer, bool& PaletteIsExact)
+	{
+		auto Histogram = ColorHistogram();
+		Histogram.AddImage(image);
+		return Quantizer.GetColors(Histogram, MaxColors, PaletteIsExact);
+	}
 };
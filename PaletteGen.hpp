@@ -5,10 +5,11 @@
 #include <cstdint>
 #include <memory>
 #include <array>
-#include <set>
+#include <vector>
 
 namespace PaletteGeneratorLib
 {
+	// 八叉树节点，保存在 `PaletteGenerator` 的节点池里，用 32 位下标互相引用。下标 0 是根节点，作为子节点下标时表示没有子节点
 	struct ColorNode
 	{
 		uint64_t RSum = 0;
@@ -16,9 +17,11 @@ namespace PaletteGeneratorLib
 		uint64_t BSum = 0;
 		uint64_t NumPixels = 0;
 
-		bool IsLeaf = false;
+		std::array<uint32_t, 8> SubNodes = {};
+		uint32_t NextNode = 0; // 可合并链表或空闲链表里的下一个节点
 
-		std::array<std::shared_ptr<ColorNode>, 8> SubNodes;
+		bool IsLeaf = false;
+		bool IsReducible = false; // 是否在可合并链表里
 
 		ColorNode() = default;
 	};
@@ -34,30 +37,197 @@ namespace PaletteGeneratorLib
 		uint32_t ToBGRA(uint8_t A) const;
 	};
 
+	// 颜色直方图：统计每种 RGB 颜色出现的次数。
+	// 按各通道的高 5 位把颜色分到 32x32x32 个桶里，桶第一次用到时才分配 512 个计数，所以占用的内存只与用到的桶数成正比
+	class ColorHistogram
+	{
+	public:
+		struct ColorCount
+		{
+			uint8_t R;
+			uint8_t G;
+			uint8_t B;
+			uint32_t Count;
+		};
+
+		static constexpr int BucketBits = 5;
+		static constexpr int SubBits = 8 - BucketBits;
+		static constexpr size_t NumBuckets = size_t(1) << (BucketBits * 3);
+		static constexpr size_t BucketSize = size_t(1) << (SubBits * 3);
+
+	protected:
+		std::vector<uint32_t> BucketOffsets; // 每个桶的计数在 `Counts` 里的位置，0 表示还没有分配
+		std::vector<uint32_t> Counts; // 开头的一个桶不用，让偏移 0 可以表示没有分配
+		size_t NumColors = 0;
+
+		uint32_t& GetCount(uint8_t R, uint8_t G, uint8_t B);
+
+	public:
+		ColorHistogram();
+
+		void AddColor(uint8_t R, uint8_t G, uint8_t B, uint32_t Count = 1);
+		void AddPixels(const UniformBitmap::Pixel_RGBA8* Pixels, size_t Count);
+		void Merge(const ColorHistogram& Other);
+
+		// 多线程统计整幅图像，每个线程先统计自己的部分再合并
+		void AddImage(const UniformBitmap::Image_RGBA8& image);
+
+		size_t GetNumColors() const;
+
+		// 按桶的顺序列出所有颜色，结果与统计的顺序、线程数无关
+		std::vector<ColorCount> GetColors() const;
+	};
+
 	class PaletteGenerator
 	{
 	protected:
-		ColorNode RootNode;
-		std::array<std::set<ColorNode*>, 8> ReducibleNodes;
+		std::vector<ColorNode> Nodes = std::vector<ColorNode>(1); // 节点池，第 0 个是根节点
+		uint32_t FreeNodes = 0; // 合并后释放的节点组成的链表，分配节点时优先复用
+		std::array<uint32_t, 8> ReducibleHead = {}; // 每一层的可合并节点组成的链表，后加入的先合并
 
 		uint64_t NumPixels = 0;
 		size_t NumColors = 0;
 		size_t MaxColors = 256;
 		bool DoPaletteExactFit = false;
 
-		bool ReduceNode(ColorNode& Node);
+		uint32_t NewNode();
+		void FreeNode(uint32_t Index);
+		void AddReducible(int Level, uint32_t Index);
+		bool ReduceNode(uint32_t Index);
 		bool ReduceTree();
-		static void GetColors(const ColorNode& Node, std::vector<PaletteItem>& Palette);
+		void GetColors(uint32_t Index, std::vector<PaletteItem>& Palette) const;
 
 	public:
 		PaletteGenerator() = default;
 		PaletteGenerator(size_t MaxColors);
 
 		void AddPixel(uint8_t R, uint8_t G, uint8_t B);
+		void AddPixel(uint8_t R, uint8_t G, uint8_t B, uint64_t Count);
+		void AddColors(const ColorHistogram& Histogram);
 		std::vector<PaletteItem> GetColors();
 		bool IsPaletteExactFit() const;
 
 		static std::vector<PaletteItem> GetColors(const UniformBitmap::Image_RGBA8& image, size_t MaxColors, bool& PaletteIsExact);
 	};
+
+	// 最近颜色查找：返回调色板里与给定颜色的 RGB 距离平方最小的颜色的索引，距离相同时取索引最小的那个，与暴力搜索的结果完全一致。
+	// 把 RGB 空间划分为 32x32x32 个格子，每个格子只保存可能成为格子内某个颜色的最近色的调色板项，查找时只需要比较这些候选项。
+	class NearestColorLookup
+	{
+	protected:
+		std::vector<PaletteItem> Palette;
+		std::vector<uint32_t> CellOffsets;
+		std::vector<uint8_t> Candidates;
+
+	public:
+		static constexpr int CellBits = 5;
+		static constexpr int CellShift = 8 - CellBits;
+
+		// 建表的开销大约相当于用 `PaletteSearch` 暴力搜索这么多个像素，像素更少时不值得建表
+		static constexpr size_t MinPixelsForLookup = 512 * 512;
+
+		NearestColorLookup(const std::vector<PaletteItem>& Palette);
+
+		size_t GetNumColors() const;
+		const std::vector<PaletteItem>& GetPalette() const;
+
+		inline uint8_t GetNearest(int R, int G, int B) const
+		{
+			size_t Cell = (size_t(R >> CellShift) << (CellBits * 2)) | (size_t(G >> CellShift) << CellBits) | size_t(B >> CellShift);
+			auto Begin = &Candidates[CellOffsets[Cell]];
+			auto End = &Candidates[0] + CellOffsets[Cell + 1];
+			int MinDiff = 0x7fffffff;
+			uint8_t MinDiffI = 0;
+			for (auto i = Begin; i < End; i++)
+			{
+				auto& Color = Palette[*i];
+				int RD = R - Color.R;
+				int GD = G - Color.G;
+				int BD = B - Color.B;
+				int Diff = RD * RD + GD * GD + BD * BD;
+				if (Diff < MinDiff)
+				{
+					MinDiff = Diff;
+					MinDiffI = *i;
+				}
+			}
+			return MinDiffI;
+		}
+	};
+
+	// 暴力搜索最近颜色使用的指令集，`Auto` 表示使用 CPU 支持的最好的指令集
+	enum class PaletteSearchISA
+	{
+		Scalar,
+		SSE41,
+		AVX2,
+		Auto
+	};
+
+	// 暴力搜索最近颜色：调色板按 SoA 的 int16 数组保存，AVX2 每次比较 16 个调色板项，结果与 `NearestColorLookup` 一致。
+	// 不需要预先建表，适合像素较少的图像，比如使用局部调色板的小帧。
+	class PaletteSearch
+	{
+	public:
+		using KernelType = int(*)(const int16_t* R, const int16_t* G, const int16_t* B, size_t NumEntries, int r, int g, int b);
+
+	protected:
+		std::vector<PaletteItem> Palette;
+		std::vector<int16_t> R;
+		std::vector<int16_t> G;
+		std::vector<int16_t> B;
+		PaletteSearchISA ISA;
+		KernelType Kernel;
+
+	public:
+		// 指定的指令集不被 CPU 支持时，使用支持的最好的指令集
+		PaletteSearch(const std::vector<PaletteItem>& Palette, PaletteSearchISA ISA = PaletteSearchISA::Auto);
+
+		size_t GetNumColors() const;
+		const std::vector<PaletteItem>& GetPalette() const;
+		PaletteSearchISA GetISA() const;
+		static PaletteSearchISA GetBestSupportedISA();
+
+		uint8_t GetNearest(int R, int G, int B) const;
+		void MapPixels(const UniformBitmap::Pixel_RGBA8* Pixels, size_t Count, uint8_t* IndicesOut) const;
+	};
+
+	// 把图像的每个像素映射为调色板里最近颜色的索引，按行存储。像素少时暴力搜索，像素多时先建立 `NearestColorLookup` 再查表。
+	std::vector<uint8_t> MapImageToPalette(const UniformBitmap::Image_RGBA8& image, const std::vector<PaletteItem>& Palette);
+
+	// 生成调色板的算法：从颜色直方图生成不超过 `MaxColors` 种颜色的调色板，调色板包含了所有颜色时 PaletteIsExact 为 true。
+	// 使用局部调色板编码 GIF 时会在多个线程里同时调用同一个对象的 GetColors()，实现不能修改自身的状态
+	class ColorQuantizer
+	{
+	public:
+		virtual ~ColorQuantizer() = default;
+		virtual std::vector<PaletteItem> GetColors(const ColorHistogram& Histogram, size_t MaxColors, bool& PaletteIsExact) const = 0;
+	};
+
+	// 八叉树，速度最快
+	class OctreeQuantizer : public ColorQuantizer
+	{
+	public:
+		std::vector<PaletteItem> GetColors(const ColorHistogram& Histogram, size_t MaxColors, bool& PaletteIsExact) const override;
+	};
+
+	// 中位切分：反复把误差平方和最大的颜色盒沿方差最大的通道从加权中位数处切开，每个盒子的加权平均色就是调色板的一项。
+	// 之后把直方图里的每种颜色归到最近的调色板项，用归类后的平均色更新调色板，重复几轮（k-means）。
+	// 调色板比八叉树的更接近原图，抖动更少，压缩后也更小
+	class MedianCutQuantizer : public ColorQuantizer
+	{
+	public:
+		static constexpr int DefaultRefinePasses = 4;
+		int NumRefinePasses = DefaultRefinePasses;
+
+		MedianCutQuantizer() = default;
+		MedianCutQuantizer(int NumRefinePasses);
+
+		// 颜色数不超过 `MaxColors` 时直接返回所有颜色，此时调色板是精确的
+		std::vector<PaletteItem> GetColors(const ColorHistogram& Histogram, size_t MaxColors, bool& PaletteIsExact) const override;
+	};
+
+	// 统计图像的颜色直方图，再用指定的算法生成调色板
+	std::vector<PaletteItem> QuantizeColors(const UniformBitmap::Image_RGBA8& image, size_t MaxColors, const ColorQuantizer& Quantizer, bool& PaletteIsExact);
 };
 
@@ -361,7 +361,7 @@ namespace CPPGIF
 		return Height;
 	}
 
-	ImageDescriptorType::ImageDescriptorType(std::istream& is)
+	ImageDescriptorType::ImageDescriptorType(std::istream& is, DecodeMode Mode)
 	{
 		Read(is, Left);
 		Read(is, Top);
@@ -371,23 +371,53 @@ namespace CPPGIF
 		if (HasLocalColorTable())
 		{
 			LocalColorTable = std::make_shared<ColorTableArray>();
-			Read(is, &LocalColorTable.get()[0], SizeOfLocalColorTable());
+			auto& ColorTable = *LocalColorTable;
+			Read(is, &ColorTable[0], SizeOfLocalColorTable());
 		}
 		// https://giflib.sourceforge.net/whatsinagif/lzw_image_data.html
-		auto LZW_MinCodeSize = uint8_t(0);
 		Read(is, LZW_MinCodeSize);
 		// std::cout << "LZW: 0x" << std::hex << is.tellg() << "\n";
-		auto LZW_Data = ReadDataSubBlock(is); // 此处确保当前图像描述符的图像内容全部读完，然后开始 LZW 解压缩。
+		auto CompressedData = ReadDataSubBlock(is); // 此处确保当前图像描述符的图像内容全部读完，然后开始 LZW 解压缩。
+		if (Mode == DecodeMode::Eager)
+		{
+			ImageData = DecodeCompressedData(CompressedData);
+		}
+		else
+		{
+			Pending = std::make_shared<PendingImageData>();
+			Pending->CompressedData = std::move(CompressedData);
+		}
+	}
+
+	DataSubBlock ImageDescriptorType::DecodeCompressedData(const DataSubBlock& CompressedData) const
+	{
 		try
 		{
-			ImageData = UncompressLZW(LZW_Data, LZW_MinCodeSize);
+			return UncompressLZW(CompressedData, LZW_MinCodeSize, size_t(Width) * Height);
 		}
 		catch (const DecodeError& e)
 		{
 			std::cerr << "GIF: " << e.what() << "\n";
+			return DataSubBlock();
 		}
 	}
 
+	bool ImageDescriptorType::IsImageDataDecoded() const
+	{
+		return !Pending || Pending->Decoded.load(std::memory_order_acquire);
+	}
+
+	void ImageDescriptorType::DecodeImageData() const
+	{
+		if (!Pending) return;
+		std::call_once(Pending->DecodeOnce, [this]()
+		{
+			Pending->ImageData = DecodeCompressedData(Pending->CompressedData);
+			Pending->CompressedData = DataSubBlock();
+			Pending->Decoded.store(true, std::memory_order_release);
+		});
+	}
+
 	void ImageDescriptorType::WriteFile(std::ostream& WriteTo, uint8_t LZW_MinCodeSize) const
 	{
 		Write(WriteTo, Left);
@@ -397,10 +427,11 @@ namespace CPPGIF
 		Write(WriteTo, Bitfields);
 		if (HasLocalColorTable())
 		{
-			Write(WriteTo, &LocalColorTable.get()[0], SizeOfLocalColorTable());
+			auto& ColorTable = *LocalColorTable;
+			Write(WriteTo, &ColorTable[0], SizeOfLocalColorTable());
 		}
 		Write(WriteTo, LZW_MinCodeSize);
-		WriteDataSubBlock(WriteTo, CompressLZW(ImageData, LZW_MinCodeSize));
+		WriteDataSubBlock(WriteTo, CompressLZW(GetImageData(), LZW_MinCodeSize));
 	}
 
 	DataSubBlock ImageDescriptorType::CompressLZW(const DataSubBlock& Data, uint8_t LZW_MinCodeSize)
@@ -409,53 +440,34 @@ namespace CPPGIF
 
 		if (!LZW_MinCodeSize) return Data;
 
-		// 编码流，以及其哈希类
 		using CodeType = uint16_t;
-		using CodeStreamType = std::vector<CodeType>;
-		struct Hasher_CodeStreamType
-		{
-			const int Shifts = 4;
-			size_t operator() (const CodeStreamType& cs) const
-			{
-				size_t ret = 0;
-				for (auto& c : cs)
-				{
-					ret = (ret << Shifts) | (ret >> (8 * sizeof(ret) - Shifts));
-					ret += c;
-				}
-				return ret;
-			}
-		};
 
-		// 把编码流转换为二进制串的类
+		// 把编码流转换为二进制串的类，用 64 位的位缓冲区攒够整字节后再输出
 		struct CodeStreamEncoder
 		{
 		protected:
 			DataSubBlock Bytes;
-			uint8_t LastByteUsedBits = 0;
+			uint64_t BitBuffer = 0;
+			int BitsInBuffer = 0;
 
 		public:
 			uint8_t CurCodeSize;
-			// 调试编码表
-			// CodeStreamType Debug_CodeStream;
 
 			CodeStreamEncoder() = delete;
-			CodeStreamEncoder(int InitCodeSize) : CurCodeSize(InitCodeSize)
+			CodeStreamEncoder(int InitCodeSize, size_t ReserveBytes) : CurCodeSize(InitCodeSize)
 			{
-				Bytes.push_back(0);
+				Bytes.reserve(ReserveBytes);
 			}
 
-			const DataSubBlock& GetEncodedBytes(uint8_t& LastByteUsedBits) const
+			DataSubBlock GetEncodedBytes()
 			{
-				LastByteUsedBits = this->LastByteUsedBits;
-				return Bytes;
-			}
-
-			DataSubBlock GetEncodedBytes() const
-			{
-				DataSubBlock ret = Bytes;
-				if (!LastByteUsedBits) ret.pop_back();
-				return ret;
+				if (BitsInBuffer)
+				{
+					Bytes.push_back(uint8_t(BitBuffer));
+					BitBuffer = 0;
+					BitsInBuffer = 0;
+				}
+				return std::move(Bytes);
 			}
 
 			CodeType CurCodeSizeMaxValue() const
@@ -465,27 +477,13 @@ namespace CPPGIF
 
 			void Encode(CodeType Code)
 			{
-				// if (Code > CurCodeSizeMaxValue()) throw EncodeError(std::string("Unexpected code ") + std::to_string(Code) + " that's beyond the current max value of " + std::to_string(CurCodeSizeMaxValue()));
-				// 调试编码表
-				// Debug_CodeStream.push_back(Code); 
-				int BitsToEncode = CurCodeSize;
-				while (BitsToEncode)
+				BitBuffer |= uint64_t(Code) << BitsInBuffer;
+				BitsInBuffer += CurCodeSize;
+				while (BitsInBuffer >= 8)
 				{
-					int BitsCanEncode = (8 - LastByteUsedBits);
-					if (BitsCanEncode > BitsToEncode) BitsCanEncode = BitsToEncode;
-					if (!BitsCanEncode)
-					{
-						Bytes.push_back(0);
-						BitsCanEncode = BitsToEncode < 8 ? BitsToEncode : 8;
-						LastByteUsedBits = 0;
-					}
-					if (BitsCanEncode)
-					{
-						Bytes.back() |= uint8_t(Code << LastByteUsedBits);
-						Code >>= BitsCanEncode;
-						LastByteUsedBits += BitsCanEncode;
-						BitsToEncode -= BitsCanEncode;
-					}
+					Bytes.push_back(uint8_t(BitBuffer));
+					BitBuffer >>= 8;
+					BitsInBuffer -= 8;
 				}
 			}
 
@@ -495,28 +493,54 @@ namespace CPPGIF
 			}
 		};
 
-		using CodeTableMapType = std::unordered_map<CodeStreamType, CodeType, Hasher_CodeStreamType>;
-
-		struct CodaTableType : public CodeTableMapType
+		// 码表：以（前缀编码, 下一个索引）为键的开放寻址哈希表。
+		// 容量固定，编码过程中没有任何堆分配；单字符串（根编码）不入表，其编码就是索引值本身。
+		constexpr int SlotBits = 13;
+		constexpr size_t NumSlots = size_t(1) << SlotBits; // 最多 4096 个编码，装填率不超过一半
+		struct CodeTableType
 		{
+			std::array<uint32_t, NumSlots> Keys; // 0 表示空槽
+			std::array<CodeType, NumSlots> Codes;
 			CodeType ClearCode;
 			CodeType EOICode;
+			CodeType NextCode;
 			uint8_t CodeSize;
 
-			void InitCodeTable()
+			static uint32_t MakeKey(CodeType Prefix, CodeType Index)
 			{
-				ClearCode = 1 << CodeSize;
-				EOICode = ClearCode + 1;
+				return ((uint32_t(Prefix) << 8) | Index) + 1;
+			}
 
-				clear();
-				for (int i = 0; i <= EOICode; i++)
+			// 查找键；找不到时 Slot 为可用于插入的空槽
+			bool Find(uint32_t Key, size_t& Slot, CodeType& Code) const
+			{
+				Slot = size_t((Key * 2654435761u) >> (32 - SlotBits));
+				while (Keys[Slot])
 				{
-					operator[]({CodeType(i)}) = i;
+					if (Keys[Slot] == Key)
+					{
+						Code = Codes[Slot];
+						return true;
+					}
+					Slot = (Slot + 1) & (NumSlots - 1);
 				}
+				return false;
 			}
 
-			CodaTableType(uint8_t CodeSize) :
-				CodeTableMapType(),
+			CodeType Insert(size_t Slot, uint32_t Key)
+			{
+				Keys[Slot] = Key;
+				Codes[Slot] = NextCode;
+				return NextCode++;
+			}
+
+			void InitCodeTable()
+			{
+				Keys.fill(0);
+				NextCode = EOICode + 1;
+			}
+
+			CodeTableType(uint8_t CodeSize) :
 				CodeSize(CodeSize)
 			{
 				ClearCode = CodeType(1) << CodeSize;
@@ -526,223 +550,228 @@ namespace CPPGIF
 
 		constexpr auto MaxCodeSize = 12;
 		const auto FirstCodeSize = LZW_MinCodeSize + 1;
-		auto Encoder = CodeStreamEncoder(FirstCodeSize);
-		auto CodeTable = CodaTableType(LZW_MinCodeSize);
-		CodeTable.InitCodeTable();
-		Encoder.Encode(CodeTable.ClearCode);
+		auto Encoder = CodeStreamEncoder(FirstCodeSize, Data.size() / 2 + 16);
+		auto CodeTable = std::make_unique<CodeTableType>(LZW_MinCodeSize);
+		CodeTable->InitCodeTable();
+		Encoder.Encode(CodeTable->ClearCode);
+
+		if (!Data.size())
+		{
+			Encoder.Encode(CodeTable->EOICode);
+			return Encoder.GetEncodedBytes();
+		}
 
-		auto CurIndexBuffer = CodeStreamType();
-		CurIndexBuffer.push_back(Data.front());
+		// 当前已匹配的字符串的编码
+		auto Prefix = CodeType(Data.front());
 
 		for (size_t i = 1; i < Data.size(); i ++)
 		{
 			auto Index = CodeType(Data[i]);
-			CurIndexBuffer.push_back(Index);
-			if (CodeTable.contains(CurIndexBuffer))
+			auto Key = CodeTableType::MakeKey(Prefix, Index);
+			size_t Slot = 0;
+			CodeType Code = 0;
+			if (CodeTable->Find(Key, Slot, Code))
 			{
+				Prefix = Code;
 				continue;
 			}
 			else
 			{
-				CodeTable[CurIndexBuffer] = CodeType(CodeTable.size());
-				CurIndexBuffer.pop_back();
-				Encoder.Encode(CodeTable.at(CurIndexBuffer));
-				CurIndexBuffer = { Index };
+				auto NewCode = CodeTable->Insert(Slot, Key);
+				Encoder.Encode(Prefix);
+				Prefix = Index;
 
-				if (CodeTable.size() - 2 == Encoder.CurCodeSizeMaxValue())
+				if (NewCode - 1 == Encoder.CurCodeSizeMaxValue())
 				{
 					Encoder.IncreaseCodeSize();
 					if (Encoder.CurCodeSize > MaxCodeSize)
 					{ // 使用当前单词大小编码 ClearCode，然后再重置单词大小。
 						Encoder.CurCodeSize = MaxCodeSize;
-						Encoder.Encode(CodeTable.ClearCode);
+						Encoder.Encode(CodeTable->ClearCode);
 						Encoder.CurCodeSize = FirstCodeSize;
-						CodeTable.InitCodeTable();
+						CodeTable->InitCodeTable();
 					}
 				}
 			}
 		}
 
 		// 输出最后一步的编码
-		Encoder.Encode(CodeTable.at(CurIndexBuffer));
-		Encoder.Encode(CodeTable.EOICode);
+		Encoder.Encode(Prefix);
+		Encoder.Encode(CodeTable->EOICode);
 
 		return Encoder.GetEncodedBytes();
 	}
 
 	DataSubBlock ImageDescriptorType::UncompressLZW(const DataSubBlock& Compressed, uint8_t LZW_MinCodeSize)
+	{
+		return UncompressLZW(Compressed, LZW_MinCodeSize, 0);
+	}
+
+	DataSubBlock ImageDescriptorType::UncompressLZW(const DataSubBlock& Compressed, uint8_t LZW_MinCodeSize, size_t NumPixels)
 	{
 		// 允许无 LZW 压缩的 GIF
 		if (!LZW_MinCodeSize) return Compressed;
 
-		auto Output = DataSubBlock();
-		using LZWCodeUnpackedType = uint16_t;
-		using LZWCodeUnpackedVectorType = std::vector<LZWCodeUnpackedType>;
-
 		// https://giflib.sourceforge.net/whatsinagif/lzw_image_data.html
-		struct CodeTableType : public std::vector<DataSubBlock>
+		constexpr auto MaxCodeSize = 12;
+		constexpr auto MaxCodes = 1 << MaxCodeSize;
+		if (LZW_MinCodeSize >= MaxCodeSize)
 		{
-		public:
-			LZWCodeUnpackedType ClearCode;
-			LZWCodeUnpackedType EOICode;
-			uint8_t LZW_MinCodeSize;
+			throw UnexpectedData(std::string("GIF: LZW decompressing: bad LZW minimum code size ") + std::to_string(LZW_MinCodeSize) + ".");
+		}
+
+		using CodeType = uint16_t;
+
+		// 码表：每个编码记录其前缀编码、末尾字符、首字符与字符串长度，解码时不再构造任何中间字符串。
+		struct CodeTableType
+		{
+			std::array<CodeType, MaxCodes> Prefix;
+			std::array<uint8_t, MaxCodes> Suffix;
+			std::array<uint8_t, MaxCodes> First;
+			std::array<uint16_t, MaxCodes> Length;
+			CodeType ClearCode;
+			CodeType EOICode;
+			CodeType NextCode;
 
 			void InitCodeTable()
 			{
-				ClearCode = 1 << LZW_MinCodeSize;
-				EOICode = ClearCode + 1;
-
-				// clear();
-				if (!size())
-				{
-					for (int i = 0; i <= EOICode; i++)
-					{
-						push_back(DataSubBlock());
-						back().push_back(i);
-					}
-				}
-				else
-				{
-					resize(EOICode + 1);
-				}
+				NextCode = EOICode + 1;
 			}
 
-			CodeTableType(uint8_t LZW_MinCodeSize) :
-				std::vector<DataSubBlock>(),
-				LZW_MinCodeSize(LZW_MinCodeSize)
+			CodeTableType(uint8_t LZW_MinCodeSize)
 			{
-				ClearCode = LZWCodeUnpackedType(1) << LZW_MinCodeSize;
+				ClearCode = CodeType(1) << LZW_MinCodeSize;
 				EOICode = ClearCode + 1;
+				for (CodeType i = 0; i < ClearCode; i++)
+				{
+					Prefix[i] = 0;
+					Suffix[i] = uint8_t(i);
+					First[i] = uint8_t(i);
+					Length[i] = 1;
+				}
+				InitCodeTable();
 			}
 		};
 
-		// auto UnpackedCodes = LZWCodeUnpackedVectorType();
+		// 从低位到高位读取变长编码，用 64 位的位缓冲区一次性补充多个字节
+		struct CodeStreamDecoder
+		{
+		protected:
+			const uint8_t* BytePtr;
+			const uint8_t* ByteEnd;
+			uint64_t BitBuffer = 0;
+			int BitsInBuffer = 0;
 
-		auto CodeTable = CodeTableType(LZW_MinCodeSize);
-		bool DoFirstStep = true;
-		bool EOIReached = false;
-		bool ExpectCC = true; // 需要立刻获得一个 Clear Code
+		public:
+			CodeStreamDecoder(const DataSubBlock& Compressed) :
+				BytePtr(Compressed.data()), ByteEnd(Compressed.data() + Compressed.size())
+			{
+			}
 
-		// 先把 LZW 的字节序列以动态位数长度的编码转变为定长的编码。
-		const auto FirstCodeSize = LZW_MinCodeSize + 1;
-		constexpr auto MaxCodeSize = 12;
-		constexpr auto MaxUnpackedBits = sizeof(LZWCodeUnpackedType) * 8;
-		auto CurCode = LZWCodeUnpackedType(0);
-		auto LastCode = CurCode;
-		auto CurCodeSize = FirstCodeSize;
-		auto CurCodeMaxVal = (1 << (CurCodeSize)) - 1;
-
-		auto CurCodeBitsNeeded = CurCodeSize;
-		for (size_t i = 0; i < Compressed.size();)
-		{
-			auto CurByte = LZWCodeUnpackedType(Compressed[i]);
-			auto CurByteRemains = 8;
-			do
-			{ // 先做位数解码工作，获取到足够位数的数据后再做码表的工作
-				auto BitsToGet = CurCodeBitsNeeded;
-				if (BitsToGet > CurByteRemains) BitsToGet = CurByteRemains;
-				auto BitsMask = (1 << BitsToGet) - 1;
-				// 新获取到的 bits 放到 CurCode 的高位，由高处向低处生长
-				CurCode >>= BitsToGet;
-				CurCode |= (CurByte & BitsMask) << (MaxUnpackedBits - BitsToGet);
-				CurByte >>= BitsToGet;
-				CurByteRemains -= BitsToGet;
-				CurCodeBitsNeeded -= BitsToGet;
-				if (!CurByteRemains)
-				{ // 用完一个字节
-					i++;
-					if (i >= Compressed.size()) 
+			bool Decode(int CodeSize, CodeType& Code)
+			{
+				if (BitsInBuffer < CodeSize)
+				{
+					while (BitsInBuffer <= 56 && BytePtr < ByteEnd)
 					{
-						if (!CurCodeBitsNeeded)
-						{
-							CurCode >>= MaxUnpackedBits - CurCodeSize;
-							if (CurCode == CodeTable.EOICode) EOIReached = true;
-						}
-						break;
+						BitBuffer |= uint64_t(*BytePtr++) << BitsInBuffer;
+						BitsInBuffer += 8;
 					}
+					if (BitsInBuffer < CodeSize) return false;
 				}
-				if (!CurCodeBitsNeeded)
-				{ // 全部位数获取完，此处获取到了一个 LZW 编码数值
-					CurCode >>= MaxUnpackedBits - CurCodeSize; // 将堆积到高位的数值移回本来的位置
+				Code = CodeType(BitBuffer & ((uint64_t(1) << CodeSize) - 1));
+				BitBuffer >>= CodeSize;
+				BitsInBuffer -= CodeSize;
+				return true;
+			}
+		};
 
-					// 为调试：记录每个 Code 值
-					// UnpackedCodes.push_back(CurCode);
+		// 已知像素数时直接写入预先分配好的输出，多出的像素丢弃；否则按需扩张输出
+		const bool FixedSize = NumPixels != 0;
+		auto Output = DataSubBlock(FixedSize ? NumPixels : Compressed.size() * 2 + 64);
+		size_t OutputPos = 0;
 
-					if (ExpectCC && CurCode != CodeTable.ClearCode)
-					{
-						char buf[256];
-						snprintf(buf, sizeof buf, "GIF decompression: expect Clear Code, got 0x%04X", CurCode);
-						throw UnexpectedData(buf);
-						// std::cerr << buf << "\n";
-					}
-					if (CurCode == CodeTable.ClearCode)
-					{
-						ExpectCC = false;
-						CodeTable.InitCodeTable();
-						DoFirstStep = true;
-						CurCodeSize = FirstCodeSize;
-						CurCodeMaxVal = (1 << CurCodeSize) - 1;
-					}
-					else try
-					{
-						if (CurCode == CodeTable.EOICode)
-						{
-							EOIReached = true;
-							break;
-						}
-						else if (DoFirstStep)
-						{
-							DoFirstStep = false;
-							auto& ToOutput = CodeTable.at(CurCode);
-							Output.insert(Output.end(), ToOutput.cbegin(), ToOutput.cend());
-						}
-						else if (CurCode < CodeTable.size())
-						{
-							auto& ToOutput = CodeTable.at(CurCode);
-							Output.insert(Output.end(), ToOutput.cbegin(), ToOutput.cend());
-							auto K = ToOutput.at(0);
-							CodeTable.push_back(CodeTable.at(LastCode));
-							CodeTable.back().push_back(K);
-						}
-						else
-						{
-							DataSubBlock CodesToAdd = CodeTable.at(LastCode);
-							auto K = CodesToAdd.at(0);
-							CodesToAdd.push_back(K);
-							Output.insert(Output.end(), CodesToAdd.cbegin(), CodesToAdd.cend());
-							CodeTable.push_back(CodesToAdd);
-						}
-						if (CodeTable.size() - 1 >= CurCodeMaxVal)
-						{
-							CurCodeSize++;
-							if (CurCodeSize > MaxCodeSize)
-							{
-								ExpectCC = true;
-								CurCodeSize = MaxCodeSize; // 此时的 CC 长度应为最大单词长度。
-							}
-							CurCodeMaxVal = (1 << CurCodeSize) - 1;
-						}
-					}
-					catch (const std::out_of_range&)
+		auto CodeTable = std::make_unique<CodeTableType>(LZW_MinCodeSize);
+		auto Decoder = CodeStreamDecoder(Compressed);
+		const int FirstCodeSize = LZW_MinCodeSize + 1;
+		int CurCodeSize = FirstCodeSize;
+		bool EOIReached = false;
+		bool HasLastCode = false;
+		auto LastCode = CodeType(0);
+		auto CurCode = CodeType(0);
+
+		while (Decoder.Decode(CurCodeSize, CurCode))
+		{
+			if (CurCode == CodeTable->ClearCode)
+			{
+				CodeTable->InitCodeTable();
+				CurCodeSize = FirstCodeSize;
+				HasLastCode = false;
+				continue;
+			}
+			if (CurCode == CodeTable->EOICode)
+			{
+				EOIReached = true;
+				break;
+			}
+			if (!HasLastCode)
+			{ // 清码后的第一个编码必须是单个字符
+				if (CurCode > CodeTable->ClearCode) throw UnexpectedData("GIF: LZW decompressing: unexpected code exceeded code table limit.");
+			}
+			else
+			{
+				if (CurCode > CodeTable->NextCode) throw UnexpectedData("GIF: LZW decompressing: unexpected code exceeded code table limit.");
+				if (CodeTable->NextCode < MaxCodes)
+				{ // 添加新编码：上一个字符串 + 当前字符串的首字符（当前编码即新编码时，首字符与上一个字符串相同）
+					auto NewCode = CodeTable->NextCode++;
+					auto K = CurCode == NewCode ? CodeTable->First[LastCode] : CodeTable->First[CurCode];
+					CodeTable->Prefix[NewCode] = LastCode;
+					CodeTable->Suffix[NewCode] = K;
+					CodeTable->First[NewCode] = CodeTable->First[LastCode];
+					CodeTable->Length[NewCode] = CodeTable->Length[LastCode] + 1;
+					if (CodeTable->NextCode == (1 << CurCodeSize) && CurCodeSize < MaxCodeSize)
 					{
-						throw UnexpectedData("GIF: LZW decompressing: unexpected code exceeded code table limit.");
+						CurCodeSize++;
 					}
+				}
+				else if (CurCode == CodeTable->NextCode)
+				{ // 码表已满且编码器没有发出清码，此时不可能引用尚未建立的编码
+					throw UnexpectedData("GIF: LZW decompressing: unexpected code exceeded code table limit.");
+				}
+			}
 
-					CurCodeBitsNeeded = CurCodeSize;
-					LastCode = CurCode;
-					CurCode = 0;
+			// 从后往前填充当前编码对应的字符串
+			size_t Length = CodeTable->Length[CurCode];
+			auto Code = CurCode;
+			if (OutputPos + Length > Output.size())
+			{
+				if (FixedSize)
+				{
+					size_t Excess = OutputPos + Length - Output.size();
+					for (size_t i = 0; i < Excess; i++) Code = CodeTable->Prefix[Code];
+					Length -= Excess;
 				}
-			} while (CurByteRemains);
-			if (EOIReached) break;
+				else
+				{
+					Output.resize((OutputPos + Length) * 2);
+				}
+			}
+			auto WritePtr = &Output[0] + OutputPos;
+			for (size_t i = Length; i--;)
+			{
+				WritePtr[i] = CodeTable->Suffix[Code];
+				Code = CodeTable->Prefix[Code];
+			}
+			OutputPos += Length;
+
+			LastCode = CurCode;
+			HasLastCode = true;
 		}
 		if (!EOIReached)
 		{
 			throw MoreDataNeeded("GIF: LZW decompressing: expected EOI.");
 		}
-		if (CurCodeBitsNeeded)
-		{
-			throw MoreDataNeeded("GIF: LZW decompressing: expected more bytes/bits to read, got end of data.");
-		}
+		if (!FixedSize) Output.resize(OutputPos);
 		return Output;
 	}
 
@@ -759,7 +788,9 @@ namespace CPPGIF
 
 	const DataSubBlock& ImageDescriptorType::GetImageData() const
 	{
-		return ImageData;
+		if (!Pending) return ImageData;
+		DecodeImageData();
+		return Pending->ImageData;
 	}
 
 	GraphicControlExtensionType::GraphicControlExtensionType(uint8_t BlockSize, uint8_t Bitfields, uint16_t DelayTime, uint8_t TransparentColorIndex) :
@@ -960,9 +991,10 @@ namespace CPPGIF
 		return TransparentColorIndex;
 	}
 
-	GIFLoader::GIFLoader(const std::string& LoadFrom, bool Verbose) :
+	GIFLoader::GIFLoader(const std::string& LoadFrom, bool Verbose, DecodeMode Mode) :
 		Name(std::filesystem::path(LoadFrom).filename().string()),
-		Verbose(Verbose)
+		Verbose(Verbose),
+		Mode(Mode)
 	{
 		std::ifstream ifs;
 		ifs.exceptions(std::ios::failbit | std::ios::badbit);
@@ -970,15 +1002,16 @@ namespace CPPGIF
 		LoadGIF(ifs);
 	}
 
-	GIFLoader::GIFLoader(const std::string& LoadFrom, const std::string& Name, bool Verbose) :
-		GIFLoader(LoadFrom, Verbose)
+	GIFLoader::GIFLoader(const std::string& LoadFrom, const std::string& Name, bool Verbose, DecodeMode Mode) :
+		GIFLoader(LoadFrom, Verbose, Mode)
 	{
 		this->Name = Name;
 	}
 
-	GIFLoader::GIFLoader(std::istream& LoadFrom, const std::string& Name, bool Verbose) :
+	GIFLoader::GIFLoader(std::istream& LoadFrom, const std::string& Name, bool Verbose, DecodeMode Mode) :
 		Name(Name),
-		Verbose(Verbose)
+		Verbose(Verbose),
+		Mode(Mode)
 	{
 		LoadGIF(LoadFrom);
 	}
@@ -1014,68 +1047,41 @@ namespace CPPGIF
 		return LogicalScreenDescriptor;
 	}
 
-	ImageAnim GIFLoader::ConvertToImageAnim() const
+	void GIFLoader::DecodeFrames() const
 	{
-		auto ret = ImageAnim(GetWidth(), GetHeight(), Name, Verbose);
-		auto& BackgroundColor = LogicalScreenDescriptor.GetBackgroundColor();
-		auto BgColor = Pixel_RGBA8(BackgroundColor.R, BackgroundColor.G, BackgroundColor.B, 255);
-
-		if (GIFFrames.size())
+		// 各帧的 LZW 数据互相独立，可以并发解码；帧的合成仍然需要按顺序进行
+		auto ToDecode = std::vector<const ImageDescriptorType*>();
+		for (auto& Frame : GIFFrames)
 		{
-			auto* Prev = &GIFFrames.at(0);
-			for (auto& Frame : GIFFrames)
+			for (auto& GD : Frame.GraphicData)
 			{
-				// 第一帧直接绘制
-				if (!ret.Frames.size()) ret.Frames.push_back(Frame.ConvertToFrame(*this, Verbose));
-				else
-				{ // 之后的帧看情况绘制
-					auto DisposalMethod = GraphicControlExtensionType::DisposalMethodEnum::NoDisposalSpec;
-					if (Frame.GraphicControlExtension) DisposalMethod = Frame.GraphicControlExtension->GetDisposalMethod();
-					switch (DisposalMethod)
-					{
-					default: // 得在前一帧的基础上绘制
-					case GraphicControlExtensionType::NoDisposalSpec:
-					case GraphicControlExtensionType::DoNotDispose:
-						ret.Frames.push_back(ret.Frames.back());
-						Frame.DrawToFrame(ret.Frames.back(), GetGlobalColorTable());
-						break;
-					case GraphicControlExtensionType::RestoreToBackgroundColor:
-						do
-						{
-							ret.Frames.push_back(ret.Frames.back()); // 复制上一帧
-							auto& ToFill = ret.Frames.back(); // 在上一帧的基础上绘图
-							for (auto& ImgDesc : Prev->GraphicData)
-							{
-								int l = 0, t = 0, w = 0, h = 0, r, b;
-								if (ImgDesc.ImageDescriptor)
-								{
-									l = ImgDesc.ImageDescriptor->GetLeft();
-									t = ImgDesc.ImageDescriptor->GetTop();
-									w = ImgDesc.ImageDescriptor->GetWidth();
-									h = ImgDesc.ImageDescriptor->GetHeight();
-								}
-								else if (ImgDesc.PlainTextExtension)
-								{
-									l = ImgDesc.PlainTextExtension->TextGridLeftPosition;
-									t = ImgDesc.PlainTextExtension->TextGridTopPosition;
-									w = ImgDesc.PlainTextExtension->TextGridWidth;
-									h = ImgDesc.PlainTextExtension->TextGridHeight;
-								}
-								r = l + w - 1;
-								b = t + h - 1;
-								ToFill.FillRect(l, t, r, b, BgColor);
-							}
-						} while (false);
-						break;
-					case GraphicControlExtensionType::RestoreToPrevious: // 恢复到最初，其实就是不基于上一帧来绘图。
-						ret.Frames.push_back(Frame.ConvertToFrame(*this, Verbose));
-						break;
-					}
+				if (GD.ImageDescriptor && !GD.ImageDescriptor->IsImageDataDecoded())
+				{
+					ToDecode.push_back(GD.ImageDescriptor.get());
 				}
-				Prev = &Frame;
 			}
 		}
 
+#pragma omp parallel for schedule(dynamic)
+		for (int i = 0; i < int(ToDecode.size()); i++)
+		{
+			ToDecode[i]->DecodeImageData();
+		}
+	}
+
+	ImageAnim GIFLoader::ConvertToImageAnim() const
+	{
+		DecodeFrames();
+
+		auto ret = ImageAnim(GetWidth(), GetHeight(), Name, Verbose);
+		auto Compositor = GIFFrameCompositor(LogicalScreenDescriptor, Name, Verbose);
+
+		// 画布还要用于合成下一帧，每一帧只复制一次画布
+		ret.Frames.reserve(GIFFrames.size());
+		for (auto& Frame : GIFFrames)
+		{
+			ret.Frames.push_back(Compositor.Composite(Frame));
+		}
 		return ret;
 	}
 
@@ -1093,13 +1099,14 @@ namespace CPPGIF
 			switch (Introducer)
 			{
 			case '!':
+				// 先只读取压缩数据，读完整个文件后再并发解码
 				if (!GIFFrames.size() || GIFFrames.back().GraphicData.size())
-					GIFFrames.push_back(GIFFrameType(is));
+					GIFFrames.push_back(GIFFrameType(is, DecodeMode::Lazy));
 				else
 				{
 					CommentExtension = GIFFrames.back().CommentExtension;
 					ApplicationExtension = GIFFrames.back().ApplicationExtension;
-					GIFFrames.back() = GIFFrameType(is);
+					GIFFrames.back() = GIFFrameType(is, DecodeMode::Lazy);
 				}
 				break;
 			case 0x3B: ReadToTrailer = true; break;
@@ -1112,8 +1119,10 @@ namespace CPPGIF
 				} while (0);
 			}
 		}
+
+		if (Mode == DecodeMode::Eager) DecodeFrames();
 	}
-	GIFFrameType::GIFFrameType(std::istream& is)
+	GIFFrameType::GIFFrameType(std::istream& is, DecodeMode Mode)
 	{
 		for(;;)
 		{
@@ -1138,7 +1147,7 @@ namespace CPPGIF
 				break;
 			case 0x2C:
 				GraphicData.push_back(GraphicDataType());
-				GraphicData.back().ImageDescriptor = std::make_shared<ImageDescriptorType>(is);
+				GraphicData.back().ImageDescriptor = std::make_shared<ImageDescriptorType>(is, Mode);
 				break;
 			case 0xF9: GraphicControlExtension = std::make_shared<GraphicControlExtensionType>(is);
 				break;
@@ -1174,4 +1183,230 @@ namespace CPPGIF
 			}
 		}
 	}
+
+	GIFFrameCompositor::GIFFrameCompositor(const LogicalScreenDescriptorType& LogicalScreenDescriptor, const std::string& Name, bool Verbose) :
+		Canvas(LogicalScreenDescriptor.GetLogicalScreenWidth(), LogicalScreenDescriptor.GetLogicalScreenHeight(), Pixel_RGBA8(0, 0, 0, 0), Name, Verbose),
+		BgColor(0, 0, 0, 0),
+		GlobalColorTable(LogicalScreenDescriptor.GetGlobalColorTable())
+	{
+		// 没有全局色表时，背景色无从谈起，使用透明色
+		if (GlobalColorTable)
+		{
+			auto& BackgroundColor = LogicalScreenDescriptor.GetBackgroundColor();
+			BgColor = Pixel_RGBA8(BackgroundColor.R, BackgroundColor.G, BackgroundColor.B, 255);
+		}
+	}
+
+	const ImageAnimFrame& GIFFrameCompositor::Composite(const GIFFrameType& Frame)
+	{
+		// 先处置上一帧
+		switch (LastDisposalMethod)
+		{
+		default:
+		case GraphicControlExtensionType::NoDisposalSpec:
+		case GraphicControlExtensionType::DoNotDispose:
+			break;
+		case GraphicControlExtensionType::RestoreToBackgroundColor:
+			for (auto& Rect : LastFrameRects)
+			{
+				Canvas.FillRect(Rect[0], Rect[1], Rect[2], Rect[3], BgColor);
+			}
+			break;
+		case GraphicControlExtensionType::RestoreToPrevious:
+			if (Backup)
+			{
+				memcpy(Canvas.GetBitmapDataPtr(), Backup->GetBitmapDataPtr(), Canvas.GetBitmapSizeInTotal());
+			}
+			break;
+		}
+
+		auto DisposalMethod = GraphicControlExtensionType::NoDisposalSpec;
+		if (Frame.GraphicControlExtension) DisposalMethod = Frame.GraphicControlExtension->GetDisposalMethod();
+
+		// 当前帧显示完后要恢复到上一帧，则先备份画布
+		if (DisposalMethod == GraphicControlExtensionType::RestoreToPrevious)
+		{
+			if (!Backup) Backup = std::make_unique<Image_RGBA8>(Canvas.GetWidth(), Canvas.GetHeight(), "GIF backup", Canvas.Verbose);
+			memcpy(Backup->GetBitmapDataPtr(), Canvas.GetBitmapDataPtr(), Canvas.GetBitmapSizeInTotal());
+		}
+
+		Frame.DrawToFrame(Canvas, GlobalColorTable);
+
+		// 设置帧属性
+		if (Frame.GraphicControlExtension)
+		{
+			Canvas.Duration = Frame.GraphicControlExtension->GetDelayTime();
+		}
+		else
+		{
+			Canvas.Duration = 0;
+		}
+
+		// 记录当前帧的处置方法以及所占区域
+		LastDisposalMethod = DisposalMethod;
+		LastFrameRects.clear();
+		for (auto& GD : Frame.GraphicData)
+		{
+			int l = 0, t = 0, w = 0, h = 0;
+			if (GD.ImageDescriptor)
+			{
+				l = GD.ImageDescriptor->GetLeft();
+				t = GD.ImageDescriptor->GetTop();
+				w = GD.ImageDescriptor->GetWidth();
+				h = GD.ImageDescriptor->GetHeight();
+			}
+			else if (GD.PlainTextExtension)
+			{
+				l = GD.PlainTextExtension->TextGridLeftPosition;
+				t = GD.PlainTextExtension->TextGridTopPosition;
+				w = GD.PlainTextExtension->TextGridWidth;
+				h = GD.PlainTextExtension->TextGridHeight;
+			}
+			if (w && h) LastFrameRects.push_back({ l, t, l + w - 1, t + h - 1 });
+		}
+
+		return Canvas;
+	}
+
+	const ImageAnimFrame& GIFFrameCompositor::GetCanvas() const
+	{
+		return Canvas;
+	}
+
+	static std::unique_ptr<std::istream> OpenGIFFile(const std::string& LoadFrom)
+	{
+		auto ifs = std::make_unique<std::ifstream>();
+		ifs->exceptions(std::ios::failbit | std::ios::badbit);
+		ifs->open(LoadFrom, std::ios::binary);
+		return ifs;
+	}
+
+	GIFStreamDecoder::GIFStreamDecoder(const std::string& LoadFrom, bool Verbose) :
+		OwnedStream(OpenGIFFile(LoadFrom)),
+		is(*OwnedStream),
+		Name(std::filesystem::path(LoadFrom).filename().string()),
+		Verbose(Verbose)
+	{
+		LoadHeader();
+	}
+
+	GIFStreamDecoder::GIFStreamDecoder(std::istream& LoadFrom, const std::string& Name, bool Verbose) :
+		is(LoadFrom),
+		Name(Name),
+		Verbose(Verbose)
+	{
+		LoadHeader();
+	}
+
+	void GIFStreamDecoder::LoadHeader()
+	{
+		Version.resize(6);
+		Read(is, &Version[0], 6);
+		if (Version != "GIF87a" && Version != "GIF89a") throw UnexpectedData(std::string("GIF: Read error: Unknown version: ") + Version);
+		LogicalScreenDescriptor = LogicalScreenDescriptorType(is);
+		Compositor = std::make_unique<GIFFrameCompositor>(LogicalScreenDescriptor, Name, Verbose);
+	}
+
+	const std::string& GIFStreamDecoder::GetVersion() const
+	{
+		return Version;
+	}
+
+	uint16_t GIFStreamDecoder::GetWidth() const
+	{
+		return LogicalScreenDescriptor.GetLogicalScreenWidth();
+	}
+
+	uint16_t GIFStreamDecoder::GetHeight() const
+	{
+		return LogicalScreenDescriptor.GetLogicalScreenHeight();
+	}
+
+	const ColorTableArray* GIFStreamDecoder::GetGlobalColorTable() const
+	{
+		return LogicalScreenDescriptor.GetGlobalColorTable();
+	}
+
+	const LogicalScreenDescriptorType& GIFStreamDecoder::GetLogicalScreenDescriptor() const
+	{
+		return LogicalScreenDescriptor;
+	}
+
+	size_t GIFStreamDecoder::GetNumFramesRead() const
+	{
+		return NumFramesRead;
+	}
+
+	bool GIFStreamDecoder::ReadFrame()
+	{
+		auto Introducer = uint8_t();
+		while (!ReadToTrailer)
+		{
+			Read(is, Introducer);
+			switch (Introducer)
+			{
+			case '!':
+				do
+				{
+					auto Frame = GIFFrameType(is, DecodeMode::Eager);
+					if (Frame.GraphicData.size())
+					{
+						Compositor->Composite(Frame);
+						NumFramesRead++;
+						return true;
+					}
+					// 只有扩展块而没有图像的帧，保留其注释和应用扩展
+					if (Frame.CommentExtension) CommentExtension = Frame.CommentExtension;
+					if (Frame.ApplicationExtension) ApplicationExtension = Frame.ApplicationExtension;
+				} while (false);
+				break;
+			case 0x3B: ReadToTrailer = true; break;
+			default:
+				do
+				{
+					char buf[256];
+					snprintf(buf, sizeof buf, "GIF: Read error: got unknown introducer (0x%02X) here.", Introducer);
+					throw UnexpectedData(buf);
+				} while (0);
+			}
+		}
+		return false;
+	}
+
+	const ImageAnimFrame& GIFStreamDecoder::GetFrame() const
+	{
+		return Compositor->GetCanvas();
+	}
+
+	GIFStreamDecoder::Iterator::Iterator(GIFStreamDecoder* Decoder) :
+		Decoder(Decoder)
+	{
+	}
+
+	const ImageAnimFrame& GIFStreamDecoder::Iterator::operator*() const
+	{
+		return Decoder->GetFrame();
+	}
+
+	const ImageAnimFrame* GIFStreamDecoder::Iterator::operator->() const
+	{
+		return &Decoder->GetFrame();
+	}
+
+	GIFStreamDecoder::Iterator& GIFStreamDecoder::Iterator::operator++()
+	{
+		if (!Decoder->ReadFrame()) Decoder = nullptr;
+		return *this;
+	}
+
+	GIFStreamDecoder::Iterator GIFStreamDecoder::begin()
+	{
+		if (!NumFramesRead && !ReadFrame()) return end();
+		return Iterator(this);
+	}
+
+	GIFStreamDecoder::Iterator GIFStreamDecoder::end()
+	{
+		return Iterator(nullptr);
+	}
 }
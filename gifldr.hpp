@@ -4,6 +4,8 @@
 #include <vector>
 #include <string>
 #include <memory>
+#include <mutex>
+#include <atomic>
 #include <stdexcept>
 #include <iostream>
 
@@ -61,6 +63,13 @@ namespace CPPGIF
 
 	using DataSubBlock = std::vector<uint8_t>;
 
+	// 图像数据的解码时机：加载时立即解码，或者第一次访问图像数据时才解码
+	enum class DecodeMode
+	{
+		Eager,
+		Lazy
+	};
+
 	struct LogicalScreenDescriptorType
 	{ // LogicalScreenDescriptor
 	protected:
@@ -122,6 +131,20 @@ namespace CPPGIF
 		uint8_t Bitfields = 0;
 		std::shared_ptr<ColorTableArray> LocalColorTable = nullptr;
 		DataSubBlock ImageData;
+		uint8_t LZW_MinCodeSize = 0;
+
+		// 延迟解码时保存的 LZW 压缩数据和解码结果。第一次访问时用 std::call_once 解码，
+		// 多个线程同时访问同一个描述符也只解码一次；描述符的副本共用这份状态
+		struct PendingImageData
+		{
+			std::once_flag DecodeOnce;
+			std::atomic<bool> Decoded = false;
+			DataSubBlock CompressedData;
+			DataSubBlock ImageData;
+		};
+		std::shared_ptr<PendingImageData> Pending;
+
+		DataSubBlock DecodeCompressedData(const DataSubBlock& CompressedData) const;
 
 	public:
 		ImageDescriptorType() = default;
@@ -143,12 +166,15 @@ namespace CPPGIF
 		const ColorTableArray* GetLocalColorTable() const;
 		const ColorTableArray* GetLocalColorTable(size_t& numColorsOut) const;
 		const DataSubBlock& GetImageData() const;
+		bool IsImageDataDecoded() const;
+		void DecodeImageData() const;
 
 		static DataSubBlock CompressLZW(const DataSubBlock& Data, uint8_t LZW_MinCodeSize);
 		static DataSubBlock UncompressLZW(const DataSubBlock& Compressed, uint8_t LZW_MinCodeSize);
+		static DataSubBlock UncompressLZW(const DataSubBlock& Compressed, uint8_t LZW_MinCodeSize, size_t NumPixels);
 
 	public:
-		ImageDescriptorType(std::istream& is);
+		ImageDescriptorType(std::istream& is, DecodeMode Mode = DecodeMode::Eager);
 		void WriteFile(std::ostream& WriteTo, uint8_t LZW_MinCodeSize) const;
 	};
 
@@ -222,7 +248,7 @@ namespace CPPGIF
 		std::shared_ptr<CommentExtensionType> CommentExtension;
 		std::shared_ptr<ApplicationExtensionType> ApplicationExtension;
 
-		GIFFrameType(std::istream& is);
+		GIFFrameType(std::istream& is, DecodeMode Mode = DecodeMode::Eager);
 		void WriteFile(std::ostream& WriteTo, uint8_t LZW_MinCodeSize) const;
 
 		ImageAnimFrame ConvertToFrame(const GIFLoader& ldr, bool Verbose) const;
@@ -230,6 +256,28 @@ namespace CPPGIF
 		void DrawImageDesc(Image_RGBA8& DrawTo, const ImageDescriptorType& ImgDesc, const ColorTableArray* GlobalColorTablePtr) const;
 	};
 
+	// GIF 帧合成器：按顺序对每一帧执行上一帧的处置方法，再把当前帧绘制到画布上。
+	// 只保留当前画布，以及“恢复到上一帧”所需的备份画布。
+	class GIFFrameCompositor
+	{
+	protected:
+		ImageAnimFrame Canvas;
+		std::unique_ptr<Image_RGBA8> Backup = nullptr;
+		Pixel_RGBA8 BgColor;
+		const ColorTableArray* GlobalColorTable = nullptr;
+
+		// 上一帧的处置方法以及它所占用的区域
+		GraphicControlExtensionType::DisposalMethodEnum LastDisposalMethod = GraphicControlExtensionType::NoDisposalSpec;
+		std::vector<std::array<int, 4>> LastFrameRects;
+
+	public:
+		GIFFrameCompositor(const LogicalScreenDescriptorType& LogicalScreenDescriptor, const std::string& Name, bool Verbose);
+
+		// 合成下一帧，返回的画布在下一次调用前有效
+		const ImageAnimFrame& Composite(const GIFFrameType& Frame);
+		const ImageAnimFrame& GetCanvas() const;
+	};
+
 	class GIFLoader
 	{
 	public:
@@ -243,11 +291,12 @@ namespace CPPGIF
 
 		std::string Name;
 		bool Verbose = true;
+		DecodeMode Mode = DecodeMode::Eager; // 帧图像数据的解码时机
 
 	public:
-		GIFLoader(const std::string& LoadFrom, bool Verbose);
-		GIFLoader(const std::string& LoadFrom, const std::string& Name, bool Verbose);
-		GIFLoader(std::istream& LoadFrom, const std::string& Name, bool Verbose);
+		GIFLoader(const std::string& LoadFrom, bool Verbose, DecodeMode Mode = DecodeMode::Eager);
+		GIFLoader(const std::string& LoadFrom, const std::string& Name, bool Verbose, DecodeMode Mode = DecodeMode::Eager);
+		GIFLoader(std::istream& LoadFrom, const std::string& Name, bool Verbose, DecodeMode Mode = DecodeMode::Eager);
 
 		const std::string& GetVersion() const;
 		const uint16_t GetWidth() const;
@@ -257,10 +306,70 @@ namespace CPPGIF
 		const LogicalScreenDescriptorType& GetLogicalScreenDescriptor() const;
 		
 	public:
+		// 多线程并发解码所有尚未解码的帧
+		void DecodeFrames() const;
+
 		ImageAnim ConvertToImageAnim() const;
 
 	protected:
 		void LoadGIF(std::istream& is);
 	};
+
+	// 流式 GIF 解码器：每次只从输入流里读取并合成一帧，内存占用与帧数无关。
+	class GIFStreamDecoder
+	{
+	protected:
+		std::unique_ptr<std::istream> OwnedStream = nullptr;
+		std::istream& is;
+		std::string Version; // gif87a / gif89a
+		LogicalScreenDescriptorType LogicalScreenDescriptor; // 逻辑屏幕描述符
+		std::unique_ptr<GIFFrameCompositor> Compositor = nullptr;
+		bool ReadToTrailer = false; // 是否已经读到文件结束符
+		size_t NumFramesRead = 0;
+
+		void LoadHeader();
+
+	public:
+		std::shared_ptr<CommentExtensionType> CommentExtension;
+		std::shared_ptr<ApplicationExtensionType> ApplicationExtension;
+
+		std::string Name;
+		bool Verbose = true;
+
+	public:
+		GIFStreamDecoder(const std::string& LoadFrom, bool Verbose);
+		GIFStreamDecoder(std::istream& LoadFrom, const std::string& Name, bool Verbose);
+		GIFStreamDecoder(const GIFStreamDecoder&) = delete;
+		GIFStreamDecoder& operator=(const GIFStreamDecoder&) = delete;
+
+		const std::string& GetVersion() const;
+		uint16_t GetWidth() const;
+		uint16_t GetHeight() const;
+		const ColorTableArray* GetGlobalColorTable() const;
+		const LogicalScreenDescriptorType& GetLogicalScreenDescriptor() const;
+		size_t GetNumFramesRead() const;
+
+		// 读取并合成下一帧，读到文件结束符时返回 false
+		bool ReadFrame();
+
+		// 当前合成好的帧，在下一次调用 `ReadFrame()` 前有效
+		const ImageAnimFrame& GetFrame() const;
+
+		class Iterator
+		{
+		protected:
+			GIFStreamDecoder* Decoder;
+
+		public:
+			Iterator(GIFStreamDecoder* Decoder);
+			const ImageAnimFrame& operator*() const;
+			const ImageAnimFrame* operator->() const;
+			Iterator& operator++();
+			bool operator == (const Iterator& other) const = default;
+		};
+
+		Iterator begin();
+		Iterator end();
+	};
 }
 
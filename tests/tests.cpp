@@ -3,10 +3,110 @@
 #include "PaletteGen.hpp"
 #include "ImageAnim.hpp"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <new>
+#include <optional>
+#include <sstream>
+#include <thread>
+#include <utility>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 using namespace CPPGIF;
 using namespace PaletteGeneratorLib;
 using namespace ImageAnimation;
 
+// 统计不小于 LargeAllocThreshold 字节的内存分配次数，用来发现意外的整帧像素复制。阈值为 0 时不统计
+static std::atomic<size_t> LargeAllocThreshold = 0;
+static std::atomic<size_t> NumLargeAllocs = 0;
+
+// 所有版本的 operator new/delete 都走同一对对齐分配函数，保证分配与释放严格配对。
+// 位图缓冲区按缓存行对齐分配，走的是对齐版本的 operator new
+static void* CountedAlloc(size_t Size, size_t Align) noexcept
+{
+	auto Threshold = LargeAllocThreshold.load(std::memory_order_relaxed);
+	if (Threshold && Size >= Threshold) NumLargeAllocs++;
+	auto Rounded = (std::max<size_t>(Size, 1) + Align - 1) / Align * Align;
+#ifdef _MSC_VER
+	return _aligned_malloc(Rounded, Align);
+#else
+	return std::aligned_alloc(Align, Rounded);
+#endif
+}
+
+static void CountedFree(void* p) noexcept
+{
+#ifdef _MSC_VER
+	_aligned_free(p);
+#else
+	free(p);
+#endif
+}
+
+void* operator new(size_t Size, std::align_val_t Alignment)
+{
+	if (auto p = CountedAlloc(Size, size_t(Alignment))) return p;
+	throw std::bad_alloc();
+}
+
+void* operator new(size_t Size)
+{
+	return operator new(Size, std::align_val_t(__STDCPP_DEFAULT_NEW_ALIGNMENT__));
+}
+
+void* operator new[](size_t Size)
+{
+	return operator new(Size);
+}
+
+void* operator new[](size_t Size, std::align_val_t Alignment)
+{
+	return operator new(Size, Alignment);
+}
+
+void* operator new(size_t Size, const std::nothrow_t&) noexcept
+{
+	return CountedAlloc(Size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void* operator new[](size_t Size, const std::nothrow_t&) noexcept
+{
+	return CountedAlloc(Size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void* operator new(size_t Size, std::align_val_t Alignment, const std::nothrow_t&) noexcept
+{
+	return CountedAlloc(Size, size_t(Alignment));
+}
+
+void* operator new[](size_t Size, std::align_val_t Alignment, const std::nothrow_t&) noexcept
+{
+	return CountedAlloc(Size, size_t(Alignment));
+}
+
+void operator delete(void* p) noexcept { CountedFree(p); }
+void operator delete(void* p, size_t) noexcept { CountedFree(p); }
+void operator delete(void* p, std::align_val_t) noexcept { CountedFree(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { CountedFree(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { CountedFree(p); }
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { CountedFree(p); }
+void operator delete[](void* p) noexcept { CountedFree(p); }
+void operator delete[](void* p, size_t) noexcept { CountedFree(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { CountedFree(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { CountedFree(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { CountedFree(p); }
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { CountedFree(p); }
+
 void test_loadgif(const std::string& gif_file, const std::string& png_file)
 {
 	std::cout << gif_file << "\n";
@@ -22,6 +122,85 @@ void test_loadgif()
 	test_loadgif("test.gif", "test4.png");
 }
 
+void test_lazyloadgif(const std::string& gif_file)
+{
+	auto Gif = GIFLoader(gif_file, false, DecodeMode::Lazy);
+	std::cout << gif_file << ": " << Gif.GetWidth() << "x" << Gif.GetHeight() << ", " << Gif.GIFFrames.size() << " frames\n";
+
+	// 两个线程同时在同一个 const 加载器上触发延迟解码，每一帧只能解码一次
+	const auto& SharedGif = Gif;
+	auto Concurrent = std::optional<ImageAnim>();
+	auto Other = std::thread([&]() { Concurrent.emplace(SharedGif.ConvertToImageAnim()); });
+	auto Lazy = SharedGif.ConvertToImageAnim();
+	Other.join();
+
+	auto Eager = GIFLoader(gif_file, false, DecodeMode::Eager).ConvertToImageAnim();
+	for (size_t i = 0; i < Eager.Frames.size(); i++)
+	{
+		auto& e = Eager.Frames[i];
+		for (auto& l : { std::cref(Lazy.Frames[i]), std::cref(Concurrent->Frames[i]) })
+		{
+			if (memcmp(l.get().GetBitmapDataPtr(), e.GetBitmapDataPtr(), e.GetBitmapSizeInTotal()))
+			{
+				std::cout << "Lazy decoded frame " << i << " differs from eager decoded frame.\n";
+			}
+		}
+	}
+}
+
+void test_framecopies(const std::string& gif_file)
+{
+	// 解码时每一帧只应分配一次像素缓冲区，另外只有合成用的画布；之后移动动画与帧都不应再分配
+	auto Gif = GIFLoader(gif_file, false);
+	LargeAllocThreshold = size_t(Gif.GetWidth()) * Gif.GetHeight() * sizeof(Pixel_RGBA8);
+	NumLargeAllocs = 0;
+	auto Anim = Gif.ConvertToImageAnim();
+	size_t DecodeAllocs = NumLargeAllocs;
+
+	NumLargeAllocs = 0;
+	auto Moved = std::move(Anim);
+	auto Frames = std::vector<ImageAnimFrame>();
+	for (auto& Frame : Moved.Frames) Frames.push_back(std::move(Frame));
+	auto Rewrapped = ImageAnimFrame(Image_RGBA8(std::move(Frames.back())), 0);
+	size_t MoveAllocs = NumLargeAllocs;
+	LargeAllocThreshold = 0;
+
+	bool Valid = Rewrapped.GetWidth() == Gif.GetWidth() && Frames.back().GetWidth() == 0 && Rewrapped.GetBitmapRowPtr(0) == Rewrapped.GetBitmapDataPtr();
+	std::cout << "FrameAllocations(" << gif_file << "): " << DecodeAllocs << " pixel buffers for " << Frames.size() << " frames, "
+		<< MoveAllocs << " while moving" << (DecodeAllocs == Frames.size() + 1 && MoveAllocs == 0 && Valid ? "" : " (unexpected)") << "\n";
+}
+
+void test_lazyloadgif()
+{
+	test_lazyloadgif("Rotating_earth_(large).gif");
+	test_lazyloadgif("testre.gif");
+}
+
+void test_streamgif(const std::string& gif_file)
+{
+	auto Anim = GIFLoader(gif_file, false).ConvertToImageAnim();
+	auto Stream = GIFStreamDecoder(gif_file, false);
+	size_t i = 0;
+	for (auto& Frame : Stream)
+	{
+		if (i >= Anim.Frames.size() || Frame.GetDuration() != Anim.Frames[i].GetDuration() ||
+			memcmp(Frame.GetBitmapDataPtr(), Anim.Frames[i].GetBitmapDataPtr(), Frame.GetBitmapSizeInTotal()))
+		{
+			std::cout << "Streamed frame " << i << " of " << gif_file << " differs from `ConvertToImageAnim()`.\n";
+		}
+		i++;
+	}
+	std::cout << gif_file << ": streamed " << i << " of " << Anim.Frames.size() << " frames\n";
+}
+
+void test_streamgif()
+{
+	test_streamgif("sample_1.gif");
+	test_streamgif("Rotating_earth_(large).gif");
+	test_streamgif("testre.gif");
+	test_streamgif("test.gif");
+}
+
 void test_getpalette()
 {
 	auto Colorful = Image_RGBA8("testcolorful.png", true);
@@ -52,6 +231,154 @@ void test_getpalette()
 	PalImage.SaveToPNG("testpalette.png");
 }
 
+void test_nearestcolor(const std::vector<PaletteItem>& Palette, const std::string& Name)
+{
+	auto start = std::chrono::steady_clock::now();
+	auto Lookup = NearestColorLookup(Palette);
+	auto end = std::chrono::steady_clock::now();
+	auto Searches = std::vector<PaletteSearch>();
+	for (auto ISA : { PaletteSearchISA::Scalar, PaletteSearchISA::SSE41, PaletteSearchISA::AVX2 })
+	{
+		Searches.push_back(PaletteSearch(Palette, ISA));
+	}
+
+	size_t NumMismatches = 0;
+	for (int R = 0; R < 256; R += 3)
+	{
+		for (int G = 0; G < 256; G++)
+		{
+			for (int B = 0; B < 256; B++)
+			{
+				int MinDiff = 0x7fffffff;
+				int MinDiffI = 0;
+				for (int i = 0; i < int(Palette.size()); i++)
+				{
+					int RD = R - Palette[i].R;
+					int GD = G - Palette[i].G;
+					int BD = B - Palette[i].B;
+					int Diff = RD * RD + GD * GD + BD * BD;
+					if (Diff < MinDiff)
+					{
+						MinDiff = Diff;
+						MinDiffI = i;
+					}
+				}
+				if (Lookup.GetNearest(R, G, B) != MinDiffI) NumMismatches++;
+				for (auto& Search : Searches)
+				{
+					if (Search.GetNearest(R, G, B) != MinDiffI) NumMismatches++;
+				}
+			}
+		}
+	}
+	std::cout << "NearestColorLookup(" << Name << "): " << std::chrono::duration<double, std::milli>(end - start).count() << " ms to build, " << NumMismatches << " mismatches\n";
+}
+
+void test_mapimagetopalette(const Image_RGBA8& Image, const std::vector<PaletteItem>& Palette)
+{
+	auto Indices = MapImageToPalette(Image, Palette);
+	auto Lookup = NearestColorLookup(Palette);
+	size_t NumMismatches = 0;
+	for (uint32_t y = 0; y < Image.GetHeight(); y++)
+	{
+		auto Row = Image.GetBitmapRowPtr(y);
+		for (uint32_t x = 0; x < Image.GetWidth(); x++)
+		{
+			if (Indices[size_t(y) * Image.GetWidth() + x] != Lookup.GetNearest(Row[x].R, Row[x].G, Row[x].B)) NumMismatches++;
+		}
+	}
+	std::cout << "MapImageToPalette(" << Image.GetWidth() << "x" << Image.GetHeight() << "): " << NumMismatches << " mismatches\n";
+}
+
+void test_colorhistogram(const std::string& gif_file)
+{
+	auto Anim = GIFLoader(gif_file, false).ConvertToImageAnim();
+	size_t NumMismatches = 0;
+	for (auto& Frame : Anim.Frames)
+	{
+		auto Histogram = ColorHistogram();
+		Histogram.AddImage(Frame);
+
+		auto Expected = std::map<uint32_t, uint32_t>();
+		for (uint32_t y = 0; y < Frame.GetHeight(); y++)
+		{
+			auto Row = Frame.GetBitmapRowPtr(y);
+			for (uint32_t x = 0; x < Frame.GetWidth(); x++) Expected[PaletteItem{ Row[x].R, Row[x].G, Row[x].B }.ToRGBA(0)]++;
+		}
+
+		auto Colors = Histogram.GetColors();
+		if (Colors.size() != Expected.size() || Histogram.GetNumColors() != Expected.size()) NumMismatches++;
+		for (auto& Color : Colors)
+		{
+			if (Expected[PaletteItem{ Color.R, Color.G, Color.B }.ToRGBA(0)] != Color.Count) NumMismatches++;
+		}
+	}
+	std::cout << "ColorHistogram(" << gif_file << "): " << NumMismatches << " mismatches\n";
+}
+
+void test_quantizer(const std::string& gif_file, size_t MaxColors)
+{
+	auto Anim = GIFLoader(gif_file, false).ConvertToImageAnim();
+	const std::pair<const char*, std::shared_ptr<const ColorQuantizer>> Quantizers[] =
+	{
+		{ "octree", std::make_shared<OctreeQuantizer>() },
+		{ "median cut", std::make_shared<MedianCutQuantizer>() },
+	};
+	for (auto& [Name, Quantizer] : Quantizers)
+	{
+		double SqError = 0;
+		double NumPixels = 0;
+		size_t NumOverflows = 0;
+		for (auto& Frame : Anim.Frames)
+		{
+			bool PaletteIsExact = false;
+			auto Palette = QuantizeColors(Frame, MaxColors, *Quantizer, PaletteIsExact);
+			if (Palette.size() > MaxColors) NumOverflows++;
+			auto Lookup = NearestColorLookup(Palette);
+			for (uint32_t y = 0; y < Frame.GetHeight(); y++)
+			{
+				auto Row = Frame.GetBitmapRowPtr(y);
+				for (uint32_t x = 0; x < Frame.GetWidth(); x++)
+				{
+					auto& Color = Palette[Lookup.GetNearest(Row[x].R, Row[x].G, Row[x].B)];
+					int RD = Color.R - Row[x].R, GD = Color.G - Row[x].G, BD = Color.B - Row[x].B;
+					SqError += RD * RD + GD * GD + BD * BD;
+				}
+			}
+			NumPixels += double(Frame.GetWidth()) * Frame.GetHeight();
+		}
+		std::cout << "QuantizeColors(" << gif_file << ", " << MaxColors << ", " << Name << "): MSE " << SqError / NumPixels << ", " << NumOverflows << " oversized palettes\n";
+	}
+}
+
+void test_nearestcolor()
+{
+	auto Random = std::vector<PaletteItem>();
+	uint32_t Seed = 12345;
+	for (int i = 0; i < 256; i++)
+	{
+		Seed = Seed * 1103515245 + 12345;
+		Random.push_back(PaletteItem{ uint8_t(Seed >> 24), uint8_t(Seed >> 16), uint8_t(Seed >> 8) });
+	}
+	test_nearestcolor(Random, "random");
+
+	auto Gray = std::vector<PaletteItem>();
+	for (int i = 0; i < 256; i += 17) Gray.push_back(PaletteItem{ uint8_t(i), uint8_t(i), uint8_t(i) });
+	Gray.push_back(PaletteItem{ 0, 0, 0 });
+	test_nearestcolor(Gray, "gray");
+
+	bool PaletteIsExact = false;
+	auto Image = Image_RGBA8("test4.png", true);
+	auto Palette = PaletteGenerator::GetColors(Image, 256, PaletteIsExact);
+	test_nearestcolor(Palette, "test4.png");
+
+	test_mapimagetopalette(Image, Palette);
+
+	auto Small = Image_RGBA8(256, Image.GetHeight(), "test4_small", true);
+	Small.Paint(Image, 0, 0, 256, Image.GetHeight(), 0, 0);
+	test_mapimagetopalette(Small, Palette);
+}
+
 void test_savegif(const std::string& pngfile, const std::string& gif_file, int slice_width, int interval)
 {
 	auto options = SaveGIFOptions();
@@ -63,7 +390,7 @@ void test_savegif(const std::string& pngfile, const std::string& gif_file, int s
 	{
 		auto Frame = ImageAnimFrame(Image_RGBA8(slice_width, PngFile.GetHeight(), ImgAnim.Name + "_frame_" + std::to_string(ImgAnim.Frames.size()), true), interval);
 		Frame.Paint(PngFile, 0, 0, slice_width, PngFile.GetHeight(), x, 0);
-		ImgAnim.Frames.push_back(Frame);
+		ImgAnim.Frames.push_back(std::move(Frame));
 	}
 	ImgAnim.SaveGIF(gif_file, options);
 }
@@ -74,9 +401,1041 @@ void test_savegif()
 	test_savegif("test4.png", "testout.gif", 200, 1);
 }
 
+// 只用黑白两色的调色板，用来检查 SaveGIF() 确实使用了传入的算法
+class BlackWhiteQuantizer : public ColorQuantizer
+{
+public:
+	std::vector<PaletteItem> GetColors(const ColorHistogram&, size_t, bool& PaletteIsExact) const override
+	{
+		PaletteIsExact = false;
+		return { PaletteItem{ 0, 0, 0 }, PaletteItem{ 255, 255, 255 } };
+	}
+};
+
+void test_savegifquantizer()
+{
+	// 渐变色远多于 256 种，不同的算法会得到不同的调色板
+	auto Anim = ImageAnim(160, 120, "gradient", false);
+	for (int f = 0; f < 4; f++)
+	{
+		auto Frame = ImageAnimFrame(Image_RGBA8(160, 120, "frame", false), 10);
+		for (uint32_t y = 0; y < Frame.GetHeight(); y++)
+		{
+			auto Row = Frame.GetBitmapRowPtr(y);
+			for (uint32_t x = 0; x < Frame.GetWidth(); x++) Row[x] = Pixel_RGBA8(uint8_t(x * 255 / 159), uint8_t(y * 255 / 119), uint8_t(f * 60 + ((x + y) & 31)), 255);
+		}
+		Anim.Frames.push_back(std::move(Frame));
+	}
+	auto Histogram = ColorHistogram();
+	for (auto& Frame : Anim.Frames) Histogram.AddImage(Frame);
+
+	const std::pair<const char*, std::shared_ptr<const ColorQuantizer>> Quantizers[] =
+	{
+		{ "octree", std::make_shared<OctreeQuantizer>() },
+		{ "median cut", std::make_shared<MedianCutQuantizer>() },
+		{ "black and white", std::make_shared<BlackWhiteQuantizer>() },
+	};
+	auto Encoded = std::vector<std::string>();
+	auto MSE = std::vector<double>();
+	size_t NumBadColors = 0;
+	for (auto& [Name, Quantizer] : Quantizers)
+	{
+		auto options = SaveGIFOptions();
+		options.Quantizer = Quantizer;
+		auto ss = std::stringstream();
+		Anim.SaveGIF(ss, options);
+		Encoded.push_back(ss.str());
+
+		auto Reloaded = GIFLoader(ss, Name, false).ConvertToImageAnim();
+		double SqError = 0;
+		for (size_t i = 0; i < Anim.Frames.size(); i++)
+		{
+			for (uint32_t y = 0; y < Anim.GetHeight(); y++)
+			{
+				auto Src = Anim.Frames[i].GetBitmapRowPtr(y);
+				auto Dst = Reloaded.Frames[i].GetBitmapRowPtr(y);
+				for (uint32_t x = 0; x < Anim.GetWidth(); x++)
+				{
+					int RD = Src[x].R - Dst[x].R, GD = Src[x].G - Dst[x].G, BD = Src[x].B - Dst[x].B;
+					SqError += RD * RD + GD * GD + BD * BD;
+					if (Quantizer == Quantizers[2].second && ((Dst[x].R != 0 && Dst[x].R != 255) || Dst[x].G != Dst[x].R || Dst[x].B != Dst[x].R)) NumBadColors++;
+				}
+			}
+		}
+		MSE.push_back(SqError / (double(Anim.GetWidth()) * Anim.GetHeight() * Anim.Frames.size()));
+	}
+
+	std::cout << "SaveGIF(" << Histogram.GetNumColors() << " colors): MSE octree " << MSE[0] << ", median cut " << MSE[1] << ", black and white " << MSE[2]
+		<< ", " << NumBadColors << " pixels outside the black and white palette"
+		<< (Histogram.GetNumColors() > 256 && Encoded[0] != Encoded[1] && Encoded[1] != Encoded[2] && NumBadColors == 0 ? "" : " (unexpected)") << "\n";
+}
+
+// 误差扩散按波前多线程处理，结果应当与单线程逐行处理完全相同
+void test_ditherthreads(const std::string& gif_file)
+{
+#ifdef _OPENMP
+	auto Anim = GIFLoader(gif_file, false).ConvertToImageAnim();
+	Anim.Verbose = false;
+	auto options = SaveGIFOptions();
+	auto MaxThreads = omp_get_max_threads();
+
+	auto Encoded = std::vector<std::string>();
+	for (int NumThreads : { 1, 2, 4 })
+	{
+		omp_set_num_threads(NumThreads);
+		auto ss = std::ostringstream();
+		Anim.SaveGIF(ss, options);
+		Encoded.push_back(ss.str());
+	}
+	omp_set_num_threads(MaxThreads);
+
+	size_t NumMismatches = 0;
+	for (auto& Data : Encoded)
+	{
+		if (Data != Encoded[0]) NumMismatches++;
+	}
+	std::cout << "Dithering(" << gif_file << "): " << NumMismatches << " mismatches between thread counts\n";
+#endif
+}
+
+void test_framesinflight(const std::string& gif_file, bool UseLocalPalettes)
+{
+	auto Anim = GIFLoader(gif_file, false).ConvertToImageAnim();
+	Anim.Verbose = false;
+	auto options = SaveGIFOptions();
+	options.UseLocalPalettes = UseLocalPalettes;
+
+	auto Encoded = std::vector<std::string>();
+	for (int MaxFramesInFlight : { 1, 3, 0 })
+	{
+		options.MaxFramesInFlight = MaxFramesInFlight;
+		auto ss = std::ostringstream();
+		Anim.SaveGIF(ss, options);
+		Encoded.push_back(ss.str());
+	}
+
+	size_t NumMismatches = 0;
+	for (auto& Data : Encoded)
+	{
+		if (Data != Encoded[0]) NumMismatches++;
+	}
+	std::cout << "FramesInFlight(" << gif_file << ", local palettes: " << UseLocalPalettes << "): " << NumMismatches << " mismatches between batch sizes\n";
+}
+
+template<typename PixelType>
+void test_rotate(uint32_t Width, uint32_t Height)
+{
+	auto Source = Image<PixelType>(Width, Height, "rotate", false);
+	uint32_t Seed = 1;
+	for (uint32_t y = 0; y < Height; y++)
+	{
+		for (uint32_t x = 0; x < Width; x++)
+		{
+			Seed = Seed * 1103515245 + 12345;
+			Source.PutPixel(x, y, PixelType(Pixel_RGBA8(uint8_t(Seed >> 24), uint8_t(Seed >> 16), uint8_t(x), uint8_t(y))));
+		}
+	}
+
+	auto CountMismatches = [&](const Image<PixelType>& Rotated, bool ClockWise) -> size_t
+	{
+		size_t NumMismatches = 0;
+		for (uint32_t y = 0; y < Width; y++)
+		{
+			for (uint32_t x = 0; x < Height; x++)
+			{
+				auto Expected = ClockWise ? Source.GetPixel(y, Height - 1 - x) : Source.GetPixel(Width - 1 - y, x);
+				if (Rotated.GetPixel(x, y) != Expected) NumMismatches++;
+			}
+		}
+		return NumMismatches;
+	};
+
+	size_t NumMismatches = 0;
+	auto CW = Source;
+	CW.Rotate90_CW();
+	NumMismatches += CountMismatches(CW, true);
+	auto CCW = Source;
+	CCW.Rotate270_CW();
+	NumMismatches += CountMismatches(CCW, false);
+	std::cout << "Rotate(" << sizeof(PixelType) * 8 << " bpp, " << Width << "x" << Height << "): " << NumMismatches << " mismatches\n";
+
+	// 原地旋转，包括行指针倒序（如自底向上存储的 Bmp）的情况
+	NumMismatches = 0;
+	for (bool RowPtrsFlipped : { false, true })
+	{
+		auto InPlaceCW = Source;
+		auto InPlaceCCW = Source;
+		if (RowPtrsFlipped)
+		{
+			InPlaceCW.FlipV_RowPtrs();
+			InPlaceCW.FlipV();
+			InPlaceCCW.FlipV_RowPtrs();
+			InPlaceCCW.FlipV();
+		}
+		InPlaceCW.Rotate90_CW_InPlace();
+		NumMismatches += CountMismatches(InPlaceCW, true);
+		InPlaceCCW.Rotate270_CW_InPlace();
+		NumMismatches += CountMismatches(InPlaceCCW, false);
+	}
+	std::cout << "RotateInPlace(" << sizeof(PixelType) * 8 << " bpp, " << Width << "x" << Height << "): " << NumMismatches << " mismatches\n";
+}
+
+void test_rotate()
+{
+	test_rotate<Pixel_RGBA8>(67, 45);
+	test_rotate<Pixel_RGBA8>(1, 33);
+	test_rotate<Pixel_RGBA8>(70, 70);
+	test_rotate<Pixel_RGBA16>(67, 45);
+	test_rotate<Pixel_RGBA32F>(45, 67);
+}
+
+void test_orientation()
+{
+	auto Source = Image_RGBA8(37, 23, "orientation", false);
+	uint32_t Seed = 1;
+	for (uint32_t y = 0; y < Source.GetHeight(); y++)
+	{
+		for (uint32_t x = 0; x < Source.GetWidth(); x++)
+		{
+			Seed = Seed * 1103515245 + 12345;
+			Source.PutPixel(x, y, Pixel_RGBA8(uint8_t(Seed >> 24), uint8_t(Seed >> 16), uint8_t(x), uint8_t(y)));
+		}
+	}
+
+	auto IsSameImage = [](const Image_RGBA8& a, const Image_RGBA8& b) -> bool
+	{
+		if (a.GetWidth() != b.GetWidth() || a.GetHeight() != b.GetHeight()) return false;
+		for (uint32_t y = 0; y < a.GetHeight(); y++)
+		{
+			if (memcmp(a.GetBitmapRowPtr(y), b.GetBitmapRowPtr(y), a.GetPitch())) return false;
+		}
+		return true;
+	};
+
+	// 延迟的方向变换与先旋转像素再操作的结果应当完全相同
+	size_t NumMismatches = 0;
+	for (int o = 1; o <= 8; o++)
+	{
+		auto Orientation = ExifOrientation(o);
+		auto Applied = Source;
+		Applied.SetOrientation(Orientation);
+		Applied.ApplyOrientation();
+
+		auto Deferred = Source;
+		Deferred.SetOrientation(Orientation);
+		if (Deferred.GetOrientedWidth() != Applied.GetWidth() || Deferred.GetOrientedHeight() != Applied.GetHeight()) NumMismatches++;
+		for (uint32_t y = 0; y < Applied.GetHeight(); y++)
+		{
+			for (uint32_t x = 0; x < Applied.GetWidth(); x++)
+			{
+				if (Deferred.GetOrientedPixel(x, y) != Applied.GetPixel(x, y)) NumMismatches++;
+			}
+		}
+		if (Deferred.SaveToPNG() != Applied.SaveToPNG()) NumMismatches++;
+
+		for (auto Size : { std::pair<uint32_t, uint32_t>(11, 7), std::pair<uint32_t, uint32_t>(50, 60) })
+		{
+			auto Fused = Deferred;
+			auto Separate = Applied;
+			Fused.ResizeNearest(Size.first, Size.second);
+			Separate.ResizeNearest(Size.first, Size.second);
+			if (!IsSameImage(Fused, Separate)) NumMismatches++;
+
+			Fused = Deferred;
+			Separate = Applied;
+			Fused.ResizeLinear(Size.first, Size.second);
+			Separate.ResizeLinear(Size.first, Size.second);
+			if (!IsSameImage(Fused, Separate)) NumMismatches++;
+		}
+	}
+	std::cout << "Orientation: " << NumMismatches << " mismatches between deferred and applied orientation\n";
+}
+
+template<typename PixelType>
+size_t count_resize_color_changes(ResizeFilter Filter, const PixelType& Color)
+{
+	// 纯色图像无论怎样缩放，颜色都不应改变
+	size_t NumMismatches = 0;
+	for (auto Size : { std::pair<uint32_t, uint32_t>(13, 200), std::pair<uint32_t, uint32_t>(150, 9) })
+	{
+		auto Solid = Image<PixelType>(61, 47, Color, "solid", false);
+		Solid.Resize(Size.first, Size.second, Filter);
+		for (uint32_t y = 0; y < Solid.GetHeight(); y++)
+		{
+			for (uint32_t x = 0; x < Solid.GetWidth(); x++)
+			{
+				auto c = Pixel_RGBA32F(Solid.GetPixel(x, y));
+				auto e = Pixel_RGBA32F(Color);
+				if (std::abs(c.R - e.R) > 1e-3f || std::abs(c.G - e.G) > 1e-3f || std::abs(c.B - e.B) > 1e-3f || std::abs(c.A - e.A) > 1e-3f) NumMismatches++;
+			}
+		}
+	}
+	return NumMismatches;
+}
+
+void test_resize(ResizeFilter Filter, const std::string& FilterName)
+{
+	auto Noise = Image_RGBA8(200, 150, "noise", false);
+	auto Gradient = Image_RGBA8(200, 150, "gradient", false);
+	uint32_t Seed = 1;
+	for (uint32_t y = 0; y < Noise.GetHeight(); y++)
+	{
+		for (uint32_t x = 0; x < Noise.GetWidth(); x++)
+		{
+			Seed = Seed * 1103515245 + 12345;
+			Noise.PutPixel(x, y, Pixel_RGBA8(uint8_t(Seed >> 24), uint8_t(Seed >> 16), uint8_t(Seed >> 8), uint8_t(x + y)));
+			Gradient.PutPixel(x, y, Pixel_RGBA8(uint8_t(x), uint8_t(y), uint8_t((x + y) / 2), 255));
+		}
+	}
+
+	// 各指令集的定点内核结果应当完全相同
+	size_t ISAMismatches = 0;
+	size_t ColorChanges = 0;
+	int MaxFloatDiff = 0;
+	for (auto Size : { std::pair<uint32_t, uint32_t>(37, 23), std::pair<uint32_t, uint32_t>(413, 301), std::pair<uint32_t, uint32_t>(301, 61) })
+	{
+		auto Reference = Noise;
+		Reference.Resize(Size.first, Size.second, Filter, ResizeISA::Scalar);
+		for (auto ISA : { ResizeISA::SSE2, ResizeISA::AVX2, ResizeISA::Auto })
+		{
+			auto Resized = Noise;
+			Resized.Resize(Size.first, Size.second, Filter, ISA);
+			for (uint32_t y = 0; y < Size.second; y++)
+			{
+				if (memcmp(Resized.GetBitmapRowPtr(y), Reference.GetBitmapRowPtr(y), Resized.GetPitch())) ISAMismatches++;
+			}
+		}
+
+		// 定点与浮点的结果只差舍入误差
+		auto Fixed = Gradient;
+		Fixed.Resize(Size.first, Size.second, Filter);
+		auto Float = Image_RGBA32F(Gradient);
+		Float.Resize(Size.first, Size.second, Filter);
+		auto FloatAs8 = Image_RGBA8(Float);
+		for (uint32_t y = 0; y < Size.second; y++)
+		{
+			for (uint32_t x = 0; x < Size.first; x++)
+			{
+				auto a = Fixed.GetPixel(x, y), b = FloatAs8.GetPixel(x, y);
+				MaxFloatDiff = std::max({ MaxFloatDiff, std::abs(int(a.R) - b.R), std::abs(int(a.G) - b.G), std::abs(int(a.B) - b.B), std::abs(int(a.A) - b.A) });
+			}
+		}
+	}
+	ColorChanges += count_resize_color_changes(Filter, Pixel_RGBA8(200, 100, 50, 255));
+	ColorChanges += count_resize_color_changes(Filter, Pixel_RGBA16(50000, 1000, 30000, 65535));
+	ColorChanges += count_resize_color_changes(Filter, Pixel_RGBA32F(0.25f, 0.5f, 0.75f, 1.0f));
+	std::cout << "Resize(" << FilterName << "): " << ISAMismatches << " ISA mismatches, " << ColorChanges << " solid color changes, max 8-bit/float difference " << MaxFloatDiff << "\n";
+}
+
+void test_resize()
+{
+	test_resize(ResizeFilter::Box, "box");
+	test_resize(ResizeFilter::Triangle, "triangle");
+	test_resize(ResizeFilter::CatmullRom, "Catmull-Rom");
+	test_resize(ResizeFilter::Mitchell, "Mitchell");
+	test_resize(ResizeFilter::Lanczos3, "Lanczos3");
+}
+
+template<typename PixelType>
+size_t count_shrink_mismatches(uint32_t Width, uint32_t Height, uint32_t NewWidth, uint32_t NewHeight)
+{
+	using ChannelType = typename PixelType::ChannelType;
+	constexpr double Max = std::is_floating_point_v<ChannelType> ? 1.0 : double(std::numeric_limits<ChannelType>::max());
+	auto Source = Image<PixelType>(Width, Height, "shrink", false);
+	uint32_t Seed = 1;
+	for (uint32_t y = 0; y < Height; y++)
+	{
+		for (uint32_t x = 0; x < Width; x++)
+		{
+			ChannelType c[4];
+			for (auto& v : c)
+			{
+				Seed = Seed * 1103515245 + 12345;
+				v = ChannelType((Seed >> 8) % 65536 / 65535.0 * Max);
+			}
+			Source.PutPixel(x, y, PixelType(c[0], c[1], c[2], c[3]));
+		}
+	}
+
+	// 按显示方向逐块求平均作为参考，整数通道四舍五入，允许倒数乘法在恰好 .5 时差 1
+	size_t NumMismatches = 0;
+	for (int o = 1; o <= 8; o++)
+	{
+		auto Shrunk = Source;
+		Shrunk.SetOrientation(ExifOrientation(o));
+		auto Oriented = Shrunk;
+		uint32_t OrigWidth = Oriented.GetOrientedWidth(), OrigHeight = Oriented.GetOrientedHeight();
+		if (OrigWidth != Width) std::swap(NewWidth, NewHeight);
+		Shrunk.ShrinkResize(NewWidth, NewHeight);
+		for (uint32_t y = 0; y < NewHeight; y++)
+		{
+			for (uint32_t x = 0; x < NewWidth; x++)
+			{
+				double Sum[4] = {};
+				uint32_t x0 = uint32_t(uint64_t(x) * OrigWidth / NewWidth), x1 = uint32_t(uint64_t(x + 1) * OrigWidth / NewWidth);
+				uint32_t y0 = uint32_t(uint64_t(y) * OrigHeight / NewHeight), y1 = uint32_t(uint64_t(y + 1) * OrigHeight / NewHeight);
+				for (uint32_t sy = y0; sy < y1; sy++)
+				{
+					for (uint32_t sx = x0; sx < x1; sx++)
+					{
+						auto c = Oriented.GetOrientedPixel(sx, sy);
+						Sum[0] += c.R; Sum[1] += c.G; Sum[2] += c.B; Sum[3] += c.A;
+					}
+				}
+				auto p = Shrunk.GetPixel(x, y);
+				double Got[4] = { double(p.R), double(p.G), double(p.B), double(p.A) };
+				for (int c = 0; c < 4; c++)
+				{
+					double Expected = Sum[c] / (double(x1 - x0) * (y1 - y0));
+					if (std::is_floating_point_v<ChannelType> ? std::abs(Got[c] - Expected) > 1e-5 : std::abs(Got[c] - std::floor(Expected + 0.5)) > 1.0) NumMismatches++;
+				}
+			}
+		}
+		if (OrigWidth != Width) std::swap(NewWidth, NewHeight);
+	}
+	return NumMismatches;
+}
+
+void test_shrinkresize()
+{
+	size_t NumMismatches = 0;
+	for (auto Size : { std::array<uint32_t, 4>{ 37, 23, 11, 7 }, std::array<uint32_t, 4>{ 37, 23, 36, 1 }, std::array<uint32_t, 4>{ 64, 48, 32, 24 },
+		std::array<uint32_t, 4>{ 64, 48, 16, 12 }, std::array<uint32_t, 4>{ 64, 48, 8, 6 }, std::array<uint32_t, 4>{ 64, 48, 32, 6 }, std::array<uint32_t, 4>{ 64, 48, 64, 12 } })
+	{
+		NumMismatches += count_shrink_mismatches<Pixel_RGBA8>(Size[0], Size[1], Size[2], Size[3]);
+		NumMismatches += count_shrink_mismatches<Pixel_RGBA16>(Size[0], Size[1], Size[2], Size[3]);
+		NumMismatches += count_shrink_mismatches<Pixel_RGBA32F>(Size[0], Size[1], Size[2], Size[3]);
+	}
+	std::cout << "ShrinkResize: " << NumMismatches << " mismatches against the area average\n";
+}
+
+void test_mipchain()
+{
+	// 每一级应当与对上一级做 ShrinkResize() 的结果相同，允许倒数乘法在恰好 .5 时差 1
+	size_t NumMismatches = 0;
+	for (auto Size : { std::pair<uint32_t, uint32_t>(64, 32), std::pair<uint32_t, uint32_t>(37, 23), std::pair<uint32_t, uint32_t>(1, 5) })
+	{
+		auto Source = Image_RGBA8(Size.first, Size.second, "mip", false);
+		uint32_t Seed = 1;
+		for (uint32_t y = 0; y < Source.GetHeight(); y++)
+		{
+			for (uint32_t x = 0; x < Source.GetWidth(); x++)
+			{
+				Seed = Seed * 1103515245 + 12345;
+				Source.PutPixel(x, y, Pixel_RGBA8(uint8_t(Seed >> 24), uint8_t(Seed >> 16), uint8_t(Seed >> 8), uint8_t(x + y)));
+			}
+		}
+
+		auto Chain = Source.BuildMipChain();
+		auto Last = Chain.GetLevel(Chain.GetNumLevels() - 1);
+		if (Last.Width != 1 || Last.Height != 1 || (Last.Offset + 1) * sizeof(Pixel_RGBA8) != Chain.GetSizeInTotal()) NumMismatches++;
+
+		// 复制出来的 mipmap 与原来的内容相同，但不共用内存
+		auto Copy = Chain;
+		if (Copy.GetDataPtr() == Chain.GetDataPtr() || Copy.GetNumLevels() != Chain.GetNumLevels() || memcmp(Copy.GetDataPtr(), Chain.GetDataPtr(), Chain.GetSizeInTotal())) NumMismatches++;
+		for (size_t i = 1; i < Chain.GetNumLevels(); i++)
+		{
+			auto Expected = Chain.GetLevelImage(i - 1);
+			Expected.ShrinkResize(Chain.GetWidth(i), Chain.GetHeight(i));
+			if (Expected.GetWidth() != std::max(Chain.GetWidth(i - 1) / 2, 1u) || Expected.GetHeight() != std::max(Chain.GetHeight(i - 1) / 2, 1u)) NumMismatches++;
+			for (uint32_t y = 0; y < Chain.GetHeight(i); y++)
+			{
+				for (uint32_t x = 0; x < Chain.GetWidth(i); x++)
+				{
+					auto a = Chain.GetPixel(i, x, y), b = Expected.GetPixel(x, y);
+					if (std::max({ std::abs(a.R - b.R), std::abs(a.G - b.G), std::abs(a.B - b.B), std::abs(a.A - b.A) }) > 1) NumMismatches++;
+				}
+			}
+		}
+	}
+
+	// 黑白相间的图像按 sRGB 平均是线性亮度 0.5，编码后是 188，直接平均是 128
+	auto Checker = Image_RGBA8(4, 4, "checker", false);
+	for (uint32_t y = 0; y < 4; y++)
+	{
+		for (uint32_t x = 0; x < 4; x++) Checker.PutPixel(x, y, (x + y) & 1 ? Pixel_RGBA8(255, 255, 255, 255) : Pixel_RGBA8(0, 0, 0, 0));
+	}
+	auto Linear = Checker.BuildMipChain(MipColorSpace::Linear).GetPixel(1, 0, 0);
+	auto SRGB = Checker.BuildMipChain(MipColorSpace::SRGB).GetPixel(1, 0, 0);
+	if (Linear != Pixel_RGBA8(128, 128, 128, 128) || SRGB != Pixel_RGBA8(188, 188, 188, 128)) NumMismatches++;
+	std::cout << "MipChain: " << NumMismatches << " mismatches\n";
+}
+
+void test_adoptstbi()
+{
+	// stb_image 解码出来的缓冲区应直接成为位图数据，不再另外分配一整张图并逐行复制
+	auto Source = Image_RGBA8(640, 480, "source", false);
+	for (uint32_t y = 0; y < Source.GetHeight(); y++)
+	{
+		auto Row = Source.GetBitmapRowPtr(y);
+		for (uint32_t x = 0; x < Source.GetWidth(); x++) Row[x] = Pixel_RGBA8(uint8_t(x), uint8_t(y), uint8_t(x ^ y), uint8_t(255 - x));
+	}
+	auto Png = Source.SaveToPNG();
+
+	LargeAllocThreshold = size_t(Source.GetWidth()) * Source.GetHeight() * sizeof(Pixel_RGBA8);
+	NumLargeAllocs = 0;
+	auto Loaded = Image_RGBA8(Png.data(), Png.size(), "loaded", false);
+	size_t LoadAllocs = NumLargeAllocs;
+	LargeAllocThreshold = 0;
+
+	size_t Mismatches = 0;
+	auto Wide = Image_RGBA32(Png.data(), Png.size(), "wide", false);
+	for (uint32_t y = 0; y < Source.GetHeight(); y++)
+	{
+		for (uint32_t x = 0; x < Source.GetWidth(); x++)
+		{
+			auto& s = Source.GetBitmapRowPtr(y)[x];
+			auto& l = Loaded.GetBitmapRowPtr(y)[x];
+			auto w = Pixel_RGBA8(Wide.GetBitmapRowPtr(y)[x]);
+			if (s.R != l.R || s.G != l.G || s.B != l.B || s.A != l.A) Mismatches++;
+			if (s.R != w.R || s.G != w.G || s.B != w.B || s.A != w.A) Mismatches++;
+		}
+	}
+
+	// 接管用 malloc() 分配的像素
+	auto Pixels = static_cast<Pixel_RGBA8*>(std::malloc(16 * 16 * sizeof(Pixel_RGBA8)));
+	for (int i = 0; i < 16 * 16; i++) Pixels[i] = Pixel_RGBA8(uint8_t(i), 0, 0, 255);
+	auto Adopted = Image_RGBA8(16, 16, Pixels, std::free, "adopted", false);
+	bool Valid = Adopted.GetBitmapDataPtr() == Pixels && Adopted.GetBitmapRowPtr(15)[15].R == 255;
+
+	// 接管的内存只保证按像素类型对齐
+	auto Buffer = PixelBuffer<Pixel_RGBA8>(Pixels, 16 * 16, [](void*) {});
+	Valid = Valid && Buffer.alignment() == alignof(Pixel_RGBA8) && !Buffer.resource();
+
+	std::cout << "AdoptSTBI: " << LoadAllocs << " pixel buffers allocated while loading, " << Mismatches << " mismatches"
+		<< (LoadAllocs == 0 && Mismatches == 0 && Valid ? "" : " (unexpected)") << "\n";
+}
+
+template<typename PixelType>
+size_t count_row_mismatches(const Image<PixelType>& a, const Image<PixelType>& b)
+{
+	if (a.GetWidth() != b.GetWidth() || a.GetHeight() != b.GetHeight()) return size_t(-1);
+	size_t ret = 0;
+	for (uint32_t y = 0; y < a.GetHeight(); y++)
+	{
+		if (memcmp(a.GetBitmapRowPtr(y), b.GetBitmapRowPtr(y), a.GetWidth() * sizeof(PixelType))) ret++;
+	}
+	return ret;
+}
+
+template<typename PixelType>
+size_t count_policy_mismatches(uint32_t Width, uint32_t Height, const BufferPolicy& Policy)
+{
+	// 同样的操作分别作用在紧密排列和按 Policy 排列的图像上，结果应该逐行相同
+	auto Packed = Image<PixelType>(Width, Height, "packed", false);
+	for (uint32_t y = 0; y < Height; y++)
+	{
+		auto Row = Packed.GetBitmapRowPtr(y);
+		for (uint32_t x = 0; x < Width; x++) Row[x] = Pixel_RGBA8(uint8_t(x * 7), uint8_t(y * 5), uint8_t(x ^ y), uint8_t(x + y));
+	}
+	auto Padded = Packed;
+	Padded.SetBufferPolicy(Policy);
+
+	size_t Mismatches = count_row_mismatches(Packed, Padded);
+	auto Check = [&](auto&& Op)
+	{
+		auto a = Packed, b = Padded;
+		Op(a);
+		Op(b);
+		Mismatches += count_row_mismatches(a, b);
+		for (uint32_t y = 0; y < b.GetHeight(); y++)
+		{
+			if (Policy.RowAlignment && reinterpret_cast<uintptr_t>(b.GetBitmapRowPtr(y)) % Policy.RowAlignment) Mismatches++;
+		}
+		if (b.GetPitch() < (b.GetWidth() + Policy.RowPadding) * sizeof(PixelType)) Mismatches++;
+	};
+	Check([](Image<PixelType>&) {});
+	Check([](Image<PixelType>& i) { i.Rotate90_CW(); });
+	Check([](Image<PixelType>& i) { i.Rotate90_CW_InPlace(); });
+	Check([](Image<PixelType>& i) { i.FlipV_RowPtrs(); i.Rotate270_CW_InPlace(); });
+	Check([&](Image<PixelType>& i) { i.ResizeNearest(Width * 2 + 1, Height / 2 + 1); });
+	Check([&](Image<PixelType>& i) { i.ShrinkResize(Width / 2, Height / 3); });
+	Check([&](Image<PixelType>& i) { i.Resize(Width * 3 / 2, Height * 2 / 3); });
+	Check([&](Image<PixelType>& i) { i.SetOrientation(ExifOrientation::Rotate90_CW); i.ApplyOrientation(); });
+	Check([&](Image<PixelType>& i)
+	{
+		auto Level = i.BuildMipChain().GetLevelImage(1);
+		Level.SetBufferPolicy(i.GetBufferPolicy());
+		i = Level;
+	});
+	if (Packed.SaveToPNG() != Padded.SaveToPNG()) Mismatches++;
+	if (Packed.SaveToTGA() != Padded.SaveToTGA()) Mismatches++;
+	return Mismatches;
+}
+
+void test_bufferpolicy()
+{
+	size_t Mismatches = 0;
+	for (auto Policy : { BufferPolicy{ 64, 0 }, BufferPolicy{ 64, 5 }, BufferPolicy{ 0, 3 }, BufferPolicy{ 4096, 0 } })
+	{
+		Mismatches += count_policy_mismatches<Pixel_RGBA8>(67, 45, Policy);
+		Mismatches += count_policy_mismatches<Pixel_RGBA8>(64, 64, Policy);
+		Mismatches += count_policy_mismatches<Pixel_RGBA16>(45, 67, Policy);
+		Mismatches += count_policy_mismatches<Pixel_RGBA32F>(33, 20, Policy);
+	}
+	auto Padded = Image_RGBA8(67, 3, BufferPolicy{ 64, 0 }, "padded", false);
+	bool PitchValid = Padded.GetPitch() == 320;
+
+	// 内存池：释放的缓冲区应被下一张同样大小的图像取用
+	auto Pool = PixelBufferPool();
+	const void* First = nullptr;
+	{
+		auto a = Image_RGBA8(640, 480, BufferPolicy{ 64, 0, &Pool }, "pooled", false);
+		First = a.GetBitmapDataPtr();
+	}
+	auto b = Image_RGBA8(640, 480, BufferPolicy{ 64, 0, &Pool }, "pooled", false);
+	b.Rotate90_CW();
+	auto c = Image_RGBA8(640, 480, BufferPolicy{ 64, 0, &Pool }, "pooled", false);
+	bool PoolReused = b.GetBitmapDataPtr() != nullptr && c.GetBitmapDataPtr() != nullptr && First != nullptr;
+	PoolReused = PoolReused && (b.GetBitmapDataPtr() == First || c.GetBitmapDataPtr() == First);
+
+	// 大页：大块缓冲区按 2MB 对齐
+	auto Huge = HugePageResource();
+	auto h = Image_RGBA8(2048, 2048, BufferPolicy{ 64, 0, &Huge }, "huge", false);
+	h.Rotate90_CW();
+	bool HugeAligned = reinterpret_cast<uintptr_t>(h.GetBitmapDataPtr()) % HugePageResource::HugePageSize == 0;
+
+	std::cout << "BufferPolicy: " << Mismatches << " mismatches, pitch " << Padded.GetPitch() << ", pool reused: " << PoolReused << ", huge pages aligned: " << HugeAligned
+		<< (Mismatches == 0 && PitchValid && PoolReused && HugeAligned ? "" : " (unexpected)") << "\n";
+}
+
+Image_RGBA8 crop_by_paint(const Image_RGBA8& Src, int x, int y, int w, int h)
+{
+	auto ret = Image_RGBA8(w, h, "crop", false);
+	ret.Paint(0, 0, w, h, Src, x, y);
+	return ret;
+}
+
+void test_imageview()
+{
+	auto Source = Image_RGBA8(101, 77, "source", false);
+	for (uint32_t y = 0; y < Source.GetHeight(); y++)
+	{
+		auto Row = Source.GetBitmapRowPtr(y);
+		for (uint32_t x = 0; x < Source.GetWidth(); x++) Row[x] = Pixel_RGBA8(uint8_t(x * 7), uint8_t(y * 5), uint8_t(x ^ y), uint8_t(x + y));
+	}
+	const int cx = 13, cy = 9, cw = 61, ch = 47;
+	auto Reference = crop_by_paint(Source, cx, cy, cw, ch);
+	auto View = Source.GetView(cx, cy, cw, ch);
+
+	size_t Mismatches = count_row_mismatches(Image_RGBA8(View, "crop", false), Reference);
+
+	// 从视图直接编码 PNG 不应复制整幅像素
+	LargeAllocThreshold = size_t(Source.GetWidth()) * sizeof(Pixel_RGBA8) * 8;
+	NumLargeAllocs = 0;
+	auto Png = View.SaveToPNG();
+	size_t EncodeAllocs = NumLargeAllocs;
+	LargeAllocThreshold = 0;
+	if (Png != Reference.SaveToPNG()) Mismatches++;
+	if (View.SaveToTGA() != Reference.SaveToTGA()) Mismatches++;
+
+	// 对视图的操作应与先裁剪再操作的结果相同
+	auto Check = [&](auto&& ViewOp, auto&& CropOp)
+	{
+		auto a = Image_RGBA8(1, 1, "a", false), b = Reference;
+		ViewOp(a);
+		CropOp(b);
+		Mismatches += count_row_mismatches(a, b);
+	};
+	Check([&](Image_RGBA8& i) { i.Resize(View, 90, 30); }, [](Image_RGBA8& i) { i.Resize(90, 30); });
+	Check([&](Image_RGBA8& i) { i.ShrinkResize(View, 20, 15); }, [](Image_RGBA8& i) { i.ShrinkResize(20, 15); });
+	Check([&](Image_RGBA8& i) { i.Rotate90_CW(View); }, [](Image_RGBA8& i) { i.Rotate90_CW(); });
+	Check([&](Image_RGBA8& i) { i.Rotate270_CW(View); }, [](Image_RGBA8& i) { i.Rotate270_CW(); });
+
+	// 以自己的视图为源
+	auto Self = Source;
+	Self.Resize(Self.GetView(cx, cy, cw, ch), 30, 20);
+	auto Expected = Reference;
+	Expected.Resize(30, 20);
+	Mismatches += count_row_mismatches(Self, Expected);
+
+	// 行指针倒序的图像得到负行距的视图
+	auto Flipped = Source;
+	Flipped.FlipV_RowPtrs();
+	auto FlippedView = std::as_const(Flipped).GetView();
+	bool NegativeStride = FlippedView.GetStride() < 0;
+	auto FlippedCrop = Image_RGBA8(FlippedView.SubView(cx, cy, cw, ch), "crop", false);
+	Mismatches += count_row_mismatches(FlippedCrop, crop_by_paint(Flipped, cx, cy, cw, ch));
+
+	// 按块并行填充，每块一个子视图
+	auto Tiled = Image_RGBA8(101, 77, "tiled", false);
+	const int TileSize = 16;
+	const int TilesX = (Tiled.GetWidth() + TileSize - 1) / TileSize;
+	const int TilesY = (Tiled.GetHeight() + TileSize - 1) / TileSize;
+	auto Whole = Tiled.GetView();
+#pragma omp parallel for
+	for (int t = 0; t < TilesX * TilesY; t++)
+	{
+		uint32_t x = (t % TilesX) * TileSize, y = (t / TilesX) * TileSize;
+		Whole.SubView(x, y, std::min(uint32_t(TileSize), Tiled.GetWidth() - x), std::min(uint32_t(TileSize), Tiled.GetHeight() - y)).Fill(Pixel_RGBA8(uint8_t(t), 0, 0, 255));
+	}
+	for (uint32_t y = 0; y < Tiled.GetHeight(); y++)
+	{
+		for (uint32_t x = 0; x < Tiled.GetWidth(); x++)
+		{
+			if (Tiled.GetBitmapRowPtr(y)[x].R != uint8_t((y / TileSize) * TilesX + x / TileSize)) Mismatches++;
+		}
+	}
+
+	bool OutOfRange = false;
+	try
+	{
+		Source.GetView(90, 0, 20, 10);
+	}
+	catch (const std::out_of_range&)
+	{
+		OutOfRange = true;
+	}
+
+	std::cout << "ImageView: " << Mismatches << " mismatches, " << EncodeAllocs << " pixel buffers allocated while encoding, negative stride: " << NegativeStride
+		<< (Mismatches == 0 && EncodeAllocs == 0 && NegativeStride && OutOfRange ? "" : " (unexpected)") << "\n";
+}
+
+
+void test_streamencodegif(const std::string& gif_file, const std::string& out_file)
+{
+	auto options = SaveGIFOptions();
+
+	auto Stream = GIFStreamDecoder(gif_file, false);
+	auto Encoder = GIFEncoder(out_file, Stream.GetWidth(), Stream.GetHeight(), options);
+	for (auto& Frame : Stream)
+	{
+		Encoder.PushFrame(Frame);
+	}
+	Encoder.Finalize();
+
+	auto Reloaded = GIFLoader(out_file, false).ConvertToImageAnim();
+	std::cout << out_file << ": encoded " << Encoder.GetNumFrames() << " frames, reloaded " << Reloaded.Frames.size() << " frames\n";
+}
+
+void test_streamencodegif()
+{
+	test_streamencodegif("Rotating_earth_(large).gif", "testout_stream.gif");
+}
+
+void bench_compresslzw()
+{
+	// 模拟 1080p 的索引帧：大片重复的颜色里夹杂着噪点
+	auto Indices = DataSubBlock(size_t(1920) * 1080);
+	uint32_t Seed = 1;
+	for (size_t i = 0; i < Indices.size(); i++)
+	{
+		Seed = Seed * 1103515245 + 12345;
+		Indices[i] = (Seed >> 28) ? uint8_t((i / 64) & 0xFF) : uint8_t(Seed >> 16);
+	}
+
+	constexpr int Rounds = 10;
+	size_t CompressedSize = 0;
+	auto StartTime = std::chrono::steady_clock::now();
+	for (int i = 0; i < Rounds; i++)
+	{
+		CompressedSize = ImageDescriptorType::CompressLZW(Indices, 8).size();
+	}
+	auto Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - StartTime).count();
+	std::cout << "CompressLZW: " << (double(Indices.size()) * Rounds / 1048576.0 / Seconds) << " MB/s (" << Indices.size() << " -> " << CompressedSize << " bytes)\n";
+}
+
+void bench_palettegen(const std::string& gif_file)
+{
+	auto Anim = GIFLoader(gif_file, false).ConvertToImageAnim();
+	double NumPixels = 0;
+	for (auto& Frame : Anim.Frames) NumPixels += double(Frame.GetWidth()) * Frame.GetHeight();
+
+	constexpr int Rounds = 5;
+	auto StartTime = std::chrono::steady_clock::now();
+	for (int i = 0; i < Rounds; i++)
+	{
+		for (auto& Frame : Anim.Frames)
+		{
+			auto PalGen = PaletteGenerator(256);
+			for (uint32_t y = 0; y < Frame.GetHeight(); y++)
+			{
+				auto Row = Frame.GetBitmapRowPtr(y);
+				for (uint32_t x = 0; x < Frame.GetWidth(); x++) PalGen.AddPixel(Row[x].R, Row[x].G, Row[x].B);
+			}
+			PalGen.GetColors();
+		}
+	}
+	auto Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - StartTime).count();
+	std::cout << "PaletteGenerator::AddPixel(" << gif_file << "): " << (NumPixels * Rounds / 1000000.0 / Seconds) << " Mpixels/s\n";
+
+	bool PaletteIsExact = false;
+	StartTime = std::chrono::steady_clock::now();
+	for (int i = 0; i < Rounds; i++)
+	{
+		for (auto& Frame : Anim.Frames)
+		{
+			PaletteGenerator::GetColors(Frame, 256, PaletteIsExact);
+		}
+	}
+	Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - StartTime).count();
+	std::cout << "PaletteGenerator::GetColors(" << gif_file << "): " << (NumPixels * Rounds / 1000000.0 / Seconds) << " Mpixels/s\n";
+}
+
+void bench_palettegen()
+{
+	bench_palettegen("Rotating_earth_(large).gif");
+	bench_palettegen("testre.gif");
+}
+
+void bench_rotate()
+{
+	// 2400 万像素的竖拍照片
+	auto Photo = Image_RGBA8(6000, 4000, Pixel_RGBA8(0x80, 0x40, 0x20, 0xFF), "photo", false);
+
+	constexpr int Rounds = 4;
+	auto StartTime = std::chrono::steady_clock::now();
+	for (int i = 0; i < Rounds; i++) Photo.Rotate90_CW();
+	auto Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - StartTime).count();
+	std::cout << "Rotate90_CW(6000x4000): " << (Seconds * 1000.0 / Rounds) << " ms per rotation\n";
+
+	StartTime = std::chrono::steady_clock::now();
+	for (int i = 0; i < Rounds; i++) Photo.Rotate270_CW();
+	Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - StartTime).count();
+	std::cout << "Rotate270_CW(6000x4000): " << (Seconds * 1000.0 / Rounds) << " ms per rotation\n";
+
+	StartTime = std::chrono::steady_clock::now();
+	Photo.Rotate90_CW_InPlace();
+	Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - StartTime).count();
+	std::cout << "Rotate90_CW_InPlace(6000x4000): " << (Seconds * 1000.0) << " ms per rotation\n";
+
+	// 竖拍照片缩成预览图：先旋转再缩放，与把旋转合并进缩放
+	StartTime = std::chrono::steady_clock::now();
+	for (int i = 0; i < Rounds; i++)
+	{
+		auto Preview = Photo;
+		Preview.SetOrientation(ExifOrientation::Rotate90_CW);
+		Preview.ApplyOrientation();
+		Preview.ResizeNearest(1000, 1500);
+	}
+	Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - StartTime).count();
+	std::cout << "Rotate90_CW + ResizeNearest(6000x4000 -> 1000x1500): " << (Seconds * 1000.0 / Rounds) << " ms\n";
+
+	StartTime = std::chrono::steady_clock::now();
+	for (int i = 0; i < Rounds; i++)
+	{
+		auto Preview = Photo;
+		Preview.SetOrientation(ExifOrientation::Rotate90_CW);
+		Preview.ResizeNearest(1000, 1500);
+	}
+	Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - StartTime).count();
+	std::cout << "Deferred Rotate90_CW, ResizeNearest(6000x4000 -> 1000x1500): " << (Seconds * 1000.0 / Rounds) << " ms\n";
+
+	auto Square = Image_RGBA8(4096, 4096, Pixel_RGBA8(0x80, 0x40, 0x20, 0xFF), "square", false);
+	StartTime = std::chrono::steady_clock::now();
+	for (int i = 0; i < Rounds; i++) Square.Rotate90_CW_InPlace();
+	Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - StartTime).count();
+	std::cout << "Rotate90_CW_InPlace(4096x4096): " << (Seconds * 1000.0 / Rounds) << " ms per rotation\n";
+}
+
+void bench_resize()
+{
+	// 2400 万像素的照片生成缩略图
+	auto Photo = Image_RGBA8(6000, 4000, "photo", false);
+	for (uint32_t y = 0; y < Photo.GetHeight(); y++)
+	{
+		auto Row = Photo.GetBitmapRowPtr(y);
+		for (uint32_t x = 0; x < Photo.GetWidth(); x++) Row[x] = Pixel_RGBA8(uint8_t(x), uint8_t(y), uint8_t(x ^ y), 255);
+	}
+
+	auto StartTime = std::chrono::steady_clock::now();
+	auto Thumbnail = Photo;
+	Thumbnail.ShrinkResize(400, 267);
+	auto Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - StartTime).count();
+	std::cout << "ShrinkResize(6000x4000 -> 400x267): " << (Seconds * 1000.0) << " ms\n";
+
+	// 整数倍缩小走快速路径，与只差一个像素、走通用路径的尺寸对比。复制原图不计入时间，取 4 次中最快的一次
+	for (uint32_t Factor : { 2, 4, 8 })
+	{
+		uint32_t ExactWidth = Photo.GetWidth() / Factor, ExactHeight = Photo.GetHeight() / Factor;
+		double Best[2] = { 1e9, 1e9 };
+		for (int i = 0; i < 4; i++)
+		{
+			for (int j = 0; j < 2; j++)
+			{
+				Thumbnail = Photo;
+				StartTime = std::chrono::steady_clock::now();
+				Thumbnail.ShrinkResize(ExactWidth - j, ExactHeight - j);
+				Best[j] = std::min(Best[j], std::chrono::duration<double>(std::chrono::steady_clock::now() - StartTime).count());
+			}
+		}
+		std::cout << "ShrinkResize(6000x4000 -> " << ExactWidth << "x" << ExactHeight << "): " << (Best[0] * 1000.0) << " ms, "
+			<< "-> " << (ExactWidth - 1) << "x" << (ExactHeight - 1) << ": " << (Best[1] * 1000.0) << " ms\n";
+	}
+
+	for (auto ISA : { ResizeISA::Scalar, ResizeISA::SSE2, ResizeISA::AVX2 })
+	{
+		StartTime = std::chrono::steady_clock::now();
+		Thumbnail = Photo;
+		Thumbnail.Resize(400, 267, ResizeFilter::Lanczos3, ISA);
+		Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - StartTime).count();
+		std::cout << "Resize(6000x4000 -> 400x267, Lanczos3, ISA " << int(ISA) << "): " << (Seconds * 1000.0) << " ms\n";
+	}
+}
+
+void bench_mipchain()
+{
+	auto Texture = Image_RGBA8(4096, 4096, "texture", false);
+	for (uint32_t y = 0; y < Texture.GetHeight(); y++)
+	{
+		auto Row = Texture.GetBitmapRowPtr(y);
+		for (uint32_t x = 0; x < Texture.GetWidth(); x++) Row[x] = Pixel_RGBA8(uint8_t(x), uint8_t(y), uint8_t(x ^ y), 255);
+	}
+
+	// 以前的做法：每一级都从原图缩小
+	auto StartTime = std::chrono::steady_clock::now();
+	for (uint32_t Size = 2048; Size >= 1; Size /= 2)
+	{
+		auto Level = Texture;
+		Level.ShrinkResize(Size, Size);
+	}
+	auto Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - StartTime).count();
+	std::cout << "ShrinkResize per mip level(4096x4096): " << (Seconds * 1000.0) << " ms\n";
+
+	for (auto ColorSpace : { MipColorSpace::Linear, MipColorSpace::SRGB })
+	{
+		StartTime = std::chrono::steady_clock::now();
+		auto Chain = Texture.BuildMipChain(ColorSpace);
+		Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - StartTime).count();
+		std::cout << "BuildMipChain(4096x4096" << (ColorSpace == MipColorSpace::SRGB ? ", sRGB" : "") << "): " << (Seconds * 1000.0) << " ms\n";
+	}
+}
+
+void bench_loadjpg()
+{
+	auto Source = Image_RGBA8(3000, 2000, "source", false);
+	for (uint32_t y = 0; y < Source.GetHeight(); y++)
+	{
+		auto Row = Source.GetBitmapRowPtr(y);
+		for (uint32_t x = 0; x < Source.GetWidth(); x++) Row[x] = Pixel_RGBA8(uint8_t(x / 8), uint8_t(y / 8), uint8_t((x ^ y) / 8), 255);
+	}
+	auto Jpg = Source.SaveToJPG(90);
+
+	constexpr int Rounds = 10;
+	auto StartTime = std::chrono::steady_clock::now();
+	for (int i = 0; i < Rounds; i++)
+	{
+		auto Loaded = Image_RGBA8(Jpg.data(), Jpg.size(), "loaded", false);
+	}
+	auto Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - StartTime).count();
+	std::cout << "Load JPG from memory(3000x2000): " << (Seconds * 1000.0 / Rounds) << " ms per load\n";
+}
+
+void bench_bufferpolicy()
+{
+	// 反复旋转大图，每次都要新分配一整张图：比较每次向系统申请内存、从池里取用和使用大页
+	auto Pool = PixelBufferPool(size_t(1) << 30);
+	auto Huge = HugePageResource();
+	auto HugePool = PixelBufferPool(size_t(1) << 30, &Huge);
+	const std::pair<const char*, BufferPolicy> Policies[] =
+	{
+		{ "default", BufferPolicy{} },
+		{ "64-byte rows", BufferPolicy{ 64, 0 } },
+		{ "pool", BufferPolicy{ 64, 0, &Pool } },
+		{ "huge pages", BufferPolicy{ 64, 0, &Huge } },
+		{ "pool + huge pages", BufferPolicy{ 64, 0, &HugePool } },
+	};
+	for (auto& [Name, Policy] : Policies)
+	{
+		constexpr int Rounds = 6;
+		auto Work = Image_RGBA8(6000, 4000, Policy, "work", false);
+		auto StartTime = std::chrono::steady_clock::now();
+		for (int i = 0; i < Rounds; i++)
+		{
+			Work.Rotate90_CW();
+		}
+		auto Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - StartTime).count();
+		std::cout << "Rotate90_CW(6000x4000, " << Name << "): " << (Seconds * 1000.0 / Rounds) << " ms per rotation\n";
+	}
+}
+
+void bench_thumbnail()
+{
+	// 从大图中裁出一块生成缩略图：先复制出裁剪图再缩小，对比直接从视图缩小
+	auto Source = Image_RGBA8(6000, 4000, "source", false);
+	for (uint32_t y = 0; y < Source.GetHeight(); y++)
+	{
+		auto Row = Source.GetBitmapRowPtr(y);
+		for (uint32_t x = 0; x < Source.GetWidth(); x++) Row[x] = Pixel_RGBA8(uint8_t(x / 8), uint8_t(y / 8), uint8_t((x ^ y) / 8), 255);
+	}
+	constexpr int Rounds = 10;
+	const int cx = 1000, cy = 800, cw = 4000, ch = 3000;
+
+	auto StartTime = std::chrono::steady_clock::now();
+	for (int i = 0; i < Rounds; i++)
+	{
+		auto Thumb = crop_by_paint(Source, cx, cy, cw, ch);
+		Thumb.ShrinkResize(400, 300);
+		Thumb.SaveToJPG(90);
+	}
+	auto CopySeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - StartTime).count();
+
+	StartTime = std::chrono::steady_clock::now();
+	for (int i = 0; i < Rounds; i++)
+	{
+		auto Thumb = Image_RGBA8(1, 1, "thumb", false);
+		Thumb.ShrinkResize(Source.GetView(cx, cy, cw, ch), 400, 300);
+		Thumb.SaveToJPG(90);
+	}
+	auto ViewSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - StartTime).count();
+
+	std::cout << "Crop(4000x3000) + ShrinkResize(400x300) + SaveToJPG: copy " << (CopySeconds * 1000.0 / Rounds) << " ms, view " << (ViewSeconds * 1000.0 / Rounds) << " ms\n";
+}
+
+void bench_loadgif(const std::string& gif_file, DecodeMode Mode)
+{
+	constexpr int Rounds = 20;
+	auto StartTime = std::chrono::steady_clock::now();
+	for (int i = 0; i < Rounds; i++)
+	{
+		auto Gif = GIFLoader(gif_file, false, Mode);
+	}
+	auto Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - StartTime).count();
+	std::cout << "GIFLoader(" << gif_file << (Mode == DecodeMode::Lazy ? ", lazy" : "") << "): " << (Seconds * 1000.0 / Rounds) << " ms per load\n";
+}
+
+void bench_loadgif()
+{
+	bench_loadgif("Rotating_earth_(large).gif", DecodeMode::Eager);
+	bench_loadgif("testre.gif", DecodeMode::Eager);
+	bench_loadgif("Rotating_earth_(large).gif", DecodeMode::Lazy);
+	bench_loadgif("testre.gif", DecodeMode::Lazy);
+}
+
 int main(int argc, char** argv)
 {
 	test_savegif();
+	test_savegifquantizer();
+	test_ditherthreads("Rotating_earth_(large).gif");
+	test_framesinflight("testre.gif", false);
+	test_framesinflight("testre.gif", true);
+	test_nearestcolor();
+	test_colorhistogram("Rotating_earth_(large).gif");
+	test_colorhistogram("testre.gif");
+	test_quantizer("Rotating_earth_(large).gif", 16);
+	test_quantizer("testre.gif", 64);
+	test_rotate();
+	test_orientation();
+	test_resize();
+	test_shrinkresize();
+	test_mipchain();
+	test_lazyloadgif();
+	test_framecopies("Rotating_earth_(large).gif");
+	test_framecopies("testre.gif");
+	test_adoptstbi();
+	test_bufferpolicy();
+	test_imageview();
+	test_streamgif();
+	test_streamencodegif();
+	bench_compresslzw();
+	bench_palettegen();
+	bench_rotate();
+	bench_resize();
+	bench_mipchain();
+	bench_loadjpg();
+	bench_bufferpolicy();
+	bench_thumbnail();
+	bench_loadgif();
 	return 0;
 }
 
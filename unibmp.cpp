@@ -8,6 +8,29 @@
 #include <cstring>
 #include <algorithm>
 #include <cmath>
+#include <utility>
+#include <bit>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define UNIBMP_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#else
+#define UNIBMP_X86 0
+#endif
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+// GCC 与 Clang 需要给使用 AVX2 等指令的函数单独指定指令集，MSVC 不需要
+#if defined(__GNUC__) || defined(__clang__)
+#define UNIBMP_TARGET(isa) __attribute__((target(isa)))
+#else
+#define UNIBMP_TARGET(isa)
+#endif
 
 #ifndef PROFILE_MultithreadingImageRastering
 #define PROFILE_MultithreadingImageRastering 1
@@ -426,6 +449,268 @@ namespace UniformBitmap
 	template class PixelRef<Pixel_RGBA32>;
 	template class PixelRef<Pixel_RGBA32F>;
 
+	PixelBufferPool::PixelBufferPool(size_t MaxCachedBytes, std::pmr::memory_resource* Upstream) :
+		Upstream(Upstream),
+		MaxCachedBytes(MaxCachedBytes)
+	{
+	}
+
+	PixelBufferPool::~PixelBufferPool()
+	{
+		Release();
+	}
+
+	void* PixelBufferPool::do_allocate(size_t Bytes, size_t Alignment)
+	{
+		{
+			auto Lock = std::lock_guard(Mutex);
+			auto it = FreeBlocks.find({ Bytes, Alignment });
+			if (it != FreeBlocks.end() && !it->second.empty())
+			{
+				auto p = it->second.back();
+				it->second.pop_back();
+				CachedBytes -= Bytes;
+				return p;
+			}
+		}
+		return Upstream->allocate(Bytes, Alignment);
+	}
+
+	void PixelBufferPool::do_deallocate(void* p, size_t Bytes, size_t Alignment)
+	{
+		{
+			auto Lock = std::lock_guard(Mutex);
+			if (CachedBytes + Bytes <= MaxCachedBytes)
+			{
+				try
+				{
+					FreeBlocks[{ Bytes, Alignment }].push_back(p);
+					CachedBytes += Bytes;
+					return;
+				}
+				catch (const std::bad_alloc&)
+				{
+					// 记不下来就直接还回去
+				}
+			}
+		}
+		Upstream->deallocate(p, Bytes, Alignment);
+	}
+
+	bool PixelBufferPool::do_is_equal(const std::pmr::memory_resource& other) const noexcept
+	{
+		return this == &other;
+	}
+
+	void PixelBufferPool::Release()
+	{
+		auto Lock = std::lock_guard(Mutex);
+		for (auto& [Key, Blocks] : FreeBlocks)
+		{
+			for (auto p : Blocks) Upstream->deallocate(p, Key.first, Key.second);
+		}
+		FreeBlocks.clear();
+		CachedBytes = 0;
+	}
+
+	size_t PixelBufferPool::GetCachedBytes() const
+	{
+		auto Lock = std::lock_guard(Mutex);
+		return CachedBytes;
+	}
+
+	HugePageResource::HugePageResource(size_t MinSize, std::pmr::memory_resource* Upstream) :
+		MinSize(MinSize),
+		Upstream(Upstream)
+	{
+	}
+
+	void* HugePageResource::do_allocate(size_t Bytes, size_t Alignment)
+	{
+		if (Bytes < MinSize) return Upstream->allocate(Bytes, Alignment);
+		auto Size = (Bytes + HugePageSize - 1) / HugePageSize * HugePageSize;
+		auto p = Upstream->allocate(Size, std::max(Alignment, HugePageSize));
+#ifdef MADV_HUGEPAGE
+		// 只是建议，内核不支持或者没有开启透明大页时照常使用普通页
+		madvise(p, Size, MADV_HUGEPAGE);
+#endif
+		return p;
+	}
+
+	void HugePageResource::do_deallocate(void* p, size_t Bytes, size_t Alignment)
+	{
+		if (Bytes < MinSize) return Upstream->deallocate(p, Bytes, Alignment);
+		auto Size = (Bytes + HugePageSize - 1) / HugePageSize * HugePageSize;
+		Upstream->deallocate(p, Size, std::max(Alignment, HugePageSize));
+	}
+
+	bool HugePageResource::do_is_equal(const std::pmr::memory_resource& other) const noexcept
+	{
+		return this == &other;
+	}
+
+	// 像素只有平凡的复制和析构，所以可以直接使用未构造的内存，释放时也不用逐个析构
+	template<typename PixelType>
+	PixelBuffer<PixelType>::PixelBuffer(size_t Count, bool Initialize, std::pmr::memory_resource* Resource, size_t Alignment) :
+		Count(Count),
+		Resource(Resource ? Resource : std::pmr::get_default_resource()),
+		Alignment(std::max(Alignment, MinAlignment))
+	{
+		static_assert(std::is_trivially_copyable_v<PixelType> && std::is_trivially_destructible_v<PixelType>);
+		if (Count) Data = static_cast<PixelType*>(this->Resource->allocate(Count * sizeof(PixelType), this->Alignment));
+		if (Initialize) std::uninitialized_default_construct_n(Data, Count);
+	}
+
+	template<typename PixelType>
+	PixelBuffer<PixelType>::PixelBuffer(PixelType* Data, size_t Count, Deleter Free) noexcept :
+		Data(Data),
+		Count(Count),
+		Free(Free),
+		Alignment(alignof(PixelType)) // 外部分配的内存只能保证按像素类型对齐
+	{
+	}
+
+	template<typename PixelType>
+	PixelBuffer<PixelType>::PixelBuffer(PixelBuffer&& from) noexcept :
+		Data(std::exchange(from.Data, nullptr)),
+		Count(std::exchange(from.Count, 0)),
+		Free(std::exchange(from.Free, nullptr)),
+		Resource(std::exchange(from.Resource, nullptr)),
+		Alignment(std::exchange(from.Alignment, MinAlignment))
+	{
+	}
+
+	template<typename PixelType>
+	PixelBuffer<PixelType>& PixelBuffer<PixelType>::operator=(PixelBuffer&& rhs) noexcept
+	{
+		if (this == &rhs) return *this;
+		clear();
+		Data = std::exchange(rhs.Data, nullptr);
+		Count = std::exchange(rhs.Count, 0);
+		Free = std::exchange(rhs.Free, nullptr);
+		Resource = std::exchange(rhs.Resource, nullptr);
+		Alignment = std::exchange(rhs.Alignment, MinAlignment);
+		return *this;
+	}
+
+	template<typename PixelType>
+	PixelBuffer<PixelType>::~PixelBuffer()
+	{
+		clear();
+	}
+
+	template<typename PixelType>
+	void PixelBuffer<PixelType>::resize(size_t NewCount)
+	{
+		if (NewCount == Count) return;
+		auto NewBuffer = PixelBuffer(NewCount, true, resource(), Alignment);
+		std::copy(Data, Data + std::min(Count, NewCount), NewBuffer.Data);
+		*this = std::move(NewBuffer);
+	}
+
+	template<typename PixelType>
+	void PixelBuffer<PixelType>::clear() noexcept
+	{
+		if (Free) Free(Data);
+		else if (Data) Resource->deallocate(Data, Count * sizeof(PixelType), Alignment);
+		Data = nullptr;
+		Count = 0;
+		Free = nullptr;
+		Resource = nullptr;
+		Alignment = MinAlignment;
+	}
+
+	template class PixelBuffer<Pixel_RGBA8>;
+	template class PixelBuffer<Pixel_RGBA16>;
+	template class PixelBuffer<Pixel_RGBA32>;
+	template class PixelBuffer<Pixel_RGBA32F>;
+
+	template<typename PixelType>
+	ConstImageView<PixelType>::ConstImageView(const PixelType* Data, uint32_t Width, uint32_t Height, ptrdiff_t Stride) :
+		Data(Data),
+		Width(Width),
+		Height(Height),
+		Stride(Stride)
+	{
+	}
+
+	template<typename PixelType>
+	ConstImageView<PixelType> ConstImageView<PixelType>::SubView(uint32_t x, uint32_t y, uint32_t w, uint32_t h) const
+	{
+		if (size_t(x) + w > Width || size_t(y) + h > Height)
+		{
+			throw std::out_of_range("`SubView()`: the region is out of the view.");
+		}
+		return ConstImageView(w && h ? GetRowPtr(y) + x : Data, w, h, Stride);
+	}
+
+	template<typename PixelType>
+	ImageView<PixelType>::ImageView(PixelType* Data, uint32_t Width, uint32_t Height, ptrdiff_t Stride) :
+		ConstImageView<PixelType>(Data, Width, Height, Stride)
+	{
+	}
+
+	template<typename PixelType>
+	ImageView<PixelType> ImageView<PixelType>::SubView(uint32_t x, uint32_t y, uint32_t w, uint32_t h) const
+	{
+		auto ret = ConstImageView<PixelType>::SubView(x, y, w, h);
+		return ImageView(const_cast<PixelType*>(ret.GetRowPtr(0)), w, h, this->Stride);
+	}
+
+	template<typename PixelType>
+	void ImageView<PixelType>::Fill(const PixelType& Color) const
+	{
+		if (!this->Width || !this->Height) return;
+		auto FirstRow = GetRowPtr(0);
+		std::fill(FirstRow, FirstRow + this->Width, Color);
+#if PROFILE_MultithreadingImageRastering
+#pragma omp parallel for
+#endif
+		for (ptrdiff_t y = 1; y < ptrdiff_t(this->Height); y++)
+		{
+			memcpy(GetRowPtr(y), FirstRow, this->Width * sizeof(PixelType));
+		}
+	}
+
+	template<typename PixelType>
+	void ImageView<PixelType>::Paint(const ConstImageView<PixelType>& Src, int x, int y) const
+	{
+		int srcx = 0, srcy = 0;
+		if (x < 0)
+		{
+			srcx = -x;
+			x = 0;
+		}
+		if (y < 0)
+		{
+			srcy = -y;
+			y = 0;
+		}
+		int w = std::min(int(Src.GetWidth()) - srcx, int(this->Width) - x);
+		int h = std::min(int(Src.GetHeight()) - srcy, int(this->Height) - y);
+		if (w <= 0 || h <= 0) return;
+
+#if PROFILE_MultithreadingImageRastering
+#pragma omp parallel for
+#endif
+		for (int py = 0; py < h; py++)
+		{
+			memcpy(GetRowPtr(y + py) + x, Src.GetRowPtr(srcy + py) + srcx, size_t(w) * sizeof(PixelType));
+		}
+	}
+
+	// 视图的行指针表，供以行指针表为参数的内部函数使用。这些函数只读取源图像的行，所以可以去掉 const
+	template<typename PixelType>
+	static std::vector<PixelType*> GetViewRows(const ConstImageView<PixelType>& View)
+	{
+		auto ret = std::vector<PixelType*>(View.GetHeight());
+		for (size_t y = 0; y < ret.size(); y++)
+		{
+			ret[y] = const_cast<PixelType*>(View.GetRowPtr(y));
+		}
+		return ret;
+	}
+
 	enum BitmapCompression
 	{
 		BI_RGB = 0,
@@ -558,12 +843,10 @@ namespace UniformBitmap
 		ifs.read(&Buffer[0], size);
 		LoadNonBmp(&Buffer[0], size);
 		ifs.seekg(0, std::ios::beg);
-		ExifData = FindExifDataFromJpeg(ifs);
-		RotateByExifData(true);
 	}
 
 	template<typename PixelType>
-	Image<PixelType>::Image(const std::string& FilePath, bool Verbose) :
+	Image<PixelType>::Image(const std::string& FilePath, bool Verbose, ExifOrientationHandling OrientationHandling) :
 		IsHDR(false),
 		Verbose(Verbose),
 		Name(std::filesystem::path(FilePath).filename().string())
@@ -583,17 +866,18 @@ namespace UniformBitmap
 		{
 			LoadNonBmp(FilePath);
 		}
+		if (OrientationHandling == ExifOrientationHandling::Apply) ApplyOrientation();
 	}
 
 	template<typename PixelType>
-	Image<PixelType>::Image(const std::string& FilePath, const std::string& Name, bool Verbose) :
-		Image(FilePath, Verbose)
+	Image<PixelType>::Image(const std::string& FilePath, const std::string& Name, bool Verbose, ExifOrientationHandling OrientationHandling) :
+		Image(FilePath, Verbose, OrientationHandling)
 	{
 		this->Name = Name;
 	}
 
 	template<typename PixelType>
-	Image<PixelType>::Image(const void* FileInMemory, size_t FileSize, const std::string& Name, bool Verbose) :
+	Image<PixelType>::Image(const void* FileInMemory, size_t FileSize, const std::string& Name, bool Verbose, ExifOrientationHandling OrientationHandling) :
 		IsHDR(false),
 		Name(Name),
 		Verbose(Verbose)
@@ -613,6 +897,7 @@ namespace UniformBitmap
 		{
 			LoadNonBmp(FileInMemory, FileSize);
 		}
+		if (OrientationHandling == ExifOrientationHandling::Apply) ApplyOrientation();
 	}
 
 	// 位图不可以是RLE压缩，但位图可以是带位域的位图、带调色板的索引颜色位图。
@@ -700,21 +985,11 @@ namespace UniformBitmap
 		XPelsPerMeter = BMIF.biXPelsPerMeter;
 		YPelsPerMeter = BMIF.biYPelsPerMeter;
 
-		BitmapData.resize(Width * Height);
-		RowPointers.resize(Height);
-		if (BMIF.biHeight < 0)
-		{
-			for (size_t i = 0; i < Height; i++)
-			{
-				RowPointers[i] = &BitmapData[i * Width];
-			}
-		}
-		else
+		CreateBuffer(Width, Height, false);
+		if (BMIF.biHeight > 0)
 		{
-			for (size_t i = 0; i < Height; i++)
-			{
-				RowPointers[i] = &BitmapData[(Height - i - 1) * Width];
-			}
+			// 文件里的行是自底向上存储的
+			std::reverse(RowPointers.begin(), RowPointers.end());
 		}
 
 		Pitch = ((size_t)(BMIF.biWidth * BMIF.biBitCount - 1) / 32 + 1) * 4;
@@ -926,7 +1201,7 @@ namespace UniformBitmap
 
 		for (size_t i = 0; i < Height; i++)
 		{
-			RowPointers[i] = &BitmapData[i * Width];
+			RowPointers[i] = &BitmapData[i * Stride];
 		}
 		BGR2RGB();
 	}
@@ -935,17 +1210,125 @@ namespace UniformBitmap
 		throw ReadBmpFileError(std::string("Failed to read BMP file: ") + e.what());
 	}
 
+	static const BufferPolicy& CheckBufferPolicy(const BufferPolicy& Policy)
+	{
+		if (Policy.RowAlignment & (Policy.RowAlignment - 1))
+		{
+			throw std::invalid_argument("`BufferPolicy`: the row alignment must be a power of 2.");
+		}
+		return Policy;
+	}
+
+	template<typename PixelType>
+	size_t Image<PixelType>::GetStrideForWidth(uint32_t w) const
+	{
+		size_t ret = size_t(w) + Policy.RowPadding;
+		if (Policy.RowAlignment > sizeof(PixelType))
+		{
+			size_t PixelsPerAlignment = Policy.RowAlignment / sizeof(PixelType);
+			ret = (ret + PixelsPerAlignment - 1) / PixelsPerAlignment * PixelsPerAlignment;
+		}
+		return ret;
+	}
+
 	template<typename PixelType>
-	void Image<PixelType>::CreateBuffer(uint32_t w, uint32_t h)
+	void Image<PixelType>::CreateBuffer(uint32_t w, uint32_t h, bool Initialize)
 	{
 		Width = w;
 		Height = h;
-		BitmapData.resize(Width * Height);
+		Stride = GetStrideForWidth(w);
+
+		// 多留出宽高互换后按 Policy 排列所需的空间，原地转置后仍能保持行对齐。紧密排列时两者相等
+		auto Count = std::max(Stride * h, GetStrideForWidth(h) * w);
+		auto Resource = Policy.Allocator ? Policy.Allocator : std::pmr::get_default_resource();
+		auto Alignment = std::max(Policy.RowAlignment, PixelBuffer<PixelType>::MinAlignment);
+		if (BitmapData.size() != Count || BitmapData.resource() != Resource || BitmapData.alignment() != Alignment)
+		{
+			BitmapData = PixelBuffer<PixelType>(Count, Initialize, Resource, Alignment);
+		}
 		RowPointers.resize(Height);
 		for (size_t y = 0; y < Height; y++)
 		{
-			RowPointers[y] = &BitmapData[y * Width];
+			RowPointers[y] = &BitmapData[y * Stride];
+		}
+	}
+
+	template<typename PixelType>
+	void Image<PixelType>::AdoptBuffer(uint32_t w, uint32_t h, PixelBuffer<PixelType>&& Buffer)
+	{
+		if (Buffer.size() != size_t(w) * h) throw std::invalid_argument("The size of the adopted buffer doesn't match the image size.");
+		RowPointers.resize(h);
+		Width = w;
+		Height = h;
+		Stride = w;
+		BitmapData = std::move(Buffer);
+		for (size_t y = 0; y < Height; y++)
+		{
+			RowPointers[y] = &BitmapData[y * Stride];
+		}
+	}
+
+	template<typename PixelType>
+	void Image<PixelType>::SetBufferPolicy(const BufferPolicy& NewPolicy)
+	{
+		Policy = CheckBufferPolicy(NewPolicy);
+		auto PrevBMP = std::move(BitmapData);
+		auto PrevRPtr = std::move(RowPointers);
+		CreateBuffer(Width, Height, false);
+		auto RowLength = size_t(Width) * sizeof(PixelType);
+#if PROFILE_MultithreadingImageRastering
+#pragma omp parallel for
+#endif
+		for (ptrdiff_t y = 0; y < ptrdiff_t(Height); y++)
+		{
+			memcpy(RowPointers[y], PrevRPtr[y], RowLength);
+		}
+	}
+
+	template<typename PixelType>
+	bool Image<PixelType>::GetRowStride(ptrdiff_t& RowStride) const
+	{
+		RowStride = Height > 1 ? RowPointers[1] - RowPointers[0] : ptrdiff_t(Stride);
+		for (size_t y = 2; y < Height; y++)
+		{
+			if (RowPointers[y] - RowPointers[y - 1] != RowStride) return false;
+		}
+		return true;
+	}
+
+	template<typename PixelType>
+	ImageView<PixelType> Image<PixelType>::GetView()
+	{
+		ptrdiff_t RowStride;
+		if (!GetRowStride(RowStride))
+		{
+			ApplyRowPtrsOrder();
+			RowStride = ptrdiff_t(Stride);
+		}
+		return ImageView<PixelType>(Height ? RowPointers[0] : BitmapData.data(), Width, Height, RowStride);
+	}
+
+	template<typename PixelType>
+	ImageView<PixelType> Image<PixelType>::GetView(uint32_t x, uint32_t y, uint32_t w, uint32_t h)
+	{
+		return GetView().SubView(x, y, w, h);
+	}
+
+	template<typename PixelType>
+	ConstImageView<PixelType> Image<PixelType>::GetView() const
+	{
+		ptrdiff_t RowStride;
+		if (!GetRowStride(RowStride))
+		{
+			throw std::logic_error("`GetView()`: the rows are not evenly spaced.");
 		}
+		return ConstImageView<PixelType>(Height ? RowPointers[0] : BitmapData.data(), Width, Height, RowStride);
+	}
+
+	template<typename PixelType>
+	ConstImageView<PixelType> Image<PixelType>::GetView(uint32_t x, uint32_t y, uint32_t w, uint32_t h) const
+	{
+		return GetView().SubView(x, y, w, h);
 	}
 
 	template<typename PixelType>
@@ -959,17 +1342,54 @@ namespace UniformBitmap
 
 	template<typename PixelType>
 	Image<PixelType>::Image(uint32_t Width, uint32_t Height, const PixelType& DefaultColor, const std::string& Name, bool Verbose) :
-		Image(Width, Height, Name, Verbose)
+		IsHDR(std::is_floating_point_v<ChannelType>),
+		Name(Name),
+		Verbose(Verbose)
 	{
+		CreateBuffer(Width, Height, false);
 		FillRect(0, 0, Width - 1, Height - 1, DefaultColor);
 	}
 
+	template<typename PixelType>
+	Image<PixelType>::Image(uint32_t Width, uint32_t Height, const BufferPolicy& Policy, const std::string& Name, bool Verbose) :
+		IsHDR(std::is_floating_point_v<ChannelType>),
+		Policy(CheckBufferPolicy(Policy)),
+		Name(Name),
+		Verbose(Verbose)
+	{
+		CreateBuffer(Width, Height);
+	}
+
+	template<typename PixelType>
+	Image<PixelType>::Image(uint32_t Width, uint32_t Height, PixelType* Pixels, typename PixelBuffer<PixelType>::Deleter Free, const std::string& Name, bool Verbose) :
+		IsHDR(std::is_floating_point_v<ChannelType>),
+		Name(Name),
+		Verbose(Verbose)
+	{
+		if (!Pixels && Width && Height) throw std::invalid_argument("No pixels to take over.");
+		AdoptBuffer(Width, Height, PixelBuffer<PixelType>(Pixels, size_t(Width) * Height, Free));
+	}
+
+	template<typename PixelType>
+	Image<PixelType>::Image(const ConstImageView<PixelType>& Src, const std::string& Name, bool Verbose) :
+		IsHDR(std::is_floating_point_v<ChannelType>),
+		Name(Name),
+		Verbose(Verbose)
+	{
+		CreateBuffer(Src.GetWidth(), Src.GetHeight(), false);
+		GetView().Paint(Src, 0, 0);
+	}
+
 	template<typename PixelType>
 	Image<PixelType>::Image(const Image& from) :
-		Image(from.GetWidth(), from.GetHeight(), from.Name, from.Verbose)
+		Policy(from.GetBufferPolicy()),
+		Name(from.Name),
+		Verbose(from.Verbose)
 	{
+		CreateBuffer(from.GetWidth(), from.GetHeight(), false);
 		XPelsPerMeter = from.XPelsPerMeter;
 		YPelsPerMeter = from.YPelsPerMeter;
+		Orientation = from.GetOrientation();
 		IsHDR = false;
 #if PROFILE_MultithreadingImageRastering
 #pragma omp parallel for
@@ -986,13 +1406,69 @@ namespace UniformBitmap
 		if (std::is_floating_point_v<ChannelType>) IsHDR = from.GetIsHDR();
 	}
 
+	template<typename PixelType>
+	Image<PixelType>::Image(Image&& from) noexcept :
+		Width(std::exchange(from.Width, 0)),
+		Height(std::exchange(from.Height, 0)),
+		IsHDR(from.IsHDR),
+		BitmapData(std::move(from.BitmapData)),
+		RowPointers(std::move(from.RowPointers)),
+		Stride(std::exchange(from.Stride, 0)),
+		Policy(from.Policy),
+		Orientation(std::exchange(from.Orientation, ExifOrientation::Normal)),
+		XPelsPerMeter(from.XPelsPerMeter),
+		YPelsPerMeter(from.YPelsPerMeter),
+		Name(std::move(from.Name)),
+		ExifData(std::move(from.ExifData)),
+		Verbose(from.Verbose)
+	{
+		from.BitmapData.clear();
+		from.RowPointers.clear();
+	}
+
+	// 默认的复制赋值会把行指针原样复制过来，指向的仍是 rhs 的位图数据，所以按复制构造重新建立
+	template<typename PixelType>
+	Image<PixelType>& Image<PixelType>::operator=(const Image& rhs)
+	{
+		if (this == &rhs) return *this;
+		auto Copy = Image(rhs);
+		Copy.ExifData = rhs.ExifData;
+		return *this = std::move(Copy);
+	}
+
+	template<typename PixelType>
+	Image<PixelType>& Image<PixelType>::operator=(Image&& rhs) noexcept
+	{
+		if (this == &rhs) return *this;
+		Width = std::exchange(rhs.Width, 0);
+		Height = std::exchange(rhs.Height, 0);
+		IsHDR = rhs.IsHDR;
+		BitmapData = std::move(rhs.BitmapData);
+		RowPointers = std::move(rhs.RowPointers);
+		Stride = std::exchange(rhs.Stride, 0);
+		Policy = rhs.Policy;
+		Orientation = std::exchange(rhs.Orientation, ExifOrientation::Normal);
+		XPelsPerMeter = rhs.XPelsPerMeter;
+		YPelsPerMeter = rhs.YPelsPerMeter;
+		Name = std::move(rhs.Name);
+		ExifData = std::move(rhs.ExifData);
+		Verbose = rhs.Verbose;
+		rhs.BitmapData.clear();
+		rhs.RowPointers.clear();
+		return *this;
+	}
+
 	template<typename PixelType>
 	template<typename FromType> requires (!std::is_same_v<PixelType, FromType>)
 	Image<PixelType>::Image(const Image<FromType>& from) :
-		Image(from.GetWidth(), from.GetHeight(), from.Name, from.Verbose)
+		Policy(from.GetBufferPolicy()),
+		Name(from.Name),
+		Verbose(from.Verbose)
 	{
+		CreateBuffer(from.GetWidth(), from.GetHeight(), false);
 		XPelsPerMeter = from.XPelsPerMeter;
 		YPelsPerMeter = from.YPelsPerMeter;
+		Orientation = from.GetOrientation();
 		IsHDR = false;
 #if PROFILE_MultithreadingImageRastering
 #pragma omp parallel for
@@ -1083,20 +1559,15 @@ namespace UniformBitmap
 	{
 		int HalfHeight = int(Height >> 1);
 		int MaxY = int(Height - 1);
-		auto RowBuffers = std::make_unique<PixelType[]>(int(Width) * HalfHeight);
-		auto RowLength = size_t(Width) * sizeof(PixelType);
 
 #if PROFILE_MultithreadingImageRastering
 #pragma omp parallel for
 #endif
 		for (int y = 0; y < HalfHeight; y++)
 		{
-			auto& row1 = RowPointers[y];
-			auto& row2 = RowPointers[MaxY - y];
-			auto& rowb = RowBuffers[int(Width) * y];
-			memcpy(&rowb, &row1, RowLength);
-			memcpy(&row1, &row2, RowLength);
-			memcpy(&row2, &rowb, RowLength);
+			auto row1 = RowPointers[y];
+			auto row2 = RowPointers[MaxY - y];
+			std::swap_ranges(row1, row1 + Width, row2);
 		}
 	}
 
@@ -1107,52 +1578,280 @@ namespace UniformBitmap
 		FlipV();
 	}
 
-	template<typename PixelType>
-	void Image<PixelType>::Rotate90_CW()
+	// 旋转 90 度的像素搬运：目标的 (x, y) 顺时针时取自源的 (y, SrcH - 1 - x)，逆时针时取自源的 (SrcW - 1 - y, x)。
+	// 逐行写目标会逐列读源，宽图每个像素都不命中缓存，所以按 Tile × Tile 的小块搬运，块内的源行与目标行都留在 L1 里。
+	template<typename PixelType, bool ClockWise>
+	static void RotateBlock(const std::vector<PixelType*>& Src, uint32_t SrcW, uint32_t SrcH, std::vector<PixelType*>& Dst, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1)
 	{
-		auto PrevBMP = std::move(BitmapData);
-		auto PrevRPtr = std::move(RowPointers);
-		CreateBuffer(Height, Width);
+		for (uint32_t y = y0; y < y1; y++)
+		{
+			auto DstRow = Dst[y];
+			for (uint32_t x = x0; x < x1; x++)
+			{
+				DstRow[x] = ClockWise ? Src[SrcH - 1 - x][y] : Src[x][SrcW - 1 - y];
+			}
+		}
+	}
 
-		const auto MaxX = int(Width - 1);
-		const auto MaxY = int(Height - 1);
+#if UNIBMP_X86
+	// 32 位像素：4 × 4 的块读入 4 个 SSE2 寄存器，转置后写出。逆时针时转置结果的行序要反过来
+	template<bool ClockWise>
+	static void RotateBlock4x4(const std::vector<Pixel_RGBA8*>& Src, uint32_t SrcW, uint32_t SrcH, std::vector<Pixel_RGBA8*>& Dst, uint32_t x, uint32_t y)
+	{
+		__m128i r0, r1, r2, r3;
+		if constexpr (ClockWise)
+		{
+			r0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&Src[SrcH - 1 - x][y]));
+			r1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&Src[SrcH - 2 - x][y]));
+			r2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&Src[SrcH - 3 - x][y]));
+			r3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&Src[SrcH - 4 - x][y]));
+		}
+		else
+		{
+			r0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&Src[x + 0][SrcW - 4 - y]));
+			r1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&Src[x + 1][SrcW - 4 - y]));
+			r2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&Src[x + 2][SrcW - 4 - y]));
+			r3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&Src[x + 3][SrcW - 4 - y]));
+		}
+		auto t0 = _mm_unpacklo_epi32(r0, r1);
+		auto t1 = _mm_unpacklo_epi32(r2, r3);
+		auto t2 = _mm_unpackhi_epi32(r0, r1);
+		auto t3 = _mm_unpackhi_epi32(r2, r3);
+		__m128i c[4] =
+		{
+			_mm_unpacklo_epi64(t0, t1),
+			_mm_unpackhi_epi64(t0, t1),
+			_mm_unpacklo_epi64(t2, t3),
+			_mm_unpackhi_epi64(t2, t3)
+		};
+		for (int i = 0; i < 4; i++)
+		{
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(&Dst[y + i][x]), c[ClockWise ? i : 3 - i]);
+		}
+	}
+#endif
+
+	template<typename PixelType, bool ClockWise>
+	static void RotateTile(const std::vector<PixelType*>& Src, uint32_t SrcW, uint32_t SrcH, std::vector<PixelType*>& Dst, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1)
+	{
+#if UNIBMP_X86
+		if constexpr (std::is_same_v<PixelType, Pixel_RGBA8>)
+		{
+			uint32_t x4 = x0 + ((x1 - x0) & ~3u);
+			uint32_t y4 = y0 + ((y1 - y0) & ~3u);
+			for (uint32_t y = y0; y < y4; y += 4)
+			{
+				for (uint32_t x = x0; x < x4; x += 4)
+				{
+					RotateBlock4x4<ClockWise>(Src, SrcW, SrcH, Dst, x, y);
+				}
+			}
+			RotateBlock<PixelType, ClockWise>(Src, SrcW, SrcH, Dst, x4, y0, x1, y4);
+			RotateBlock<PixelType, ClockWise>(Src, SrcW, SrcH, Dst, x0, y4, x1, y1);
+			return;
+		}
+#endif
+		RotateBlock<PixelType, ClockWise>(Src, SrcW, SrcH, Dst, x0, y0, x1, y1);
+	}
+
+	template<typename PixelType, bool ClockWise>
+	static void RotateTiled(const std::vector<PixelType*>& Src, uint32_t SrcW, uint32_t SrcH, std::vector<PixelType*>& Dst)
+	{
+		// 一块的源与目标加起来不超过 32 KB
+		constexpr uint32_t Tile = sizeof(PixelType) <= 8 ? 32 : 16;
+		const uint32_t DstW = SrcH;
+		const uint32_t DstH = SrcW;
+		const int NumTileRows = int((DstH + Tile - 1) / Tile);
 
 #if PROFILE_MultithreadingImageRastering
 #pragma omp parallel for
 #endif
-		for (int y = 0; y < int(Height); y++)
+		for (int ty = 0; ty < NumTileRows; ty++)
 		{
-			auto& row = RowPointers[y];
-			for (int x = 0; x < int(Width); x++)
+			uint32_t y0 = uint32_t(ty) * Tile;
+			uint32_t y1 = std::min(y0 + Tile, DstH);
+			for (uint32_t x0 = 0; x0 < DstW; x0 += Tile)
 			{
-				row[x] = PrevRPtr[MaxX - x][y];
+				RotateTile<PixelType, ClockWise>(Src, SrcW, SrcH, Dst, x0, y0, std::min(x0 + Tile, DstW), y1);
 			}
 		}
 	}
 
+	template<typename PixelType>
+	void Image<PixelType>::Rotate90_CW()
+	{
+		auto PrevBMP = std::move(BitmapData);
+		auto PrevRPtr = std::move(RowPointers);
+		auto PrevWidth = Width;
+		auto PrevHeight = Height;
+		CreateBuffer(Height, Width, false);
+
+		RotateTiled<PixelType, true>(PrevRPtr, PrevWidth, PrevHeight, RowPointers);
+	}
+
 	template<typename PixelType>
 	void Image<PixelType>::Rotate270_CW()
 	{
 		auto PrevBMP = std::move(BitmapData);
 		auto PrevRPtr = std::move(RowPointers);
-		CreateBuffer(Height, Width);
+		auto PrevWidth = Width;
+		auto PrevHeight = Height;
+		CreateBuffer(Height, Width, false);
+
+		RotateTiled<PixelType, false>(PrevRPtr, PrevWidth, PrevHeight, RowPointers);
+	}
+
+	template<typename PixelType>
+	void Image<PixelType>::Rotate90_CW(const ConstImageView<PixelType>& Src)
+	{
+		auto SrcRows = GetViewRows(Src);
+		auto PrevBMP = std::move(BitmapData);
+		auto PrevRPtr = std::move(RowPointers);
+		CreateBuffer(Src.GetHeight(), Src.GetWidth(), false);
+		Orientation = ExifOrientation::Normal;
+
+		RotateTiled<PixelType, true>(SrcRows, Src.GetWidth(), Src.GetHeight(), RowPointers);
+	}
+
+	template<typename PixelType>
+	void Image<PixelType>::Rotate270_CW(const ConstImageView<PixelType>& Src)
+	{
+		auto SrcRows = GetViewRows(Src);
+		auto PrevBMP = std::move(BitmapData);
+		auto PrevRPtr = std::move(RowPointers);
+		CreateBuffer(Src.GetHeight(), Src.GetWidth(), false);
+		Orientation = ExifOrientation::Normal;
+
+		RotateTiled<PixelType, false>(SrcRows, Src.GetWidth(), Src.GetHeight(), RowPointers);
+	}
+
+	template<typename PixelType>
+	void Image<PixelType>::ApplyRowPtrsOrder()
+	{
+		auto Data = &BitmapData[0];
+		auto RowLength = size_t(Width) * sizeof(PixelType);
+		auto RowBuffer = std::vector<PixelType>(Width);
+		auto Placed = std::vector<bool>(Height);
+
+		// 行指针是行的一个置换，沿着置换环逐行搬运
+		for (uint32_t y = 0; y < Height; y++)
+		{
+			if (Placed[y]) continue;
+			auto DstRow = Data + size_t(y) * Stride;
+			if (RowPointers[y] == DstRow)
+			{
+				Placed[y] = true;
+				continue;
+			}
+			memcpy(&RowBuffer[0], DstRow, RowLength);
+			auto Cur = y;
+			for (;;)
+			{
+				Placed[Cur] = true;
+				auto Src = uint32_t((RowPointers[Cur] - Data) / Stride);
+				if (Src == y) break;
+				memcpy(Data + size_t(Cur) * Stride, RowPointers[Cur], RowLength);
+				Cur = Src;
+			}
+			memcpy(Data + size_t(Cur) * Stride, &RowBuffer[0], RowLength);
+		}
+
+		for (uint32_t y = 0; y < Height; y++)
+		{
+			RowPointers[y] = Data + size_t(y) * Stride;
+		}
+	}
 
-		const auto MaxX = int(Width - 1);
-		const auto MaxY = int(Height - 1);
+	template<typename PixelType>
+	void Image<PixelType>::TransposeInPlace()
+	{
+		if (Width == Height)
+		{
+			// 正方形：以对角线为轴分块交换，通过行指针访问，不需要先整理行序
+			constexpr int Tile = sizeof(PixelType) <= 8 ? 32 : 16;
+			const int Size = int(Width);
+			const int NumTiles = (Size + Tile - 1) / Tile;
 
 #if PROFILE_MultithreadingImageRastering
-#pragma omp parallel for
+#pragma omp parallel for schedule(dynamic)
 #endif
-		for (int y = 0; y < int(Height); y++)
-		{
-			auto& row = RowPointers[y];
-			for (int x = 0; x < int(Width); x++)
+			for (int ty = 0; ty < NumTiles; ty++)
 			{
-				row[x] = PrevRPtr[x][MaxY - y];
+				int y0 = ty * Tile, y1 = std::min(y0 + Tile, Size);
+				for (int x0 = y0; x0 < Size; x0 += Tile)
+				{
+					int x1 = std::min(x0 + Tile, Size);
+					for (int y = y0; y < y1; y++)
+					{
+						for (int x = std::max(x0, y + 1); x < x1; x++)
+						{
+							std::swap(RowPointers[y][x], RowPointers[x][y]);
+						}
+					}
+				}
 			}
+			return;
+		}
+
+		// 非正方形：H 行 W 列的矩阵里位于 k 的像素，转置后位于 k * H mod (N - 1)。沿着置换环搬运，用位图标记已经搬过的位置
+		ApplyRowPtrsOrder();
+		auto Data = &BitmapData[0];
+		auto RowLength = size_t(Width) * sizeof(PixelType);
+
+		// 行末有填充时先把各行紧密排列，转置完再按新的宽度展开
+		for (size_t y = 1; Stride != Width && y < Height; y++)
+		{
+			memmove(Data + y * Width, Data + y * Stride, RowLength);
+		}
+
+		const size_t N = size_t(Width) * Height;
+		auto Moved = std::vector<bool>(N);
+		for (size_t Start = 1; Start + 1 < N; Start++)
+		{
+			if (Moved[Start]) continue;
+			auto Carry = Data[Start];
+			auto Cur = Start;
+			do
+			{
+				Cur = size_t(uint64_t(Cur) * Height % (N - 1)); // size_t 为 32 位时乘积会溢出
+				std::swap(Data[Cur], Carry);
+				Moved[Cur] = true;
+			} while (Cur != Start);
+		}
+
+		std::swap(Width, Height);
+		RowLength = size_t(Width) * sizeof(PixelType);
+
+		// 按新的宽度算出的行距放不下时（接管来的紧密排列的缓冲区），保持紧密排列
+		auto NewStride = GetStrideForWidth(Width);
+		if (NewStride * Height > BitmapData.size()) NewStride = Width;
+		for (size_t y = Height; NewStride != Width && y-- > 1;)
+		{
+			memmove(Data + y * NewStride, Data + y * Width, RowLength);
+		}
+		Stride = NewStride;
+
+		RowPointers.resize(Height);
+		for (uint32_t y = 0; y < Height; y++)
+		{
+			RowPointers[y] = Data + size_t(y) * Stride;
 		}
 	}
 
+	template<typename PixelType>
+	void Image<PixelType>::Rotate90_CW_InPlace()
+	{
+		TransposeInPlace();
+		FlipH();
+	}
+
+	template<typename PixelType>
+	void Image<PixelType>::Rotate270_CW_InPlace()
+	{
+		FlipH();
+		TransposeInPlace();
+	}
+
 	template<typename PixelType>
 	void Image<PixelType>::Rotate90_CCW()
 	{
@@ -1211,6 +1910,13 @@ namespace UniformBitmap
 
 	template<typename PixelType>
 	void Image<PixelType>::RotateByExifData(bool RemoveRotationFromExifData)
+	{
+		LoadOrientationFromExif(RemoveRotationFromExifData);
+		ApplyOrientation();
+	}
+
+	template<typename PixelType>
+	void Image<PixelType>::LoadOrientationFromExif(bool RemoveRotationFromExifData)
 	{
 		if (!ExifData)
 		{
@@ -1226,73 +1932,72 @@ namespace UniformBitmap
 			{
 				if (Field.first == 0x0112)
 				{
-					auto& Orientation = Field.second->AsUShorts().Components[0];
-					switch (Orientation)
+					auto& OrientationTag = Field.second->AsUShorts().Components[0];
+					switch (OrientationTag)
 					{
 					case 1:
 						if (Verbose)
 						{
 							std::cout << std::string("[INFO] For bitmap `") + Name + ": Exif data `Orientation` specified horizontal (normal).\n";
 						}
+						Orientation = ExifOrientation::Normal;
 						break;
 					case 2:
 						if (Verbose)
 						{
 							std::cout << std::string("[INFO] For bitmap `") + Name + ": Exif data `Orientation` specified mirror horizontal.\n";
 						}
-						FlipH();
+						Orientation = ExifOrientation::MirrorH;
 						break;
 					case 3:
 						if (Verbose)
 						{
 							std::cout << std::string("[INFO] For bitmap `") + Name + ": Exif data `Orientation` specified 180° rotation.\n";
 						}
-						Rotate180();
+						Orientation = ExifOrientation::Rotate180;
 						break;
 					case 4:
 						if (Verbose)
 						{
 							std::cout << std::string("[INFO] For bitmap `") + Name + ": Exif data `Orientation` specified mirror vertical.\n";
 						}
-						FlipV();
+						Orientation = ExifOrientation::MirrorV;
 						break;
 					case 5:
 						if (Verbose)
 						{
 							std::cout << std::string("[INFO] For bitmap `") + Name + ": Exif data `Orientation` specified mirror horizontal and rotate 270 CW.\n";
 						}
-						FlipH();
-						Rotate270_CW();
+						Orientation = ExifOrientation::MirrorH_Rotate270_CW;
 						break;
 					case 6:
 						if (Verbose)
 						{
 							std::cout << std::string("[INFO] For bitmap `") + Name + ": Exif data `Orientation` specified rotate 90 CW.\n";
 						}
-						Rotate90_CW();
+						Orientation = ExifOrientation::Rotate90_CW;
 						break;
 					case 7:
 						if (Verbose)
 						{
 							std::cout << std::string("[INFO] For bitmap `") + Name + ": Exif data `Orientation` specified mirror horizontal and rotate 90 CW.\n";
 						}
-						FlipH();
-						Rotate90_CW();
+						Orientation = ExifOrientation::MirrorH_Rotate90_CW;
 						break;
 					case 8:
 						if (Verbose)
 						{
 							std::cout << std::string("[INFO] For bitmap `") + Name + ": Exif data `Orientation` specified rotate 270 CW.\n";
 						}
-						Rotate270_CW();
+						Orientation = ExifOrientation::Rotate270_CW;
 						break;
 					default:
-						std::cerr << std::string("[WARN] For bitmap `") + Name + ": Exif data `Orientation` specified unknown orientation `" + std::to_string(Orientation) + "`.\n";
+						std::cerr << std::string("[WARN] For bitmap `") + Name + ": Exif data `Orientation` specified unknown orientation `" + std::to_string(OrientationTag) + "`.\n";
 						break;
 					}
 					if (RemoveRotationFromExifData)
 					{
-						Orientation = 1;
+						OrientationTag = 1;
 					}
 					return;
 				}
@@ -1304,6 +2009,58 @@ namespace UniformBitmap
 		}
 	}
 
+	template<typename PixelType>
+	void Image<PixelType>::ApplyOrientation()
+	{
+		switch (Orientation)
+		{
+		case ExifOrientation::Normal: break;
+		case ExifOrientation::MirrorH: FlipH(); break;
+		case ExifOrientation::Rotate180: Rotate180(); break;
+		case ExifOrientation::MirrorV: FlipV(); break;
+		case ExifOrientation::MirrorH_Rotate270_CW: FlipH(); Rotate270_CW(); break;
+		case ExifOrientation::Rotate90_CW: Rotate90_CW(); break;
+		case ExifOrientation::MirrorH_Rotate90_CW: FlipH(); Rotate90_CW(); break;
+		case ExifOrientation::Rotate270_CW: Rotate270_CW(); break;
+		}
+		Orientation = ExifOrientation::Normal;
+	}
+
+	template<typename PixelType>
+	typename Image<PixelType>::OrientationMap Image<PixelType>::GetOrientationMap() const
+	{
+		// 与 ApplyOrientation() 的变换一致，例如顺时针旋转 90 度后显示的 (x, y) 来自存储的 (y, H - 1 - x)
+		const int W1 = int(Width) - 1;
+		const int H1 = int(Height) - 1;
+		switch (Orientation)
+		{
+		case ExifOrientation::MirrorH: return { W1, -1, 0, 0, 0, 1 };
+		case ExifOrientation::Rotate180: return { W1, -1, 0, H1, 0, -1 };
+		case ExifOrientation::MirrorV: return { 0, 1, 0, H1, 0, -1 };
+		case ExifOrientation::MirrorH_Rotate270_CW: return { 0, 0, 1, 0, 1, 0 };
+		case ExifOrientation::Rotate90_CW: return { 0, 0, 1, H1, -1, 0 };
+		case ExifOrientation::MirrorH_Rotate90_CW: return { W1, 0, -1, H1, -1, 0 };
+		case ExifOrientation::Rotate270_CW: return { W1, 0, -1, 0, 1, 0 };
+		default: return { 0, 1, 0, 0, 0, 1 };
+		}
+	}
+
+	template<typename PixelType>
+	PixelType Image<PixelType>::GetOrientedPixel(uint32_t x, uint32_t y) const
+	{
+		auto Map = GetOrientationMap();
+		return RowPointers[Map.MapY(int(x), int(y))][Map.MapX(int(x), int(y))];
+	}
+
+	template<typename PixelType>
+	Image<PixelType> Image<PixelType>::MakeOrientedCopy() const
+	{
+		auto Oriented = *this;
+		Oriented.ExifData = ExifData;
+		Oriented.ApplyOrientation();
+		return Oriented;
+	}
+
 	template<typename PixelType>
 	bool Image<PixelType>::WidthIs2N() const
 	{
@@ -1329,16 +2086,16 @@ namespace UniformBitmap
 	template<typename PixelType>
 	void Image<PixelType>::ExpandTo2N()
 	{
-		uint64_t w = 1; while (w < Width) w <<= 1;
-		uint64_t h = 1; while (h < Height) h <<= 1;
+		uint64_t w = 1; while (w < GetOrientedWidth()) w <<= 1;
+		uint64_t h = 1; while (h < GetOrientedHeight()) h <<= 1;
 		ExpandResizeLinear(uint32_t(w), uint32_t(h));
 	}
 
 	template<typename PixelType>
 	void Image<PixelType>::ShrinkTo2N()
 	{
-		uint64_t w = 1; while (w < Width) w <<= 1;
-		uint64_t h = 1; while (h < Height) h <<= 1;
+		uint64_t w = 1; while (w < GetOrientedWidth()) w <<= 1;
+		uint64_t h = 1; while (h < GetOrientedHeight()) h <<= 1;
 		w >>= 1;
 		h >>= 1;
 		ShrinkResize(uint32_t(w), uint32_t(h));
@@ -1347,184 +2104,1194 @@ namespace UniformBitmap
 	template<typename PixelType>
 	void Image<PixelType>::ResizeNearest(uint32_t NewWidth, uint32_t NewHeight)
 	{
-		if (NewWidth == Width && NewHeight == Height) return;
+		auto OrigWidth = GetOrientedWidth();
+		auto OrigHeight = GetOrientedHeight();
+		if (NewWidth == OrigWidth && NewHeight == OrigHeight)
+		{
+			ApplyOrientation();
+			return;
+		}
 
+		auto Map = GetOrientationMap();
+		auto PrevOrientation = Orientation;
 		auto PrevBMP = std::move(BitmapData);
 		auto PrevRPtr = std::move(RowPointers);
-		auto OrigWidth = Width;
-		auto OrigHeight = Height;
-		CreateBuffer(NewWidth, NewHeight);
+		CreateBuffer(NewWidth, NewHeight, false);
+		Orientation = ExifOrientation::Normal;
+
+		if (PrevOrientation == ExifOrientation::Normal)
+		{
+#if PROFILE_MultithreadingImageRastering
+#pragma omp parallel for
+#endif
+			for (int y = 0; y < int(NewHeight); y++)
+			{
+				auto& DstRow = RowPointers[y];
+				auto& SrcRow = PrevRPtr[uint64_t(y) * OrigHeight / NewHeight];
+				for (int x = 0; x < int(NewWidth); x++)
+				{
+					DstRow[x] = SrcRow[uint64_t(x) * OrigWidth / NewWidth];
+				}
+			}
+			return;
+		}
 
+		// 带方向变换时按显示方向取样，旋转与缩放在同一遍里完成
 #if PROFILE_MultithreadingImageRastering
 #pragma omp parallel for
 #endif
 		for (int y = 0; y < int(NewHeight); y++)
 		{
 			auto& DstRow = RowPointers[y];
-			auto& SrcRow = PrevRPtr[uint64_t(y) * OrigHeight / NewHeight];
+			int sy = int(uint64_t(y) * OrigHeight / NewHeight);
+			for (int x = 0; x < int(NewWidth); x++)
+			{
+				int sx = int(uint64_t(x) * OrigWidth / NewWidth);
+				DstRow[x] = PrevRPtr[Map.MapY(sx, sy)][Map.MapX(sx, sy)];
+			}
+		}
+	}
+
+	template<typename PixelType>
+	void Image<PixelType>::ResizeLinear(uint32_t NewWidth, uint32_t NewHeight)
+	{
+		auto OrigWidth = GetOrientedWidth();
+		auto OrigHeight = GetOrientedHeight();
+		int xset = NewWidth > OrigWidth ? 2 : NewWidth == OrigWidth ? 1 : 0;
+		int yset = NewHeight > OrigHeight ? 2 : NewHeight == OrigHeight ? 1 : 0;
+		int xyset = (xset << 4) + (yset << 0);
+		// 0: shrink; 1: keep; 2: expand
+		switch (xyset)
+		{
+		case 0x00:
+		case 0x01:
+		case 0x10: ShrinkResize(NewWidth, NewHeight); break;
+		case 0x11: ApplyOrientation(); break;
+		case 0x12:
+		case 0x21:
+		case 0x22: ExpandResizeLinear(NewWidth, NewHeight); break;
+		case 0x02: ShrinkResize(NewWidth, OrigHeight); ExpandResizeLinear(NewWidth, NewHeight); break;
+		case 0x20: ShrinkResize(OrigWidth, NewHeight); ExpandResizeLinear(NewWidth, NewHeight); break;
+		}
+	}
+
+	template<typename PixelType>
+	void Image<PixelType>::ExpandResizeLinear(uint32_t NewWidth, uint32_t NewHeight)
+	{
+		auto OrigWidth = GetOrientedWidth();
+		auto OrigHeight = GetOrientedHeight();
+		if (NewWidth == OrigWidth && NewHeight == OrigHeight)
+		{
+			ApplyOrientation();
+			return;
+		}
+		if (NewWidth < OrigWidth || NewHeight < OrigHeight)
+		{
+			throw std::invalid_argument("Should not use `ExpandResizeLinear()` on shrinking an image.\n");
+		}
+
+		auto Map = GetOrientationMap();
+		auto PrevBMP = std::move(BitmapData);
+		auto PrevRPtr = std::move(RowPointers);
+		CreateBuffer(NewWidth, NewHeight, false);
+		Orientation = ExifOrientation::Normal;
+
+#if PROFILE_MultithreadingComplexImageRastering
+#pragma omp parallel for
+#endif
+		for (int y = 0; y < int(NewHeight); y++)
+		{
+			float v = float(y) / NewHeight;
+			auto DstRow = RowPointers[y];
 			for (int x = 0; x < int(NewWidth); x++)
 			{
-				DstRow[x] = SrcRow[uint64_t(x) * OrigWidth / NewWidth];
+				float u = float(x) / NewWidth;
+				DstRow[x] = LinearSample(OrigWidth, OrigHeight, PrevRPtr, Map, u, v);
+			}
+		}
+	}
+
+	// 面积平均缩小的一维划分：输出的第 i 个像素覆盖输入的 [Bounds[i], Bounds[i + 1])，每个输入像素只属于一个输出像素。
+	// Mirror 时从另一端开始划分，这样按存储方向划分出的块与按显示方向划分的完全一致
+	static std::vector<uint32_t> MakeShrinkBounds(uint32_t SrcSize, uint32_t DstSize, bool Mirror)
+	{
+		auto Bounds = std::vector<uint32_t>(size_t(DstSize) + 1);
+		for (uint32_t i = 0; i <= DstSize; i++)
+		{
+			if (Mirror) Bounds[i] = SrcSize - uint32_t(uint64_t(DstSize - i) * SrcSize / DstSize);
+			else Bounds[i] = uint32_t(uint64_t(i) * SrcSize / DstSize);
+		}
+		return Bounds;
+	}
+
+	// 所有块一样大并且是 1、2、4、8 时返回块的大小，否则返回 0
+	static uint32_t GetShrinkFactor(uint32_t SrcSize, uint32_t DstSize)
+	{
+		uint32_t Factor = SrcSize / DstSize;
+		if (Factor * DstSize != SrcSize) return 0;
+		switch (Factor)
+		{
+		case 1: case 2: case 4: case 8: return Factor;
+		default: return 0;
+		}
+	}
+
+	template<typename ChannelType, typename SumType, typename RecipType>
+	static ChannelType AverageToChannel(SumType Sum, RecipType Recip)
+	{
+		if constexpr (std::is_floating_point_v<ChannelType>) return ChannelType(RecipType(Sum) * Recip);
+		else return ChannelType(RecipType(Sum) * Recip + RecipType(0.5));
+	}
+
+	// 任意比例：每个输出行先把所覆盖的输入行逐列累加到一行整数和里，每个输入像素只读一次，
+	// 再对这行和按块横向求和，乘以块面积的倒数得到平均值
+	template<typename PixelType, typename SumType, typename RecipType>
+	static void ShrinkAreaSpans(const std::vector<PixelType*>& SrcRows, uint32_t SrcWidth, std::vector<PixelType*>& DstRows, const std::vector<uint32_t>& XBounds, const std::vector<uint32_t>& YBounds)
+	{
+		using ChannelType = typename PixelType::ChannelType;
+		const int DstWidth = int(XBounds.size()) - 1;
+		const int DstHeight = int(YBounds.size()) - 1;
+
+#if PROFILE_MultithreadingComplexImageRastering
+#pragma omp parallel for
+#endif
+		for (int y = 0; y < DstHeight; y++)
+		{
+			auto Column = std::vector<SumType>(size_t(SrcWidth) * 4, SumType(0));
+			for (uint32_t sy = YBounds[y]; sy < YBounds[y + 1]; sy++)
+			{
+				auto Src = reinterpret_cast<const ChannelType*>(SrcRows[sy]);
+				for (size_t i = 0; i < Column.size(); i++) Column[i] += Src[i];
+			}
+
+			auto Dst = reinterpret_cast<ChannelType*>(DstRows[y]);
+			uint64_t SpanY = YBounds[y + 1] - YBounds[y];
+			for (int x = 0; x < DstWidth; x++)
+			{
+				SumType Sum[4] = {};
+				for (size_t i = size_t(XBounds[x]) * 4; i < size_t(XBounds[x + 1]) * 4; i += 4)
+				{
+					for (int c = 0; c < 4; c++) Sum[c] += Column[i + c];
+				}
+				RecipType Recip = RecipType(1) / RecipType((XBounds[x + 1] - XBounds[x]) * SpanY);
+				for (int c = 0; c < 4; c++) Dst[size_t(x) * 4 + c] = AverageToChannel<ChannelType>(Sum[c], Recip);
+			}
+		}
+	}
+
+	// 整数倍 2、4、8 缩小（例如 ShrinkTo2N() 与各级 mipmap）：块大小是编译期常数，求平均的除法变成移位。
+	// 列和缓冲每个线程只分配一次；横向求和时一个像素的四个通道一起累加，读取是连续的
+	template<int FactorX, int FactorY, typename PixelType, typename SumType>
+	static void ShrinkAreaFixed(const std::vector<PixelType*>& SrcRows, std::vector<PixelType*>& DstRows, uint32_t DstWidth, uint32_t DstHeight)
+	{
+		using ChannelType = typename PixelType::ChannelType;
+		constexpr int Area = FactorX * FactorY;
+		constexpr int Shift = std::countr_zero(unsigned(Area));
+		const size_t NumChannels = size_t(DstWidth) * FactorX * 4;
+
+#if PROFILE_MultithreadingComplexImageRastering
+#pragma omp parallel
+#endif
+		{
+			auto Column = std::vector<SumType>(NumChannels);
+#if PROFILE_MultithreadingComplexImageRastering
+#pragma omp for
+#endif
+			for (int y = 0; y < int(DstHeight); y++)
+			{
+				auto Src = reinterpret_cast<const ChannelType*>(SrcRows[size_t(y) * FactorY]);
+				for (size_t i = 0; i < NumChannels; i++) Column[i] = Src[i];
+				for (int sy = 1; sy < FactorY; sy++)
+				{
+					Src = reinterpret_cast<const ChannelType*>(SrcRows[size_t(y) * FactorY + sy]);
+					for (size_t i = 0; i < NumChannels; i++) Column[i] += Src[i];
+				}
+
+				auto Dst = reinterpret_cast<ChannelType*>(DstRows[y]);
+				for (size_t x = 0; x < DstWidth; x++)
+				{
+					auto Block = &Column[x * FactorX * 4];
+					SumType Sum[4] = { Block[0], Block[1], Block[2], Block[3] };
+					for (int sx = 1; sx < FactorX; sx++)
+					{
+						for (int c = 0; c < 4; c++) Sum[c] += Block[sx * 4 + c];
+					}
+					for (int c = 0; c < 4; c++)
+					{
+						if constexpr (std::is_floating_point_v<ChannelType>) Dst[x * 4 + c] = ChannelType(Sum[c] * (SumType(1) / Area));
+						else Dst[x * 4 + c] = ChannelType((Sum[c] + Area / 2) >> Shift);
+					}
+				}
+			}
+		}
+	}
+
+	template<int FactorX, typename PixelType, typename SumType>
+	static bool ShrinkAreaFixed(uint32_t FactorY, const std::vector<PixelType*>& SrcRows, std::vector<PixelType*>& DstRows, uint32_t DstWidth, uint32_t DstHeight)
+	{
+		switch (FactorY)
+		{
+		case 1: ShrinkAreaFixed<FactorX, 1, PixelType, SumType>(SrcRows, DstRows, DstWidth, DstHeight); return true;
+		case 2: ShrinkAreaFixed<FactorX, 2, PixelType, SumType>(SrcRows, DstRows, DstWidth, DstHeight); return true;
+		case 4: ShrinkAreaFixed<FactorX, 4, PixelType, SumType>(SrcRows, DstRows, DstWidth, DstHeight); return true;
+		case 8: ShrinkAreaFixed<FactorX, 8, PixelType, SumType>(SrcRows, DstRows, DstWidth, DstHeight); return true;
+		default: return false;
+		}
+	}
+
+	template<typename PixelType, typename SumType>
+	static void ShrinkArea(const std::vector<PixelType*>& SrcRows, uint32_t SrcWidth, uint32_t SrcHeight, std::vector<PixelType*>& DstRows, const std::vector<uint32_t>& XBounds, const std::vector<uint32_t>& YBounds)
+	{
+		using ChannelType = typename PixelType::ChannelType;
+		using RecipType = std::conditional_t<sizeof(ChannelType) == 1 && std::is_integral_v<ChannelType>, float, double>;
+		uint32_t DstWidth = uint32_t(XBounds.size()) - 1;
+		uint32_t DstHeight = uint32_t(YBounds.size()) - 1;
+		uint32_t FactorX = GetShrinkFactor(SrcWidth, DstWidth);
+		uint32_t FactorY = GetShrinkFactor(SrcHeight, DstHeight);
+		bool Done = false;
+		switch (FactorX)
+		{
+		case 1: Done = ShrinkAreaFixed<1, PixelType, SumType>(FactorY, SrcRows, DstRows, DstWidth, DstHeight); break;
+		case 2: Done = ShrinkAreaFixed<2, PixelType, SumType>(FactorY, SrcRows, DstRows, DstWidth, DstHeight); break;
+		case 4: Done = ShrinkAreaFixed<4, PixelType, SumType>(FactorY, SrcRows, DstRows, DstWidth, DstHeight); break;
+		case 8: Done = ShrinkAreaFixed<8, PixelType, SumType>(FactorY, SrcRows, DstRows, DstWidth, DstHeight); break;
+		}
+		if (!Done) ShrinkAreaSpans<PixelType, SumType, RecipType>(SrcRows, SrcWidth, DstRows, XBounds, YBounds);
+	}
+
+	// 按最大的块估计和的范围，选用够用的最窄的整数累加器，8 位图像的小块用 uint16 时 SIMD 一次能加的通道最多
+	template<typename PixelType>
+	static void ShrinkArea(const std::vector<PixelType*>& SrcRows, uint32_t SrcWidth, uint32_t SrcHeight, std::vector<PixelType*>& DstRows, const std::vector<uint32_t>& XBounds, const std::vector<uint32_t>& YBounds)
+	{
+		using ChannelType = typename PixelType::ChannelType;
+		if constexpr (std::is_floating_point_v<ChannelType>)
+		{
+			ShrinkArea<PixelType, double>(SrcRows, SrcWidth, SrcHeight, DstRows, XBounds, YBounds);
+		}
+		else
+		{
+			uint64_t MaxSpanX = 0, MaxSpanY = 0;
+			for (size_t i = 1; i < XBounds.size(); i++) MaxSpanX = std::max<uint64_t>(MaxSpanX, XBounds[i] - XBounds[i - 1]);
+			for (size_t i = 1; i < YBounds.size(); i++) MaxSpanY = std::max<uint64_t>(MaxSpanY, YBounds[i] - YBounds[i - 1]);
+			uint64_t MaxSum = MaxSpanX * MaxSpanY * std::numeric_limits<ChannelType>::max();
+			if (MaxSum <= std::numeric_limits<uint16_t>::max()) ShrinkArea<PixelType, uint16_t>(SrcRows, SrcWidth, SrcHeight, DstRows, XBounds, YBounds);
+			else if (MaxSum <= std::numeric_limits<uint32_t>::max()) ShrinkArea<PixelType, uint32_t>(SrcRows, SrcWidth, SrcHeight, DstRows, XBounds, YBounds);
+			else ShrinkArea<PixelType, uint64_t>(SrcRows, SrcWidth, SrcHeight, DstRows, XBounds, YBounds);
+		}
+	}
+
+	template<typename PixelType>
+	void Image<PixelType>::ShrinkResize(uint32_t NewWidth, uint32_t NewHeight)
+	{
+		auto OrigWidth = GetOrientedWidth();
+		auto OrigHeight = GetOrientedHeight();
+		if (NewWidth == OrigWidth && NewHeight == OrigHeight)
+		{
+			ApplyOrientation();
+			return;
+		}
+		if (NewWidth > OrigWidth || NewHeight > OrigHeight)
+		{
+			throw std::invalid_argument("Should not use `ShrinkResize()` on expanding an image.\n");
+		}
+		if (!NewWidth || !NewHeight)
+		{
+			throw std::invalid_argument("`ShrinkResize()`: the new size must not be zero.\n");
+		}
+
+		// 求平均与顺序无关，所以直接按存储方向划分、求平均，得到的小图仍带着原来的方向，最后只对小图做方向变换
+		auto Map = GetOrientationMap();
+		bool Transposed = Map.XX == 0;
+		uint32_t DstWidth = Transposed ? NewHeight : NewWidth;
+		uint32_t DstHeight = Transposed ? NewWidth : NewHeight;
+		auto XBounds = MakeShrinkBounds(Width, DstWidth, (Transposed ? Map.XY : Map.XX) < 0);
+		auto YBounds = MakeShrinkBounds(Height, DstHeight, (Transposed ? Map.YX : Map.YY) < 0);
+
+		auto SrcWidth = Width;
+		auto SrcHeight = Height;
+		auto PrevBMP = std::move(BitmapData);
+		auto PrevRPtr = std::move(RowPointers);
+		CreateBuffer(DstWidth, DstHeight, false);
+		ShrinkArea(PrevRPtr, SrcWidth, SrcHeight, RowPointers, XBounds, YBounds);
+		ApplyOrientation();
+	}
+
+	template<typename PixelType>
+	void Image<PixelType>::ShrinkResize(const ConstImageView<PixelType>& Src, uint32_t NewWidth, uint32_t NewHeight)
+	{
+		if (NewWidth > Src.GetWidth() || NewHeight > Src.GetHeight())
+		{
+			throw std::invalid_argument("Should not use `ShrinkResize()` on expanding an image.\n");
+		}
+		if (!NewWidth || !NewHeight)
+		{
+			throw std::invalid_argument("`ShrinkResize()`: the new size must not be zero.\n");
+		}
+
+		auto XBounds = MakeShrinkBounds(Src.GetWidth(), NewWidth, false);
+		auto YBounds = MakeShrinkBounds(Src.GetHeight(), NewHeight, false);
+		auto SrcRows = GetViewRows(Src);
+		auto PrevBMP = std::move(BitmapData);
+		auto PrevRPtr = std::move(RowPointers);
+		CreateBuffer(NewWidth, NewHeight, false);
+		Orientation = ExifOrientation::Normal;
+		ShrinkArea(SrcRows, Src.GetWidth(), Src.GetHeight(), RowPointers, XBounds, YBounds);
+	}
+
+	template<typename PixelType>
+	MipChain<PixelType>::MipChain(uint32_t Width, uint32_t Height)
+	{
+		if (!Width || !Height)
+		{
+			throw std::invalid_argument("`MipChain`: the image size must not be zero.\n");
+		}
+		size_t Total = 0;
+		for (;;)
+		{
+			Levels.push_back({ Width, Height, Total });
+			Total += size_t(Width) * Height;
+			if (Width == 1 && Height == 1) break;
+			Width = std::max(Width / 2, 1u);
+			Height = std::max(Height / 2, 1u);
+		}
+		Pixels = PixelBuffer<PixelType>(Total, false);
+	}
+
+	template<typename PixelType>
+	MipChain<PixelType>::MipChain(const MipChain& from) :
+		Pixels(from.Pixels.size(), false), Levels(from.Levels)
+	{
+		std::copy(from.Pixels.data(), from.Pixels.data() + from.Pixels.size(), Pixels.data());
+	}
+
+	template<typename PixelType>
+	MipChain<PixelType>& MipChain<PixelType>::operator=(const MipChain& rhs)
+	{
+		if (this != &rhs) *this = MipChain(rhs);
+		return *this;
+	}
+
+	template<typename PixelType>
+	Image<PixelType> MipChain<PixelType>::GetLevelImage(size_t i) const
+	{
+		auto& L = Levels.at(i);
+		return Image<PixelType>(ConstImageView<PixelType>(GetLevelRowPtr(i, 0), L.Width, L.Height, L.Width), "", false);
+	}
+
+	static float SRGBToLinear(float v)
+	{
+		return v <= 0.04045f ? v / 12.92f : std::pow((v + 0.055f) / 1.055f, 2.4f);
+	}
+
+	static float LinearToSRGB(float v)
+	{
+		return v <= 0.0031308f ? v * 12.92f : 1.055f * std::pow(v, 1.0f / 2.4f) - 0.055f;
+	}
+
+	// sRGB 与线性值的换算。8 位查表：编码时先按线性值查一个近似的结果，再与相邻两个值的线性中点比较修正，得到线性空间里最近的值
+	template<typename ChannelType>
+	class SRGBCodec
+	{
+	public:
+		static constexpr float Max = std::is_floating_point_v<ChannelType> ? 1.0f : float(std::numeric_limits<ChannelType>::max());
+
+		static float Decode(ChannelType c)
+		{
+			if constexpr (std::is_same_v<ChannelType, uint8_t>) return Table.ToLinear[c];
+			else return SRGBToLinear(float(c) / Max);
+		}
+
+		static ChannelType Encode(float v)
+		{
+			if constexpr (std::is_same_v<ChannelType, uint8_t>)
+			{
+				int i = Table.Guess[int(std::clamp(v, 0.0f, 1.0f) * 4096.0f)];
+				while (i < 255 && v >= Table.Mid[i]) i++;
+				while (i > 0 && v < Table.Mid[i - 1]) i--;
+				return uint8_t(i);
+			}
+			else if constexpr (std::is_floating_point_v<ChannelType>) return ChannelType(LinearToSRGB(v));
+			else return ChannelType(std::clamp(LinearToSRGB(v), 0.0f, 1.0f) * Max + 0.5f);
+		}
+
+	protected:
+		struct Tables
+		{
+			float ToLinear[256];
+			float Mid[255];
+			uint8_t Guess[4097];
+
+			Tables()
+			{
+				for (int i = 0; i < 256; i++) ToLinear[i] = SRGBToLinear(i / 255.0f);
+				for (int i = 0; i < 255; i++) Mid[i] = (ToLinear[i] + ToLinear[i + 1]) * 0.5f;
+				for (int i = 0; i <= 4096; i++) Guess[i] = uint8_t(std::upper_bound(Mid, Mid + 255, i / 4096.0f) - Mid);
+			}
+		};
+
+		static inline const Tables Table;
+	};
+
+	// 生成下一级的一行：输出的每个像素是上一级 [XBounds[x], XBounds[x + 1]) x SrcRows 这一块的平均值。
+	// 宽、高都是偶数时块都是 2x2，其余情况奇数边上的块是 3 个像素宽，宽或高为 1 时块只有 1 个像素宽
+	template<typename PixelType>
+	static void MakeMipRow(const PixelType* const* SrcRows, uint32_t NumRows, const std::vector<uint32_t>& XBounds, PixelType* Dst, MipColorSpace ColorSpace)
+	{
+		using ChannelType = typename PixelType::ChannelType;
+		using SumType = std::conditional_t<std::is_floating_point_v<ChannelType>, double, std::conditional_t<sizeof(ChannelType) < 4, uint32_t, uint64_t>>;
+		const uint32_t DstWidth = uint32_t(XBounds.size()) - 1;
+
+		if (ColorSpace == MipColorSpace::Linear && NumRows == 2 && XBounds.back() == DstWidth * 2)
+		{
+			auto Src0 = reinterpret_cast<const ChannelType*>(SrcRows[0]);
+			auto Src1 = reinterpret_cast<const ChannelType*>(SrcRows[1]);
+			auto Out = reinterpret_cast<ChannelType*>(Dst);
+			for (size_t x = 0; x < DstWidth; x++)
+			{
+				for (size_t c = 0; c < 4; c++)
+				{
+					size_t i = x * 8 + c;
+					SumType Sum = SumType(Src0[i]) + Src0[i + 4] + Src1[i] + Src1[i + 4];
+					if constexpr (std::is_floating_point_v<ChannelType>) Out[x * 4 + c] = ChannelType(Sum * 0.25);
+					else Out[x * 4 + c] = ChannelType((Sum + 2) / 4);
+				}
+			}
+			return;
+		}
+
+		for (uint32_t x = 0; x < DstWidth; x++)
+		{
+			uint32_t Area = (XBounds[x + 1] - XBounds[x]) * NumRows;
+			if (ColorSpace == MipColorSpace::Linear)
+			{
+				SumType Sum[4] = {};
+				for (uint32_t y = 0; y < NumRows; y++)
+				{
+					for (uint32_t sx = XBounds[x]; sx < XBounds[x + 1]; sx++)
+					{
+						auto& c = SrcRows[y][sx];
+						Sum[0] += c.R; Sum[1] += c.G; Sum[2] += c.B; Sum[3] += c.A;
+					}
+				}
+				if constexpr (std::is_floating_point_v<ChannelType>) Dst[x] = PixelType(ChannelType(Sum[0] / Area), ChannelType(Sum[1] / Area), ChannelType(Sum[2] / Area), ChannelType(Sum[3] / Area));
+				else Dst[x] = PixelType(ChannelType((Sum[0] + Area / 2) / Area), ChannelType((Sum[1] + Area / 2) / Area), ChannelType((Sum[2] + Area / 2) / Area), ChannelType((Sum[3] + Area / 2) / Area));
+			}
+			else
+			{
+				float R = 0, G = 0, B = 0;
+				SumType A = 0;
+				for (uint32_t y = 0; y < NumRows; y++)
+				{
+					for (uint32_t sx = XBounds[x]; sx < XBounds[x + 1]; sx++)
+					{
+						auto& c = SrcRows[y][sx];
+						R += SRGBCodec<ChannelType>::Decode(c.R);
+						G += SRGBCodec<ChannelType>::Decode(c.G);
+						B += SRGBCodec<ChannelType>::Decode(c.B);
+						A += c.A;
+					}
+				}
+				float Recip = 1.0f / Area;
+				ChannelType Alpha;
+				if constexpr (std::is_floating_point_v<ChannelType>) Alpha = ChannelType(A / Area);
+				else Alpha = ChannelType((A + Area / 2) / Area);
+				Dst[x] = PixelType(SRGBCodec<ChannelType>::Encode(R * Recip), SRGBCodec<ChannelType>::Encode(G * Recip), SRGBCodec<ChannelType>::Encode(B * Recip), Alpha);
+			}
+		}
+	}
+
+	template<typename PixelType>
+	MipChain<PixelType> Image<PixelType>::BuildMipChain(MipColorSpace ColorSpace) const
+	{
+		if (Orientation != ExifOrientation::Normal) return MakeOrientedCopy().BuildMipChain(ColorSpace);
+
+		auto Chain = MipChain<PixelType>(Width, Height);
+		auto NumLevels = Chain.GetNumLevels();
+
+		// 每一级相对上一级的划分方式与 ShrinkResize() 相同，NextRow 是这一级下一个要生成的行
+		struct LevelPlan
+		{
+			std::vector<uint32_t> XBounds;
+			std::vector<uint32_t> YBounds;
+			uint32_t NextRow = 0;
+		};
+		auto Plans = std::vector<LevelPlan>(NumLevels);
+		for (size_t i = 1; i < NumLevels; i++)
+		{
+			Plans[i].XBounds = MakeShrinkBounds(Chain.GetWidth(i - 1), Chain.GetWidth(i), false);
+			Plans[i].YBounds = MakeShrinkBounds(Chain.GetHeight(i - 1), Chain.GetHeight(i), false);
+		}
+
+		const PixelType* SrcRows[3];
+		for (uint32_t y = 0; y < Height; y++)
+		{
+			memcpy(Chain.GetLevelRowPtr(0, y), RowPointers[y], size_t(Width) * sizeof(PixelType));
+
+			// 上一级的第 Row 行写完后，如果它是下一级某一行所需的最后一行，就立即生成那一行，并继续向更小的级别传递
+			uint32_t Row = y;
+			for (size_t i = 1; i < NumLevels; i++)
+			{
+				auto& Plan = Plans[i];
+				if (Plan.NextRow >= Chain.GetHeight(i) || Plan.YBounds[Plan.NextRow + 1] - 1 != Row) break;
+				uint32_t NumRows = Plan.YBounds[Plan.NextRow + 1] - Plan.YBounds[Plan.NextRow];
+				for (uint32_t r = 0; r < NumRows; r++) SrcRows[r] = Chain.GetLevelRowPtr(i - 1, Plan.YBounds[Plan.NextRow] + r);
+				MakeMipRow(SrcRows, NumRows, Plan.XBounds, Chain.GetLevelRowPtr(i, Plan.NextRow), ColorSpace);
+				Row = Plan.NextRow++;
+			}
+		}
+		return Chain;
+	}
+
+	template<typename PixelType>
+	PixelType Image<PixelType>::LinearSample(float u, float v) const
+	{
+		return LinearSample(GetOrientedWidth(), GetOrientedHeight(), RowPointers, GetOrientationMap(), u, v);
+	}
+
+	// Width、Height 与 u、v 都是显示方向的，取四个纹素时再经过 Map 换算成存储坐标
+	template<typename PixelType>
+	PixelType Image<PixelType>::LinearSample(uint32_t Width, uint32_t Height, const std::vector<PixelType*>& RowPointers, const OrientationMap& Map, float u, float v)
+	{
+		float TexelCoordX = u * Width;
+		float TexelCoordY = v * Height;
+		int x0 = int(floor(TexelCoordX));
+		int y0 = int(floor(TexelCoordY));
+		int x1 = x0 + 1; if (x1 >= int(Width)) x1 = Width - 1;
+		int y1 = y0 + 1; if (y1 >= int(Height)) y1 = Height - 1;
+		auto Texel = [&](int x, int y) -> const PixelType& { return RowPointers[Map.MapY(x, y)][Map.MapX(x, y)]; };
+		return LinearInterpolate(
+			LinearInterpolate(Texel(x0, y0), Texel(x1, y0), TexelCoordX - x0),
+			LinearInterpolate(Texel(x0, y1), Texel(x1, y1), TexelCoordX - x0),
+			TexelCoordY - y0
+		);
+	}
+
+	template<typename PixelType>
+	PixelType Image<PixelType>::GetAvreage(int x0, int y0, int x1, int y1, const std::vector<PixelType*>& RowPointers, const OrientationMap& Map)
+	{
+		auto ret = Pixel_RGBA32F(0, 0, 0, 0);
+		size_t count = 0;
+
+		// 方向变换把显示方向的矩形映射成存储方向的矩形，求平均与顺序无关
+		int sx0 = Map.MapX(x0, y0), sx1 = Map.MapX(x1, y1);
+		int sy0 = Map.MapY(x0, y0), sy1 = Map.MapY(x1, y1);
+		if (sx0 > sx1) std::swap(sx0, sx1);
+		if (sy0 > sy1) std::swap(sy0, sy1);
+
+		for (int y = sy0; y <= sy1; y++)
+		{
+			for (int x = sx0; x <= sx1; x++)
+			{
+				auto& c = RowPointers[y][x];
+				ret.R += c.R;
+				ret.G += c.G;
+				ret.B += c.B;
+				ret.A += c.A;
+				count++;
+			}
+		}
+
+		return PixelType
+		(
+			ChannelType(ret.R / count),
+			ChannelType(ret.G / count),
+			ChannelType(ret.B / count),
+			ChannelType(ret.A / count)
+		);
+	}
+
+	template<typename PixelType>
+	PixelType Image<PixelType>::LinearInterpolate(const PixelType& c1, const PixelType& c2, float s)
+	{
+		Pixel_RGBA32F Base
+		{
+			float(c2.R) - c1.R,
+			float(c2.G) - c1.G,
+			float(c2.B) - c1.B,
+			float(c2.A) - c1.A
+		};
+		return PixelType
+		(
+			ChannelType(float(c1.R) + Base.R * s),
+			ChannelType(float(c1.G) + Base.G * s),
+			ChannelType(float(c1.B) + Base.B * s),
+			ChannelType(float(c1.A) + Base.A * s)
+		);
+	}
+
+	template<typename PixelType>
+	PixelType Image<PixelType>::GetAvreage(int x0, int y0, int x1, int y1) const
+	{
+		return GetAvreage(x0, y0, x1, y1, RowPointers, GetOrientationMap());
+	}
+
+	constexpr int ResizeFixedShift = 14;
+
+	// 可分离重采样的一维权重表：第 i 个输出像素取输入的 [First[i], First[i] + Count[i]) 加权求和，
+	// 每个输出像素的权重占 Stride 个位置。浮点权重之和为 1，定点权重之和正好为 1 << ResizeFixedShift
+	struct ResizeWeights
+	{
+		std::vector<int> First;
+		std::vector<int> Count;
+		int Stride = 0;
+		std::vector<float> Weights;
+		std::vector<int16_t> FixedWeights;
+	};
+
+	static double GetResizeFilterSupport(ResizeFilter Filter)
+	{
+		switch (Filter)
+		{
+		case ResizeFilter::Box: return 0.5;
+		case ResizeFilter::Triangle: return 1.0;
+		case ResizeFilter::CatmullRom: return 2.0;
+		case ResizeFilter::Mitchell: return 2.0;
+		case ResizeFilter::Lanczos3: return 3.0;
+		default: throw std::invalid_argument(std::string("Invalid resize filter (value = ") + std::to_string(int(Filter)) + ")");
+		}
+	}
+
+	// Mitchell-Netravali 三次滤波器，B = 0、C = 0.5 是 Catmull-Rom
+	static double CubicBC(double x, double B, double C)
+	{
+		x = std::abs(x);
+		if (x < 1.0) return ((12 - 9 * B - 6 * C) * x * x * x + (-18 + 12 * B + 6 * C) * x * x + (6 - 2 * B)) / 6;
+		if (x < 2.0) return ((-B - 6 * C) * x * x * x + (6 * B + 30 * C) * x * x + (-12 * B - 48 * C) * x + (8 * B + 24 * C)) / 6;
+		return 0;
+	}
+
+	static double Sinc(double x)
+	{
+		if (x == 0.0) return 1.0;
+		x *= 3.14159265358979323846;
+		return std::sin(x) / x;
+	}
+
+	static double GetResizeFilterValue(ResizeFilter Filter, double x)
+	{
+		switch (Filter)
+		{
+		case ResizeFilter::Box: return x > -0.5 && x <= 0.5 ? 1.0 : 0.0;
+		case ResizeFilter::Triangle: return std::max(1.0 - std::abs(x), 0.0);
+		case ResizeFilter::CatmullRom: return CubicBC(x, 0.0, 0.5);
+		case ResizeFilter::Mitchell: return CubicBC(x, 1.0 / 3, 1.0 / 3);
+		case ResizeFilter::Lanczos3: return std::abs(x) < 3.0 ? Sinc(x) * Sinc(x / 3) : 0.0;
+		default: return 0;
+		}
+	}
+
+	static ResizeWeights MakeResizeWeights(ResizeFilter Filter, uint32_t SrcSize, uint32_t DstSize)
+	{
+		// 像素中心对齐：输出像素 i 的中心在输入的 (i + 0.5) * Scale 处。缩小时滤波器按 Scale 展宽，相当于先低通再取样
+		double Scale = double(SrcSize) / DstSize;
+		double FilterScale = std::max(Scale, 1.0);
+		double Support = GetResizeFilterSupport(Filter) * FilterScale;
+
+		auto ret = ResizeWeights();
+		ret.Stride = int(std::ceil(Support)) * 2 + 1;
+		ret.First.resize(DstSize);
+		ret.Count.resize(DstSize);
+		ret.Weights.resize(size_t(DstSize) * ret.Stride);
+		ret.FixedWeights.resize(size_t(DstSize) * ret.Stride);
+
+		auto Values = std::vector<double>(ret.Stride);
+		for (uint32_t i = 0; i < DstSize; i++)
+		{
+			double Center = (i + 0.5) * Scale;
+			int x0 = std::max(int(std::floor(Center - Support + 0.5)), 0);
+			int x1 = std::min(int(std::floor(Center + Support + 0.5)), int(SrcSize));
+			x1 = std::min(x1, x0 + ret.Stride);
+
+			double Sum = 0;
+			for (int x = x0; x < x1; x++)
+			{
+				Values[x - x0] = GetResizeFilterValue(Filter, (x - Center + 0.5) / FilterScale);
+				Sum += Values[x - x0];
+			}
+
+			// 去掉两头为 0 的权重，减少抽头数
+			while (x1 > x0 + 1 && Values[x1 - 1 - x0] == 0.0) x1--;
+			int Skip = 0;
+			while (x0 + Skip + 1 < x1 && Values[Skip] == 0.0) Skip++;
+			if (Sum == 0.0)
+			{
+				// 滤波器在这里没有覆盖任何像素，取最近的像素
+				x0 = std::min(int(Center), int(SrcSize) - 1);
+				x1 = x0 + 1;
+				Values[0] = Sum = 1.0;
+				Skip = 0;
+			}
+
+			auto Weights = &ret.Weights[size_t(i) * ret.Stride];
+			auto FixedWeights = &ret.FixedWeights[size_t(i) * ret.Stride];
+			int FixedSum = 0;
+			int Largest = 0;
+			ret.First[i] = x0 + Skip;
+			ret.Count[i] = x1 - x0 - Skip;
+			for (int k = 0; k < ret.Count[i]; k++)
+			{
+				double w = Values[k + Skip] / Sum;
+				Weights[k] = float(w);
+				FixedWeights[k] = int16_t(std::lround(w * (1 << ResizeFixedShift)));
+				FixedSum += FixedWeights[k];
+				if (FixedWeights[k] > FixedWeights[Largest]) Largest = k;
+			}
+
+			// 舍入误差归到最大的权重上，保证纯色图像缩放后颜色不变
+			FixedWeights[Largest] += int16_t((1 << ResizeFixedShift) - FixedSum);
+		}
+		return ret;
+	}
+
+	static uint8_t FixedToChannel(int32_t Sum)
+	{
+		Sum = (Sum + (1 << (ResizeFixedShift - 1))) >> ResizeFixedShift;
+		return uint8_t(std::clamp(Sum, 0, 255));
+	}
+
+	// 横向一遍：一行输入缩放成一行输出
+	using ResizeRowHKernel = void(*)(const Pixel_RGBA8* Src, Pixel_RGBA8* Dst, uint32_t DstWidth, const ResizeWeights& W);
+
+	// 纵向一遍：Count 行输入按权重合成一行输出
+	using ResizeRowVKernel = void(*)(Pixel_RGBA8* const* Rows, const int16_t* Weights, int Count, Pixel_RGBA8* Dst, uint32_t Width);
+
+	static void ResizeRowH_Scalar(const Pixel_RGBA8* Src, Pixel_RGBA8* Dst, uint32_t DstWidth, const ResizeWeights& W)
+	{
+		for (uint32_t i = 0; i < DstWidth; i++)
+		{
+			auto s = Src + W.First[i];
+			auto w = &W.FixedWeights[size_t(i) * W.Stride];
+			int32_t R = 0, G = 0, B = 0, A = 0;
+			for (int k = 0; k < W.Count[i]; k++)
+			{
+				R += s[k].R * w[k];
+				G += s[k].G * w[k];
+				B += s[k].B * w[k];
+				A += s[k].A * w[k];
+			}
+			Dst[i] = Pixel_RGBA8(FixedToChannel(R), FixedToChannel(G), FixedToChannel(B), FixedToChannel(A));
+		}
+	}
+
+	static void ResizeRowV_Scalar(Pixel_RGBA8* const* Rows, const int16_t* Weights, int Count, Pixel_RGBA8* Dst, uint32_t Width)
+	{
+		for (uint32_t x = 0; x < Width; x++)
+		{
+			int32_t R = 0, G = 0, B = 0, A = 0;
+			for (int k = 0; k < Count; k++)
+			{
+				auto& s = Rows[k][x];
+				R += s.R * Weights[k];
+				G += s.G * Weights[k];
+				B += s.B * Weights[k];
+				A += s.A * Weights[k];
+			}
+			Dst[x] = Pixel_RGBA8(FixedToChannel(R), FixedToChannel(G), FixedToChannel(B), FixedToChannel(A));
+		}
+	}
+
+#if UNIBMP_X86
+	// 两个抽头的权重拼成一个 32 位数，配合 madd：像素按 (抽头 0 的通道, 抽头 1 的通道) 两两交错成 int16
+	static inline int32_t PackWeightPair(int16_t w0, int16_t w1)
+	{
+		return int32_t(uint16_t(w0)) | (int32_t(w1) << 16);
+	}
+
+	UNIBMP_TARGET("sse2")
+	static inline __m128i LoadPixel_SSE2(const Pixel_RGBA8* p)
+	{
+		int32_t v;
+		memcpy(&v, p, sizeof v);
+		return _mm_cvtsi32_si128(v);
+	}
+
+	UNIBMP_TARGET("sse2")
+	static void ResizeRowH_SSE2(const Pixel_RGBA8* Src, Pixel_RGBA8* Dst, uint32_t DstWidth, const ResizeWeights& W)
+	{
+		const __m128i Zero = _mm_setzero_si128();
+		const __m128i Round = _mm_set1_epi32(1 << (ResizeFixedShift - 1));
+		for (uint32_t i = 0; i < DstWidth; i++)
+		{
+			auto s = Src + W.First[i];
+			auto w = &W.FixedWeights[size_t(i) * W.Stride];
+			int n = W.Count[i];
+			__m128i Sum = Round;
+			int k = 0;
+			for (; k + 4 <= n; k += 4)
+			{
+				auto p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + k));
+				auto wv = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(w + k));
+				auto lo = _mm_unpacklo_epi8(p, Zero);
+				auto hi = _mm_unpackhi_epi8(p, Zero);
+				Sum = _mm_add_epi32(Sum, _mm_madd_epi16(_mm_unpacklo_epi16(lo, _mm_srli_si128(lo, 8)), _mm_shuffle_epi32(wv, _MM_SHUFFLE(0, 0, 0, 0))));
+				Sum = _mm_add_epi32(Sum, _mm_madd_epi16(_mm_unpacklo_epi16(hi, _mm_srli_si128(hi, 8)), _mm_shuffle_epi32(wv, _MM_SHUFFLE(1, 1, 1, 1))));
+			}
+			for (; k + 2 <= n; k += 2)
+			{
+				auto lo = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(s + k)), Zero);
+				Sum = _mm_add_epi32(Sum, _mm_madd_epi16(_mm_unpacklo_epi16(lo, _mm_srli_si128(lo, 8)), _mm_set1_epi32(PackWeightPair(w[k], w[k + 1]))));
+			}
+			if (k < n)
+			{
+				auto lo = _mm_unpacklo_epi8(LoadPixel_SSE2(s + k), Zero);
+				Sum = _mm_add_epi32(Sum, _mm_madd_epi16(_mm_unpacklo_epi16(lo, Zero), _mm_set1_epi32(PackWeightPair(w[k], 0))));
+			}
+			Sum = _mm_srai_epi32(Sum, ResizeFixedShift);
+			Sum = _mm_packs_epi32(Sum, Sum);
+			Sum = _mm_packus_epi16(Sum, Sum);
+			int32_t v = _mm_cvtsi128_si32(Sum);
+			memcpy(static_cast<void*>(&Dst[i]), &v, sizeof v);
+		}
+	}
+
+	UNIBMP_TARGET("sse2")
+	static void ResizeRowV_SSE2(Pixel_RGBA8* const* Rows, const int16_t* Weights, int Count, Pixel_RGBA8* Dst, uint32_t Width)
+	{
+		const __m128i Zero = _mm_setzero_si128();
+		const __m128i Round = _mm_set1_epi32(1 << (ResizeFixedShift - 1));
+		uint32_t x = 0;
+		for (; x + 4 <= Width; x += 4)
+		{
+			__m128i s0 = Round, s1 = Round, s2 = Round, s3 = Round;
+			for (int k = 0; k < Count; k += 2)
+			{
+				auto a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(Rows[k] + x));
+				auto b = Zero;
+				auto wv = _mm_set1_epi32(PackWeightPair(Weights[k], 0));
+				if (k + 1 < Count)
+				{
+					b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(Rows[k + 1] + x));
+					wv = _mm_set1_epi32(PackWeightPair(Weights[k], Weights[k + 1]));
+				}
+				auto alo = _mm_unpacklo_epi8(a, Zero), blo = _mm_unpacklo_epi8(b, Zero);
+				auto ahi = _mm_unpackhi_epi8(a, Zero), bhi = _mm_unpackhi_epi8(b, Zero);
+				s0 = _mm_add_epi32(s0, _mm_madd_epi16(_mm_unpacklo_epi16(alo, blo), wv));
+				s1 = _mm_add_epi32(s1, _mm_madd_epi16(_mm_unpackhi_epi16(alo, blo), wv));
+				s2 = _mm_add_epi32(s2, _mm_madd_epi16(_mm_unpacklo_epi16(ahi, bhi), wv));
+				s3 = _mm_add_epi32(s3, _mm_madd_epi16(_mm_unpackhi_epi16(ahi, bhi), wv));
+			}
+			auto lo = _mm_packs_epi32(_mm_srai_epi32(s0, ResizeFixedShift), _mm_srai_epi32(s1, ResizeFixedShift));
+			auto hi = _mm_packs_epi32(_mm_srai_epi32(s2, ResizeFixedShift), _mm_srai_epi32(s3, ResizeFixedShift));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(Dst + x), _mm_packus_epi16(lo, hi));
+		}
+		if (x < Width)
+		{
+			auto Tail = std::vector<Pixel_RGBA8*>(Rows, Rows + Count);
+			for (auto& Row : Tail) Row += x;
+			ResizeRowV_Scalar(&Tail[0], Weights, Count, Dst + x, Width - x);
+		}
+	}
+
+	UNIBMP_TARGET("avx2")
+	static void ResizeRowH_AVX2(const Pixel_RGBA8* Src, Pixel_RGBA8* Dst, uint32_t DstWidth, const ResizeWeights& W)
+	{
+		const __m128i Zero = _mm_setzero_si128();
+		const __m128i Round = _mm_set1_epi32(1 << (ResizeFixedShift - 1));
+
+		// 每个 128 位通道里有两个像素的 8 个 int16，交错成 (R0, R1, G0, G1, B0, B1, A0, A1)
+		const __m256i Interleave = _mm256_setr_epi8(
+			0, 1, 8, 9, 2, 3, 10, 11, 4, 5, 12, 13, 6, 7, 14, 15,
+			0, 1, 8, 9, 2, 3, 10, 11, 4, 5, 12, 13, 6, 7, 14, 15);
+
+		// 4 个抽头的权重一次读入，低 128 位放抽头 0、1 的权重对，高 128 位放抽头 2、3 的
+		const __m256i WeightPairIndex = _mm256_setr_epi32(0, 0, 0, 0, 1, 1, 1, 1);
+		for (uint32_t i = 0; i < DstWidth; i++)
+		{
+			auto s = Src + W.First[i];
+			auto w = &W.FixedWeights[size_t(i) * W.Stride];
+			int n = W.Count[i];
+			__m256i Sum8 = _mm256_setzero_si256();
+			int k = 0;
+			for (; k + 4 <= n; k += 4)
+			{
+				auto p = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(s + k)));
+				p = _mm256_shuffle_epi8(p, Interleave);
+				auto wv = _mm256_permutevar8x32_epi32(_mm256_castsi128_si256(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(w + k))), WeightPairIndex);
+				Sum8 = _mm256_add_epi32(Sum8, _mm256_madd_epi16(p, wv));
+			}
+			__m128i Sum = _mm_add_epi32(Round, _mm_add_epi32(_mm256_castsi256_si128(Sum8), _mm256_extracti128_si256(Sum8, 1)));
+			for (; k + 2 <= n; k += 2)
+			{
+				auto lo = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(s + k)), Zero);
+				Sum = _mm_add_epi32(Sum, _mm_madd_epi16(_mm_unpacklo_epi16(lo, _mm_srli_si128(lo, 8)), _mm_set1_epi32(PackWeightPair(w[k], w[k + 1]))));
+			}
+			if (k < n)
+			{
+				auto lo = _mm_unpacklo_epi8(LoadPixel_SSE2(s + k), Zero);
+				Sum = _mm_add_epi32(Sum, _mm_madd_epi16(_mm_unpacklo_epi16(lo, Zero), _mm_set1_epi32(PackWeightPair(w[k], 0))));
+			}
+			Sum = _mm_srai_epi32(Sum, ResizeFixedShift);
+			Sum = _mm_packs_epi32(Sum, Sum);
+			Sum = _mm_packus_epi16(Sum, Sum);
+			int32_t v = _mm_cvtsi128_si32(Sum);
+			memcpy(static_cast<void*>(&Dst[i]), &v, sizeof v);
+		}
+	}
+
+	UNIBMP_TARGET("avx2")
+	static void ResizeRowV_AVX2(Pixel_RGBA8* const* Rows, const int16_t* Weights, int Count, Pixel_RGBA8* Dst, uint32_t Width)
+	{
+		const __m256i Zero = _mm256_setzero_si256();
+		const __m256i Round = _mm256_set1_epi32(1 << (ResizeFixedShift - 1));
+		uint32_t x = 0;
+
+		// unpack 与 pack 都在 128 位通道内进行，两次重排互相抵消，输出的像素顺序不变
+		for (; x + 8 <= Width; x += 8)
+		{
+			__m256i s0 = Round, s1 = Round, s2 = Round, s3 = Round;
+			for (int k = 0; k < Count; k += 2)
+			{
+				auto a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(Rows[k] + x));
+				auto b = Zero;
+				auto wv = _mm256_set1_epi32(PackWeightPair(Weights[k], 0));
+				if (k + 1 < Count)
+				{
+					b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(Rows[k + 1] + x));
+					wv = _mm256_set1_epi32(PackWeightPair(Weights[k], Weights[k + 1]));
+				}
+				auto alo = _mm256_unpacklo_epi8(a, Zero), blo = _mm256_unpacklo_epi8(b, Zero);
+				auto ahi = _mm256_unpackhi_epi8(a, Zero), bhi = _mm256_unpackhi_epi8(b, Zero);
+				s0 = _mm256_add_epi32(s0, _mm256_madd_epi16(_mm256_unpacklo_epi16(alo, blo), wv));
+				s1 = _mm256_add_epi32(s1, _mm256_madd_epi16(_mm256_unpackhi_epi16(alo, blo), wv));
+				s2 = _mm256_add_epi32(s2, _mm256_madd_epi16(_mm256_unpacklo_epi16(ahi, bhi), wv));
+				s3 = _mm256_add_epi32(s3, _mm256_madd_epi16(_mm256_unpackhi_epi16(ahi, bhi), wv));
 			}
+			auto lo = _mm256_packs_epi32(_mm256_srai_epi32(s0, ResizeFixedShift), _mm256_srai_epi32(s1, ResizeFixedShift));
+			auto hi = _mm256_packs_epi32(_mm256_srai_epi32(s2, ResizeFixedShift), _mm256_srai_epi32(s3, ResizeFixedShift));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(Dst + x), _mm256_packus_epi16(lo, hi));
+		}
+		if (x < Width)
+		{
+			auto Tail = std::vector<Pixel_RGBA8*>(Rows, Rows + Count);
+			for (auto& Row : Tail) Row += x;
+			ResizeRowV_SSE2(&Tail[0], Weights, Count, Dst + x, Width - x);
 		}
 	}
 
-	template<typename PixelType>
-	void Image<PixelType>::ResizeLinear(uint32_t NewWidth, uint32_t NewHeight)
+	static ResizeISA DetectResizeISA()
 	{
-		int xset = NewWidth > Width ? 2 : NewWidth == Width ? 1 : 0;
-		int yset = NewHeight > Height ? 2 : NewHeight == Height ? 1 : 0;
-		int xyset = (xset << 4) + (yset << 0);
-		// 0: shrink; 1: keep; 2: expand
-		switch (xyset)
+#if defined(_MSC_VER) && !defined(__clang__)
+		int Info[4];
+		__cpuid(Info, 0);
+		int MaxLeaf = Info[0];
+		__cpuid(Info, 1);
+		bool HasSSE2 = (Info[3] & (1 << 26)) != 0;
+		bool HasAVX = (Info[2] & (1 << 28)) != 0 && (Info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;
+		bool HasAVX2 = false;
+		if (HasAVX && MaxLeaf >= 7)
 		{
-		case 0x00:
-		case 0x01:
-		case 0x10: ShrinkResize(NewWidth, NewHeight); break;
-		case 0x11: break;
-		case 0x12:
-		case 0x21:
-		case 0x22: ExpandResizeLinear(NewWidth, NewHeight); break;
-		case 0x02: ShrinkResize(NewWidth, Height); ExpandResizeLinear(NewWidth, NewHeight); break;
-		case 0x20: ShrinkResize(Width, NewHeight); ExpandResizeLinear(NewWidth, NewHeight); break;
+			__cpuidex(Info, 7, 0);
+			HasAVX2 = (Info[1] & (1 << 5)) != 0;
 		}
+#else
+		__builtin_cpu_init();
+		bool HasSSE2 = __builtin_cpu_supports("sse2");
+		bool HasAVX2 = __builtin_cpu_supports("avx2");
+#endif
+		if (HasAVX2) return ResizeISA::AVX2;
+		if (HasSSE2) return ResizeISA::SSE2;
+		return ResizeISA::Scalar;
+	}
+#else
+	static ResizeISA DetectResizeISA()
+	{
+		return ResizeISA::Scalar;
 	}
+#endif
 
-	template<typename PixelType>
-	void Image<PixelType>::ExpandResizeLinear(uint32_t NewWidth, uint32_t NewHeight)
+	ResizeISA GetBestSupportedResizeISA()
 	{
-		if (NewWidth == Width && NewHeight == Height) return;
-		if (NewWidth < Width || NewHeight < Height)
+		static const ResizeISA BestISA = DetectResizeISA();
+		return BestISA;
+	}
+
+	static void ResizeSeparableFixed(const std::vector<Pixel_RGBA8*>& SrcRows, uint32_t SrcWidth, uint32_t SrcHeight, std::vector<Pixel_RGBA8*>& DstRows, uint32_t DstWidth, uint32_t DstHeight, const ResizeWeights& WX, const ResizeWeights& WY, ResizeISA ISA)
+	{
+		auto BestISA = GetBestSupportedResizeISA();
+		if (ISA == ResizeISA::Auto || int(ISA) > int(BestISA)) ISA = BestISA;
+		ResizeRowHKernel RowH = ResizeRowH_Scalar;
+		ResizeRowVKernel RowV = ResizeRowV_Scalar;
+#if UNIBMP_X86
+		switch (ISA)
 		{
-			throw std::invalid_argument("Should not use `ExpandResizeLinear()` on shrinking an image.\n");
+		case ResizeISA::AVX2: RowH = ResizeRowH_AVX2; RowV = ResizeRowV_AVX2; break;
+		case ResizeISA::SSE2: RowH = ResizeRowH_SSE2; RowV = ResizeRowV_SSE2; break;
+		default: break;
 		}
+#endif
 
-		auto PrevBMP = std::move(BitmapData);
-		auto PrevRPtr = std::move(RowPointers);
-		auto OrigWidth = Width;
-		auto OrigHeight = Height;
-		CreateBuffer(NewWidth, NewHeight);
-
+		auto ResizeRows = [&](const std::vector<Pixel_RGBA8*>& Rows, std::vector<Pixel_RGBA8*>& Out, uint32_t NumRows)
+		{
 #if PROFILE_MultithreadingComplexImageRastering
 #pragma omp parallel for
 #endif
-		for (int y = 0; y < int(NewHeight); y++)
+			for (int y = 0; y < int(NumRows); y++)
+			{
+				RowH(Rows[y], Out[y], DstWidth, WX);
+			}
+		};
+		auto ResizeColumns = [&](const std::vector<Pixel_RGBA8*>& Rows, std::vector<Pixel_RGBA8*>& Out, uint32_t RowWidth)
 		{
-			float v = float(y) / NewHeight;
-			auto DstRow = RowPointers[y];
-			for (int x = 0; x < int(NewWidth); x++)
+#if PROFILE_MultithreadingComplexImageRastering
+#pragma omp parallel for
+#endif
+			for (int y = 0; y < int(DstHeight); y++)
 			{
-				float u = float(x) / NewWidth;
-				DstRow[x] = LinearSample(OrigWidth, OrigHeight, PrevRPtr, u, v);
+				RowV(&Rows[WY.First[y]], &WY.FixedWeights[size_t(y) * WY.Stride], WY.Count[y], Out[y], RowWidth);
 			}
+		};
+
+		if (DstWidth == SrcWidth)
+		{
+			ResizeColumns(SrcRows, DstRows, DstWidth);
+			return;
+		}
+		if (DstHeight == SrcHeight)
+		{
+			ResizeRows(SrcRows, DstRows, DstHeight);
+			return;
+		}
+
+		// 纵向一遍每条指令处理 4 到 8 个像素，横向一遍每条指令只处理一个像素的几个抽头，所以按开销估计决定先做哪一遍。
+		// 大幅缩小时先纵向，横向的那一遍只需要处理已经变少的行
+		double RowCost = 3.0 * DstWidth * WX.Stride;
+		double ColumnCost = double(WY.Stride);
+		bool RowsFirst = SrcHeight * RowCost + double(DstHeight) * DstWidth * ColumnCost < double(DstHeight) * SrcWidth * ColumnCost + DstHeight * RowCost;
+
+		// 中间结果的每个像素都会被第一遍写入，不需要初始化
+		auto Temp = PixelBuffer<Pixel_RGBA8>();
+		auto TempRows = std::vector<Pixel_RGBA8*>();
+		if (RowsFirst)
+		{
+			Temp = PixelBuffer<Pixel_RGBA8>(size_t(DstWidth) * SrcHeight, false);
+			TempRows.resize(SrcHeight);
+			for (uint32_t y = 0; y < SrcHeight; y++) TempRows[y] = &Temp[size_t(y) * DstWidth];
+			ResizeRows(SrcRows, TempRows, SrcHeight);
+			ResizeColumns(TempRows, DstRows, DstWidth);
+		}
+		else
+		{
+			Temp = PixelBuffer<Pixel_RGBA8>(size_t(SrcWidth) * DstHeight, false);
+			TempRows.resize(DstHeight);
+			for (uint32_t y = 0; y < DstHeight; y++) TempRows[y] = &Temp[size_t(y) * SrcWidth];
+			ResizeColumns(SrcRows, TempRows, SrcWidth);
+			ResizeRows(TempRows, DstRows, DstHeight);
 		}
 	}
 
-	template<typename PixelType>
-	void Image<PixelType>::ShrinkResize(uint32_t NewWidth, uint32_t NewHeight)
+	template<typename ChannelType>
+	static ChannelType FloatToChannel(float v)
 	{
-		if (NewWidth == Width && NewHeight == Height) return;
-		if (NewWidth > Width || NewHeight > Height)
+		if constexpr (std::is_floating_point_v<ChannelType>)
 		{
-			throw std::invalid_argument("Should not use `ShrinkResize()` on expanding an image.\n");
+			return ChannelType(v);
+		}
+		else
+		{
+			return ChannelType(std::clamp(double(v) + 0.5, 0.0, double(std::numeric_limits<ChannelType>::max())));
 		}
+	}
 
-		auto PrevBMP = std::move(BitmapData);
-		auto PrevRPtr = std::move(RowPointers);
-		auto OrigWidth = Width;
-		auto OrigHeight = Height;
-		CreateBuffer(NewWidth, NewHeight);
+	template<typename PixelType>
+	static void ResizeSeparableFloat(const std::vector<PixelType*>& SrcRows, uint32_t SrcHeight, std::vector<PixelType*>& DstRows, uint32_t DstWidth, uint32_t DstHeight, const ResizeWeights& WX, const ResizeWeights& WY)
+	{
+		using ChannelType = typename PixelType::ChannelType;
+		auto Temp = PixelBuffer<Pixel_RGBA32F>(size_t(DstWidth) * SrcHeight, false);
 
 #if PROFILE_MultithreadingComplexImageRastering
 #pragma omp parallel for
 #endif
-		for (int y = 0; y < int(NewHeight); y++)
+		for (int y = 0; y < int(SrcHeight); y++)
 		{
-			int y0 = int((int64_t(y) * OrigHeight + 0) / int(NewHeight));
-			int y1 = int((int64_t(y) * OrigHeight + 1) / int(NewHeight));
-			auto DstRow = RowPointers[y];
-			for (int x = 0; x < int(NewWidth); x++)
+			auto Src = SrcRows[y];
+			auto Dst = &Temp[size_t(y) * DstWidth];
+			for (uint32_t i = 0; i < DstWidth; i++)
 			{
-				int x0 = int((int64_t(x) * OrigWidth + 0) / int(NewWidth));
-				int x1 = int((int64_t(x) * OrigWidth + 1) / int(NewWidth));
-				DstRow[x] = GetAvreage(x0, y0, x1, y1, PrevRPtr);
+				auto s = Src + WX.First[i];
+				auto w = &WX.Weights[size_t(i) * WX.Stride];
+				float R = 0, G = 0, B = 0, A = 0;
+				for (int k = 0; k < WX.Count[i]; k++)
+				{
+					R += float(s[k].R) * w[k];
+					G += float(s[k].G) * w[k];
+					B += float(s[k].B) * w[k];
+					A += float(s[k].A) * w[k];
+				}
+				Dst[i] = Pixel_RGBA32F(R, G, B, A);
 			}
 		}
-	}
 
-	template<typename PixelType>
-	PixelType Image<PixelType>::LinearSample(float u, float v) const
-	{
-		return LinearSample(Width, Height, RowPointers, u, v);
+#if PROFILE_MultithreadingComplexImageRastering
+#pragma omp parallel for
+#endif
+		for (int y = 0; y < int(DstHeight); y++)
+		{
+			auto Sum = std::vector<Pixel_RGBA32F>(DstWidth, Pixel_RGBA32F(0, 0, 0, 0));
+			auto w = &WY.Weights[size_t(y) * WY.Stride];
+			for (int k = 0; k < WY.Count[y]; k++)
+			{
+				auto Row = &Temp[size_t(WY.First[y] + k) * DstWidth];
+				for (uint32_t x = 0; x < DstWidth; x++)
+				{
+					Sum[x].R += Row[x].R * w[k];
+					Sum[x].G += Row[x].G * w[k];
+					Sum[x].B += Row[x].B * w[k];
+					Sum[x].A += Row[x].A * w[k];
+				}
+			}
+			auto Dst = DstRows[y];
+			for (uint32_t x = 0; x < DstWidth; x++)
+			{
+				Dst[x] = PixelType(
+					FloatToChannel<ChannelType>(Sum[x].R),
+					FloatToChannel<ChannelType>(Sum[x].G),
+					FloatToChannel<ChannelType>(Sum[x].B),
+					FloatToChannel<ChannelType>(Sum[x].A));
+			}
+		}
 	}
 
 	template<typename PixelType>
-	PixelType Image<PixelType>::LinearSample(uint32_t Width, uint32_t Height, const std::vector<PixelType*> RowPointers, float u, float v)
+	void Image<PixelType>::Resize(uint32_t NewWidth, uint32_t NewHeight, ResizeFilter Filter, ResizeISA ISA)
 	{
-		float TexelCoordX = u * Width;
-		float TexelCoordY = v * Height;
-		int x0 = int(floor(TexelCoordX));
-		int y0 = int(floor(TexelCoordY));
-		int x1 = x0 + 1; if (x1 >= int(Width)) x1 = Width - 1;
-		int y1 = y0 + 1; if (y1 >= int(Height)) y1 = Height - 1;
-		return LinearInterpolate(
-			LinearInterpolate(RowPointers[y0][x0], RowPointers[y0][x1], TexelCoordX - x0),
-			LinearInterpolate(RowPointers[y1][x0], RowPointers[y1][x1], TexelCoordX - x0),
-			TexelCoordY - y0
-		);
+		// 重采样按显示方向进行。方向变换先用分块旋转应用到像素上，两遍滤波都沿存储的行读取
+		ApplyOrientation();
+		if (NewWidth == Width && NewHeight == Height) return;
+		Resize(GetView(), NewWidth, NewHeight, Filter, ISA);
 	}
 
 	template<typename PixelType>
-	PixelType Image<PixelType>::GetAvreage(int x0, int y0, int x1, int y1, const std::vector<PixelType*> RowPointers)
+	void Image<PixelType>::Resize(const ConstImageView<PixelType>& Src, uint32_t NewWidth, uint32_t NewHeight, ResizeFilter Filter, ResizeISA ISA)
 	{
-		auto ret = Pixel_RGBA32F(0, 0, 0, 0);
-		size_t count = 0;
-
-		for (int y = y0; y <= y1; y++)
+		if (!NewWidth || !NewHeight)
 		{
-			for (int x = x0; x <= x1; x++)
-			{
-				auto& c = RowPointers[y][x];
-				ret.R += c.R;
-				ret.G += c.G;
-				ret.B += c.B;
-				ret.A += c.A;
-				count++;
-			}
+			throw std::invalid_argument("`Resize()`: the new size must not be zero.");
 		}
 
-		return PixelType
-		(
-			ChannelType(ret.R / count),
-			ChannelType(ret.G / count),
-			ChannelType(ret.B / count),
-			ChannelType(ret.A / count)
-		);
-	}
-
-	template<typename PixelType>
-	PixelType Image<PixelType>::LinearInterpolate(const PixelType& c1, const PixelType& c2, float s)
-	{
-		Pixel_RGBA32F Base
+		// Src 可能是自己的视图，旧的缓冲区要留到写完为止
+		auto SrcRows = GetViewRows(Src);
+		auto PrevBMP = std::move(BitmapData);
+		auto PrevRPtr = std::move(RowPointers);
+		auto OrigWidth = Src.GetWidth();
+		auto OrigHeight = Src.GetHeight();
+		CreateBuffer(NewWidth, NewHeight, false);
+		Orientation = ExifOrientation::Normal;
+		if (NewWidth == OrigWidth && NewHeight == OrigHeight)
 		{
-			float(c2.R) - c1.R,
-			float(c2.G) - c1.G,
-			float(c2.B) - c1.B,
-			float(c2.A) - c1.A
-		};
-		return PixelType
-		(
-			ChannelType(float(c1.R) + Base.R * s),
-			ChannelType(float(c1.G) + Base.G * s),
-			ChannelType(float(c1.B) + Base.B * s),
-			ChannelType(float(c1.A) + Base.A * s)
-		);
-	}
+			GetView().Paint(Src, 0, 0);
+			return;
+		}
 
-	template<typename PixelType>
-	PixelType Image<PixelType>::GetAvreage(int x0, int y0, int x1, int y1) const
-	{
-		return GetAvreage(x0, y0, x1, y1, RowPointers);
+		auto WX = MakeResizeWeights(Filter, OrigWidth, NewWidth);
+		auto WY = MakeResizeWeights(Filter, OrigHeight, NewHeight);
+		if constexpr (std::is_same_v<PixelType, Pixel_RGBA8>)
+		{
+			ResizeSeparableFixed(SrcRows, OrigWidth, OrigHeight, RowPointers, NewWidth, NewHeight, WX, WY, ISA);
+		}
+		else
+		{
+			ResizeSeparableFloat(SrcRows, OrigHeight, RowPointers, NewWidth, NewHeight, WX, WY);
+		}
 	}
 
 	template<typename PixelType, typename T>
@@ -1639,24 +3406,28 @@ namespace UniformBitmap
 	template<typename PixelType>
 	size_t Image<PixelType>::SaveToBmp24(std::ostream& ofs, bool InverseLineOrder) const
 	{
+		if (Orientation != ExifOrientation::Normal) return MakeOrientedCopy().SaveToBmp24(ofs, InverseLineOrder);
 		return SaveBmp24(*this, ofs, InverseLineOrder);
 	}
 
 	template<typename PixelType>
 	size_t Image<PixelType>::SaveToBmp32(std::ostream& ofs, bool InverseLineOrder) const
 	{
+		if (Orientation != ExifOrientation::Normal) return MakeOrientedCopy().SaveToBmp32(ofs, InverseLineOrder);
 		return SaveBmp32(*this, ofs, InverseLineOrder);
 	}
 
 	template<typename PixelType>
 	size_t Image<PixelType>::SaveToBmp24(FileInMemoryType& mf, bool InverseLineOrder) const
 	{
+		if (Orientation != ExifOrientation::Normal) return MakeOrientedCopy().SaveToBmp24(mf, InverseLineOrder);
 		return SaveBmp24(*this, mf, InverseLineOrder);
 	}
 
 	template<typename PixelType>
 	size_t Image<PixelType>::SaveToBmp32(FileInMemoryType& mf, bool InverseLineOrder) const
 	{
+		if (Orientation != ExifOrientation::Normal) return MakeOrientedCopy().SaveToBmp32(mf, InverseLineOrder);
 		return SaveBmp32(*this, mf, InverseLineOrder);
 	}
 
@@ -1912,6 +3683,12 @@ namespace UniformBitmap
 			}
 		}
 	}
+
+	template<typename PixelType>
+	void Image<PixelType>::Paint(const ConstImageView<PixelType>& Src, int x, int y)
+	{
+		GetView().Paint(Src, x, y);
+	}
 }
 
 #pragma warning(push)
@@ -1928,81 +3705,50 @@ namespace UniformBitmap
 
 namespace UniformBitmap
 {
-	template<typename PixelType>
-	class STBITakeOver
-	{
-	public:
-		PixelType* Pixels;
-		int Width;
-		int Height;
-		STBITakeOver(int& w, int& h, void* data) :
-			Width(w), Height(h), Pixels(reinterpret_cast<PixelType*>(data))
-		{
-			if (!data) throw LoadImageError(stbi_failure_reason());
-		}
-		~STBITakeOver()
+	// 接管 stbi 加载出来的像素。stbi 给出的格式与 PixelType 相同时直接使用这块内存，否则转换到新的缓冲区后释放它
+	// w 和 h 按引用传入，因为它们由同一个表达式里的 stbi_load() 填写
+	template<typename PixelType, typename STBIPixelType>
+	static PixelBuffer<PixelType> TakeOverSTBI(void* data, const int& w, const int& h)
+	{
+		if (!data) throw LoadImageError(stbi_failure_reason());
+		auto Count = size_t(w) * size_t(h);
+		auto stbi = PixelBuffer<STBIPixelType>(reinterpret_cast<STBIPixelType*>(data), Count, stbi_image_free);
+		if constexpr (std::is_same_v<PixelType, STBIPixelType>) return stbi;
+		else
 		{
-			stbi_image_free(Pixels);
+			auto ret = PixelBuffer<PixelType>(Count, false);
+#if PROFILE_MultithreadingImageRastering
+#pragma omp parallel for
+#endif
+			for (ptrdiff_t i = 0; i < ptrdiff_t(Count); i++)
+			{
+				ret[i] = stbi[i];
+			}
+			return ret;
 		}
-	};
+	}
 
 	template<typename PixelType>
 	void Image<PixelType>::LoadNonBmp(const std::string& FilePath)
 	{
 		int w = 0, h = 0, n = 0;
-		if (std::is_floating_point_v<ChannelType>)
+		if constexpr (std::is_floating_point_v<ChannelType>)
 		{
-			auto stbi = STBITakeOver<Pixel_RGBA32F>(w, h, stbi_loadf(FilePath.c_str(), &w, &h, &n, 4));
-			CreateBuffer(w, h);
-#if PROFILE_MultithreadingImageRastering
-#pragma omp parallel for
-#endif
-			for (ptrdiff_t y = 0; y < ptrdiff_t(Height); y++)
-			{
-				auto srow = &stbi.Pixels[y * Width];
-				auto drow = RowPointers[y];
-				for (size_t x = 0; x < Width; x++)
-				{
-					drow[x] = srow[x];
-				}
-			}
+			auto Buffer = TakeOverSTBI<PixelType, Pixel_RGBA32F>(stbi_loadf(FilePath.c_str(), &w, &h, &n, 4), w, h);
+			AdoptBuffer(w, h, std::move(Buffer));
 			IsHDR = true;
 		}
-		else if (sizeof(ChannelType) == 1)
+		else if constexpr (sizeof(ChannelType) == 1)
 		{
-			auto stbi = STBITakeOver<Pixel_RGBA8>(w, h, stbi_load(FilePath.c_str(), &w, &h, &n, 4));
-			CreateBuffer(w, h);
-#if PROFILE_MultithreadingImageRastering
-#pragma omp parallel for
-#endif
-			for (ptrdiff_t y = 0; y < ptrdiff_t(Height); y++)
-			{
-				auto srow = &stbi.Pixels[y * Width];
-				auto drow = RowPointers[y];
-				for (size_t x = 0; x < Width; x++)
-				{
-					drow[x] = srow[x];
-				}
-			}
+			auto Buffer = TakeOverSTBI<PixelType, Pixel_RGBA8>(stbi_load(FilePath.c_str(), &w, &h, &n, 4), w, h);
+			AdoptBuffer(w, h, std::move(Buffer));
 			ExifData = FindExifDataFromJpeg(FilePath);
-			RotateByExifData(true);
+			LoadOrientationFromExif(true);
 		}
 		else
 		{
-			auto stbi = STBITakeOver<Pixel_RGBA16>(w, h, stbi_load_16(FilePath.c_str(), &w, &h, &n, 4));
-			CreateBuffer(w, h);
-#if PROFILE_MultithreadingImageRastering
-#pragma omp parallel for
-#endif
-			for (ptrdiff_t y = 0; y < ptrdiff_t(Height); y++)
-			{
-				auto srow = &stbi.Pixels[y * Width];
-				auto drow = RowPointers[y];
-				for (size_t x = 0; x < Width; x++)
-				{
-					drow[x] = srow[x];
-				}
-			}
+			auto Buffer = TakeOverSTBI<PixelType, Pixel_RGBA16>(stbi_load_16(FilePath.c_str(), &w, &h, &n, 4), w, h);
+			AdoptBuffer(w, h, std::move(Buffer));
 		}
 	}
 
@@ -2013,59 +3759,23 @@ namespace UniformBitmap
 	void Image<PixelType>::LoadNonBmp(const void* FileInMemory, size_t FileSize)
 	{
 		int w = 0, h = 0, n = 0;
-		if (std::is_floating_point_v<ChannelType>)
+		if constexpr (std::is_floating_point_v<ChannelType>)
 		{
-			auto stbi = STBITakeOver<Pixel_RGBA32F>(w, h, stbi_loadf_from_memory(reinterpret_cast<const uint8_t*>(FileInMemory), FileSize, &w, &h, &n, 4));
-			CreateBuffer(w, h);
-#if PROFILE_MultithreadingImageRastering
-#pragma omp parallel for
-#endif
-			for (ptrdiff_t y = 0; y < ptrdiff_t(Height); y++)
-			{
-				auto srow = &stbi.Pixels[y * Width];
-				auto drow = RowPointers[y];
-				for (size_t x = 0; x < Width; x++)
-				{
-					drow[x] = srow[x];
-				}
-			}
+			auto Buffer = TakeOverSTBI<PixelType, Pixel_RGBA32F>(stbi_loadf_from_memory(reinterpret_cast<const uint8_t*>(FileInMemory), FileSize, &w, &h, &n, 4), w, h);
+			AdoptBuffer(w, h, std::move(Buffer));
 			IsHDR = true;
 		}
-		else if (sizeof(ChannelType) == 1)
+		else if constexpr (sizeof(ChannelType) == 1)
 		{
-			auto stbi = STBITakeOver<Pixel_RGBA8>(w, h, stbi_load_from_memory(reinterpret_cast<const uint8_t*>(FileInMemory), FileSize, &w, &h, &n, 4));
-			CreateBuffer(w, h);
-#if PROFILE_MultithreadingImageRastering
-#pragma omp parallel for
-#endif
-			for (ptrdiff_t y = 0; y < ptrdiff_t(Height); y++)
-			{
-				auto srow = &stbi.Pixels[y * Width];
-				auto drow = RowPointers[y];
-				for (size_t x = 0; x < Width; x++)
-				{
-					drow[x] = srow[x];
-				}
-			}
+			auto Buffer = TakeOverSTBI<PixelType, Pixel_RGBA8>(stbi_load_from_memory(reinterpret_cast<const uint8_t*>(FileInMemory), FileSize, &w, &h, &n, 4), w, h);
+			AdoptBuffer(w, h, std::move(Buffer));
 			ExifData = FindExifDataFromJpeg(FileInMemory, FileSize);
-			RotateByExifData(true);
+			LoadOrientationFromExif(true);
 		}
 		else
 		{
-			auto stbi = STBITakeOver<Pixel_RGBA16>(w, h, stbi_load_16_from_memory(reinterpret_cast<const uint8_t*>(FileInMemory), FileSize, &w, &h, &n, 4));
-			CreateBuffer(w, h);
-#if PROFILE_MultithreadingImageRastering
-#pragma omp parallel for
-#endif
-			for (ptrdiff_t y = 0; y < ptrdiff_t(Height); y++)
-			{
-				auto srow = &stbi.Pixels[y * Width];
-				auto drow = RowPointers[y];
-				for (size_t x = 0; x < Width; x++)
-				{
-					drow[x] = srow[x];
-				}
-			}
+			auto Buffer = TakeOverSTBI<PixelType, Pixel_RGBA16>(stbi_load_16_from_memory(reinterpret_cast<const uint8_t*>(FileInMemory), FileSize, &w, &h, &n, 4), w, h);
+			AdoptBuffer(w, h, std::move(Buffer));
 		}
 	}
 #pragma warning(pop)
@@ -2076,63 +3786,106 @@ namespace UniformBitmap
 		WriteData(wt, data, size_t(size));
 	}
 
-	template<typename PixelType>
-	FileInMemoryType Image<PixelType>::SaveToPNG() const
+	// 逐行转换成 ToType 并紧密排列，供不接受行距的 stbi 写入函数使用。已经是紧密排列的 ToType 时直接返回视图的像素
+	template<typename ToType, typename PixelType>
+	static const ToType* GetPackedPixels(const ConstImageView<PixelType>& View, PixelBuffer<ToType>& Packed)
 	{
-		if (!std::is_same_v<PixelType, Pixel_RGBA8>)
+		auto Width = View.GetWidth();
+		auto Height = View.GetHeight();
+		if constexpr (std::is_same_v<ToType, PixelType>)
 		{
-			auto conv = Image_RGBA8(*this);
-			return conv.SaveToPNG();
+			if (Height <= 1 || View.GetStride() == ptrdiff_t(Width)) return View.GetRowPtr(0);
 		}
 
-		FileInMemoryType ret;
-		if (!stbi_write_png_to_func(stbi_WriteToFileInMemory, &ret, Width, Height, 4, GetBitmapDataPtr(), 0)) throw SaveImageError(stbi_failure_reason());
-		return ret;
+		Packed = PixelBuffer<ToType>(size_t(Width) * Height, false);
+#if PROFILE_MultithreadingImageRastering
+#pragma omp parallel for
+#endif
+		for (ptrdiff_t y = 0; y < ptrdiff_t(Height); y++)
+		{
+			auto Src = View.GetRowPtr(y);
+			auto Dst = &Packed[y * Width];
+			for (size_t x = 0; x < Width; x++)
+			{
+				Dst[x] = Src[x];
+			}
+		}
+		return Packed.data();
 	}
 
 	template<typename PixelType>
-	FileInMemoryType Image<PixelType>::SaveToTGA() const
+	FileInMemoryType ConstImageView<PixelType>::SaveToPNG() const
 	{
-		if (!std::is_same_v<PixelType, Pixel_RGBA8>)
+		FileInMemoryType ret;
+		PixelBuffer<Pixel_RGBA8> Packed;
+		const void* Pixels = Data;
+		auto Pitch = Stride * ptrdiff_t(sizeof(PixelType));
+		if (!std::is_same_v<PixelType, Pixel_RGBA8> || Stride < 0)
 		{
-			auto conv = Image_RGBA8(*this);
-			return conv.SaveToTGA();
+			Pixels = GetPackedPixels(*this, Packed);
+			Pitch = ptrdiff_t(Width) * ptrdiff_t(sizeof(Pixel_RGBA8));
 		}
+		if (!stbi_write_png_to_func(stbi_WriteToFileInMemory, &ret, Width, Height, 4, Pixels, int(Pitch))) throw SaveImageError(stbi_failure_reason());
+		return ret;
+	}
 
+	template<typename PixelType>
+	FileInMemoryType ConstImageView<PixelType>::SaveToTGA() const
+	{
 		FileInMemoryType ret;
-		if (!stbi_write_tga_to_func(stbi_WriteToFileInMemory, &ret, Width, Height, 4, GetBitmapDataPtr())) throw SaveImageError(stbi_failure_reason());
+		PixelBuffer<Pixel_RGBA8> Packed;
+		if (!stbi_write_tga_to_func(stbi_WriteToFileInMemory, &ret, Width, Height, 4, GetPackedPixels(*this, Packed))) throw SaveImageError(stbi_failure_reason());
 		return ret;
 	}
 
 	template<typename PixelType>
-	FileInMemoryType Image<PixelType>::SaveToJPG(int Quality) const
+	FileInMemoryType ConstImageView<PixelType>::SaveToJPG(int Quality) const
 	{
-		if (!std::is_same_v<PixelType, Pixel_RGBA8>)
-		{
-			auto conv = Image_RGBA8(*this);
-			return conv.SaveToJPG(Quality);
-		}
+		FileInMemoryType ret;
+		PixelBuffer<Pixel_RGBA8> Packed;
+		if (!stbi_write_jpg_to_func(stbi_WriteToFileInMemory, &ret, Width, Height, 4, GetPackedPixels(*this, Packed), Quality)) throw SaveImageError(stbi_failure_reason());
+		return ret;
+	}
 
+	template<typename PixelType>
+	FileInMemoryType ConstImageView<PixelType>::SaveToHDR() const
+	{
 		FileInMemoryType ret;
-		if (!stbi_write_jpg_to_func(stbi_WriteToFileInMemory, &ret, Width, Height, 4, GetBitmapDataPtr(), Quality)) throw SaveImageError(stbi_failure_reason());
-		if (ExifData) ModifyJpegToInsertExif(ret, *ExifData);
+		PixelBuffer<Pixel_RGBA32F> Packed;
+		if (!stbi_write_hdr_to_func(stbi_WriteToFileInMemory, &ret, Width, Height, 4, reinterpret_cast<const float*>(GetPackedPixels(*this, Packed)))) throw SaveImageError(stbi_failure_reason());
 		return ret;
 	}
 
 	template<typename PixelType>
-	FileInMemoryType Image<PixelType>::SaveToHDR() const
+	FileInMemoryType Image<PixelType>::SaveToPNG() const
 	{
-		if (!std::is_same_v<PixelType, Pixel_RGBA32F>)
-		{
-			auto conv = Image_RGBA32F(*this);
-			return conv.SaveToHDR();
-		}
+		if (Orientation != ExifOrientation::Normal) return MakeOrientedCopy().SaveToPNG();
+		return GetView().SaveToPNG();
+	}
 
-		FileInMemoryType ret;
-		if (!stbi_write_hdr_to_func(stbi_WriteToFileInMemory, &ret, Width, Height, 4, reinterpret_cast<const float*>(GetBitmapDataPtr()))) throw SaveImageError(stbi_failure_reason());
+	template<typename PixelType>
+	FileInMemoryType Image<PixelType>::SaveToTGA() const
+	{
+		if (Orientation != ExifOrientation::Normal) return MakeOrientedCopy().SaveToTGA();
+		return GetView().SaveToTGA();
+	}
+
+	template<typename PixelType>
+	FileInMemoryType Image<PixelType>::SaveToJPG(int Quality) const
+	{
+		if (Orientation != ExifOrientation::Normal) return MakeOrientedCopy().SaveToJPG(Quality);
+		auto ret = GetView().SaveToJPG(Quality);
+		if (ExifData) ModifyJpegToInsertExif(ret, *ExifData);
 		return ret;
 	}
 
+	template<typename PixelType>
+	FileInMemoryType Image<PixelType>::SaveToHDR() const
+	{
+		if (Orientation != ExifOrientation::Normal) return MakeOrientedCopy().SaveToHDR();
+		return GetView().SaveToHDR();
+	}
+
 	template<typename ExceptionType = SaveImageError>
 	static size_t WriteFileFromMemory(const std::string& FilePath, const FileInMemoryType& fm)
 	{
@@ -2193,6 +3946,20 @@ namespace UniformBitmap
 	template Image_RGBA32F::Image(const Image_RGBA16& from);
 	template Image_RGBA32F::Image(const Image_RGBA32& from);
 
+	template class MipChain<Pixel_RGBA8>;
+	template class MipChain<Pixel_RGBA16>;
+	template class MipChain<Pixel_RGBA32>;
+	template class MipChain<Pixel_RGBA32F>;
+
+	template class ConstImageView<Pixel_RGBA8>;
+	template class ConstImageView<Pixel_RGBA16>;
+	template class ConstImageView<Pixel_RGBA32>;
+	template class ConstImageView<Pixel_RGBA32F>;
+	template class ImageView<Pixel_RGBA8>;
+	template class ImageView<Pixel_RGBA16>;
+	template class ImageView<Pixel_RGBA32>;
+	template class ImageView<Pixel_RGBA32F>;
+
 	bool IsImage16bpps(const std::string& FilePath)
 	{
 		return stbi_is_16_bit(FilePath.c_str()) ? true : false;
@@ -4,6 +4,9 @@
 #include <vector>
 #include <string>
 #include <memory>
+#include <memory_resource>
+#include <map>
+#include <mutex>
 #include <stdexcept>
 #include <unordered_set>
 #include "tiffhdr.hpp"
@@ -157,7 +160,161 @@ namespace UniformBitmap
 	extern template class PixelRef<Pixel_RGBA32>;
 	extern template class PixelRef<Pixel_RGBA32F>;
 
+	// Exif 的 Orientation 标签值：存储的像素要经过怎样的变换才是正确的显示方向
+	enum class ExifOrientation : uint16_t
+	{
+		Normal = 1,
+		MirrorH = 2,
+		Rotate180 = 3,
+		MirrorV = 4,
+		MirrorH_Rotate270_CW = 5,
+		Rotate90_CW = 6,
+		MirrorH_Rotate90_CW = 7,
+		Rotate270_CW = 8
+	};
+
+	// 加载图像时如何处理 Exif 的 Orientation：立即旋转像素，或者只记下来，留给之后的缩放、保存一并处理
+	enum class ExifOrientationHandling
+	{
+		Apply,
+		Defer
+	};
+
+	// Resize() 使用的重采样滤波器
+	enum class ResizeFilter
+	{
+		Box,
+		Triangle,
+		CatmullRom,
+		Mitchell,
+		Lanczos3
+	};
+
+	// Resize() 处理 8 位图像时使用的指令集，`Auto` 表示使用 CPU 支持的最好的指令集。各指令集的结果完全相同
+	enum class ResizeISA
+	{
+		Scalar,
+		SSE2,
+		AVX2,
+		Auto
+	};
+
+	ResizeISA GetBestSupportedResizeISA();
+
+	// BuildMipChain() 求平均的方式：直接平均存储的数值，或者把 RGB 当作 sRGB 编码，换算到线性空间平均后再编码回去。Alpha 总是直接平均
+	enum class MipColorSpace
+	{
+		Linear,
+		SRGB
+	};
+
+	// 回收位图缓冲区的内存池：释放的内存块按（大小，对齐）留在池里，之后同样大小的分配直接取用，不再向系统申请、重新缺页。
+	// 适合反复处理同样尺寸图像的场合，例如逐个请求生成缩略图。池里留存的总字节数不超过 MaxCachedBytes，多出的直接还给 Upstream。线程安全
+	class PixelBufferPool : public std::pmr::memory_resource
+	{
+	protected:
+		std::pmr::memory_resource* Upstream;
+		size_t MaxCachedBytes;
+		size_t CachedBytes = 0;
+		std::map<std::pair<size_t, size_t>, std::vector<void*>> FreeBlocks;
+		mutable std::mutex Mutex;
+
+		void* do_allocate(size_t Bytes, size_t Alignment) override;
+		void do_deallocate(void* p, size_t Bytes, size_t Alignment) override;
+		bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+
+	public:
+		explicit PixelBufferPool(size_t MaxCachedBytes = size_t(256) << 20, std::pmr::memory_resource* Upstream = std::pmr::get_default_resource());
+		PixelBufferPool(const PixelBufferPool&) = delete;
+		PixelBufferPool& operator=(const PixelBufferPool&) = delete;
+		~PixelBufferPool() override;
+
+		// 把池里留存的内存全部还给 Upstream
+		void Release();
+		size_t GetCachedBytes() const;
+	};
+
+	// 大块内存按 2MB 对齐、按 2MB 取整分配，并用 madvise(MADV_HUGEPAGE) 请内核使用透明大页，减少大图的缺页和 TLB 缺失。
+	// 小于 MinSize 的分配原样交给 Upstream。没有 madvise() 的平台上只做对齐
+	class HugePageResource : public std::pmr::memory_resource
+	{
+	public:
+		static constexpr size_t HugePageSize = size_t(2) << 20;
+
+	protected:
+		size_t MinSize;
+		std::pmr::memory_resource* Upstream;
+
+		void* do_allocate(size_t Bytes, size_t Alignment) override;
+		void do_deallocate(void* p, size_t Bytes, size_t Alignment) override;
+		bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+
+	public:
+		explicit HugePageResource(size_t MinSize = HugePageSize, std::pmr::memory_resource* Upstream = std::pmr::get_default_resource());
+	};
+
+	// 图像缓冲区的布局与分配方式。RowAlignment 是每行起始地址对齐的字节数，必须是 2 的幂，0 表示行与行紧密排列；
+	// RowPadding 是每行末尾至少多留的像素数。Allocator 为 nullptr 时使用 std::pmr::get_default_resource()，不为 nullptr 时必须比使用它的图像活得久
+	struct BufferPolicy
+	{
+		size_t RowAlignment = 0;
+		size_t RowPadding = 0;
+		std::pmr::memory_resource* Allocator = nullptr;
+	};
+
+	// 位图数据的存储。可以自己分配，也可以接管外部分配的一块内存（例如 stbi_load() 的结果），析构时用给定的函数释放。
+	// 接口与 std::vector 相同的部分用法相同，但不能复制，只能移动
+	template<typename PixelType>
+	class PixelBuffer
+	{
+	public:
+		using Deleter = void(*)(void*);
+
+		// 自己分配时起始地址至少按缓存行对齐
+		static constexpr size_t MinAlignment = 64;
+
+	protected:
+		PixelType* Data = nullptr;
+		size_t Count = 0;
+		Deleter Free = nullptr; // 不为 nullptr 时 Data 是接管来的，用它释放
+		std::pmr::memory_resource* Resource = nullptr; // Free 为 nullptr 时 Data 由它分配
+		size_t Alignment = MinAlignment;
+
+	public:
+		PixelBuffer() = default;
+		// Initialize 为 false 时不构造像素，内容未定义，用于随后会写满每一个像素的场合。Resource 为 nullptr 时使用 std::pmr::get_default_resource()
+		explicit PixelBuffer(size_t Count, bool Initialize = true, std::pmr::memory_resource* Resource = nullptr, size_t Alignment = MinAlignment);
+		PixelBuffer(PixelType* Data, size_t Count, Deleter Free) noexcept;
+		PixelBuffer(const PixelBuffer&) = delete;
+		PixelBuffer(PixelBuffer&& from) noexcept;
+		PixelBuffer& operator=(const PixelBuffer&) = delete;
+		PixelBuffer& operator=(PixelBuffer&& rhs) noexcept;
+		~PixelBuffer();
+
+		inline size_t size() const { return Count; }
+		inline bool empty() const { return !Count; }
+		inline PixelType* data() { return Data; }
+		inline const PixelType* data() const { return Data; }
+		inline PixelType& operator[](size_t i) { return Data[i]; }
+		inline const PixelType& operator[](size_t i) const { return Data[i]; }
+		// 起始地址保证的对齐字节数。接管来的缓冲区只保证 alignof(PixelType)
+		inline size_t alignment() const { return Alignment; }
+
+		// 接管来的缓冲区返回 nullptr
+		inline std::pmr::memory_resource* resource() const { return Free ? nullptr : Resource; }
+
+		// 与 std::vector::resize() 相同：保留原有的像素，新增的像素默认构造
+		void resize(size_t NewCount);
+		void clear() noexcept;
+	};
+
+	extern template class PixelBuffer<Pixel_RGBA8>;
+	extern template class PixelBuffer<Pixel_RGBA16>;
+	extern template class PixelBuffer<Pixel_RGBA32>;
+	extern template class PixelBuffer<Pixel_RGBA32F>;
+
 	template<typename PixelType> class Image;
+	template<typename PixelType> class MipChain;
 	using Image_RGBA8 = Image<Pixel_RGBA8>;
 	using Image_RGBA16 = Image<Pixel_RGBA16>;
 	using Image_RGBA32 = Image<Pixel_RGBA32>;
@@ -169,6 +326,65 @@ namespace UniformBitmap
 
 	using FileInMemoryType = std::vector<uint8_t>;
 
+	// 图像中一块矩形区域的只读视图：首行指针、宽、高和行距，直接指向原来的像素，不复制。行距以像素计，可以为负（行指针倒序的图像）。
+	// 视图不持有像素，原图重新分配缓冲区（缩放、旋转、SetBufferPolicy() 等）或销毁后视图失效。坐标是存储方向的，不考虑 Orientation
+	template<typename PixelType>
+	class ConstImageView
+	{
+	protected:
+		const PixelType* Data = nullptr;
+		uint32_t Width = 0;
+		uint32_t Height = 0;
+		ptrdiff_t Stride = 0;
+
+	public:
+		ConstImageView() = default;
+		ConstImageView(const PixelType* Data, uint32_t Width, uint32_t Height, ptrdiff_t Stride);
+
+		inline uint32_t GetWidth() const { return Width; }
+		inline uint32_t GetHeight() const { return Height; }
+		inline ptrdiff_t GetStride() const { return Stride; }
+		inline const PixelType* GetRowPtr(size_t y) const { return Data + ptrdiff_t(y) * Stride; }
+		inline PixelType GetPixel(uint32_t x, uint32_t y) const { return GetRowPtr(y)[x]; }
+
+		// 取其中的一块，超出范围时抛出 std::out_of_range
+		ConstImageView SubView(uint32_t x, uint32_t y, uint32_t w, uint32_t h) const;
+
+		// 直接从视图编码，不复制出一幅图像。8 位像素、行距为正时 PNG 按行距直接读取；其它情况先逐行转换、紧密排列再编码
+		FileInMemoryType SaveToPNG() const;
+		FileInMemoryType SaveToTGA() const;
+		FileInMemoryType SaveToJPG(int Quality) const;
+		FileInMemoryType SaveToHDR() const;
+	};
+
+	// 可写的视图。和指针一样，视图本身是 const 的也可以修改它指向的像素
+	template<typename PixelType>
+	class ImageView : public ConstImageView<PixelType>
+	{
+	public:
+		ImageView() = default;
+		ImageView(PixelType* Data, uint32_t Width, uint32_t Height, ptrdiff_t Stride);
+
+		inline PixelType* GetRowPtr(size_t y) const { return const_cast<PixelType*>(ConstImageView<PixelType>::GetRowPtr(y)); }
+		inline void PutPixel(uint32_t x, uint32_t y, const PixelType& Color) const { GetRowPtr(y)[x] = Color; }
+
+		ImageView SubView(uint32_t x, uint32_t y, uint32_t w, uint32_t h) const;
+
+		void Fill(const PixelType& Color) const;
+
+		// 把 Src 复制到视图的 (x, y) 处，超出视图的部分被裁掉。Src 不能与视图重叠
+		void Paint(const ConstImageView<PixelType>& Src, int x, int y) const;
+	};
+
+	extern template class ConstImageView<Pixel_RGBA8>;
+	extern template class ConstImageView<Pixel_RGBA16>;
+	extern template class ConstImageView<Pixel_RGBA32>;
+	extern template class ConstImageView<Pixel_RGBA32F>;
+	extern template class ImageView<Pixel_RGBA8>;
+	extern template class ImageView<Pixel_RGBA16>;
+	extern template class ImageView<Pixel_RGBA32>;
+	extern template class ImageView<Pixel_RGBA32F>;
+
 	template<typename PixelType>
 	class Image
 	{
@@ -188,13 +404,41 @@ namespace UniformBitmap
 		bool IsHDR;
 
 		// 位图数据
-		std::vector<PixelType> BitmapData;
+		PixelBuffer<PixelType> BitmapData;
 
 		// 位图数据的行指针
 		std::vector<PixelType*> RowPointers;
 
-		// 创建空的缓冲区
-		void CreateBuffer(uint32_t w, uint32_t h);
+		// BitmapData 里相邻两行起始位置相差的像素数，不小于 Width
+		size_t Stride = 0;
+
+		// 之后创建缓冲区时使用的布局与分配方式
+		BufferPolicy Policy;
+
+		// 尚未应用到像素上的方向变换。Width、Height、行指针和 GetPixel() 等都是存储方向的
+		ExifOrientation Orientation = ExifOrientation::Normal;
+
+		// 显示方向的坐标 (x, y) 对应的存储坐标：xs = X0 + x * XX + y * XY，ys = Y0 + x * YX + y * YY
+		struct OrientationMap
+		{
+			int X0, XX, XY;
+			int Y0, YX, YY;
+			inline int MapX(int x, int y) const { return X0 + x * XX + y * XY; }
+			inline int MapY(int x, int y) const { return Y0 + x * YX + y * YY; }
+		};
+		OrientationMap GetOrientationMap() const;
+
+		// 创建空的缓冲区，布局与分配方式按 Policy。Initialize 为 false 时像素内容未定义，调用者必须随后写满每一个像素
+		void CreateBuffer(uint32_t w, uint32_t h, bool Initialize = true);
+
+		// 按 Policy 计算宽为 w 的图像的行距（像素数）
+		size_t GetStrideForWidth(uint32_t w) const;
+
+		// 使用已经填好像素、行与行紧密排列的缓冲区作为位图数据，不复制像素
+		void AdoptBuffer(uint32_t w, uint32_t h, PixelBuffer<PixelType>&& Buffer);
+
+		// 行指针等距排列时（包括倒序）得到相邻两行相差的像素数
+		bool GetRowStride(ptrdiff_t& RowStride) const;
 
 		// 从图像文件加载 Bmp 格式图片
 		void LoadBmp(const std::string& FilePath);
@@ -224,6 +468,18 @@ namespace UniformBitmap
 
 		void RotateByExifData(bool RemoveRotationFromExifData);
 
+		// 从 Exif 读出 Orientation 记到 Orientation 成员里，不改动像素
+		void LoadOrientationFromExif(bool RemoveRotationFromExifData);
+
+		// 保存时使用：得到一份应用了方向变换的拷贝
+		Image MakeOrientedCopy() const;
+
+		// 按行指针的顺序重排位图数据的行，使第 y 行位于 BitmapData 的第 y 行，只需要一行的临时缓冲区
+		void ApplyRowPtrsOrder();
+
+		// 原地转置位图数据，宽高互换
+		void TransposeInPlace();
+
 	public:
 		inline uint32_t GetWidth() const { return Width; }
 		inline uint32_t GetHeight() const { return Height; }
@@ -236,7 +492,7 @@ namespace UniformBitmap
 		inline PixelType& GetPixelRef(uint32_t x, uint32_t y) { return RowPointers[y][x]; }
 		inline void PutPixel(uint32_t x, uint32_t y, const PixelType& Color) { RowPointers[y][x] = Color; }
 		inline bool IsOutOfBound(const Point& pt) const { return pt.x >= Width || pt.y >= Height; }
-		inline size_t GetPitch() const { return size_t(Width) * sizeof(PixelType); }
+		inline size_t GetPitch() const { return Stride * sizeof(PixelType); }
 		inline size_t GetBitmapSizeInTotal() const { return GetPitch() * Height; }
 		FloodFillEdgeType FloodFill(uint32_t x, uint32_t y, const PixelType& Color, bool RetrieveEdge = false, bool(*IsSamePixel)(const PixelType& a, const PixelType& b) = PixelType::IsSame, void (*SetPixel)(PixelType& dst, const PixelType& src) = PixelType::SetPixel);
 
@@ -250,12 +506,22 @@ namespace UniformBitmap
 		// TIFF 头部信息
 		std::shared_ptr<TIFFHeader> ExifData;
 
-		Image(const std::string& FilePath, bool Verbose);
-		Image(const std::string& FilePath, const std::string& Name, bool Verbose);
-		Image(const void* FileInMemory, size_t FileSize, const std::string& Name, bool Verbose);
+		Image(const std::string& FilePath, bool Verbose, ExifOrientationHandling OrientationHandling = ExifOrientationHandling::Apply);
+		Image(const std::string& FilePath, const std::string& Name, bool Verbose, ExifOrientationHandling OrientationHandling = ExifOrientationHandling::Apply);
+		Image(const void* FileInMemory, size_t FileSize, const std::string& Name, bool Verbose, ExifOrientationHandling OrientationHandling = ExifOrientationHandling::Apply);
 		Image(uint32_t Width, uint32_t Height, const std::string& Name, bool Verbose);
 		Image(uint32_t Width, uint32_t Height, const PixelType& DefaultColor, const std::string& Name, bool Verbose);
+		Image(uint32_t Width, uint32_t Height, const BufferPolicy& Policy, const std::string& Name, bool Verbose);
+
+		// 接管外部分配的一块 Width x Height 的像素，不复制。图像销毁时调用 Free(Pixels) 释放，例如传入 stbi_image_free 或 free
+		Image(uint32_t Width, uint32_t Height, PixelType* Pixels, typename PixelBuffer<PixelType>::Deleter Free, const std::string& Name, bool Verbose);
 		Image(const Image& from);
+
+		// 把视图里的像素复制成一幅独立的图像，例如裁剪
+		Image(const ConstImageView<PixelType>& Src, const std::string& Name, bool Verbose);
+
+		// 移动时整块转移位图数据，行指针仍然指向同一块内存，不复制像素。被移走的图像变成 0x0 的空图像
+		Image(Image&& from) noexcept;
 		template<typename FromType> requires (!std::is_same_v<PixelType, FromType>)
 		Image(const Image<FromType>& from);
 
@@ -282,8 +548,19 @@ namespace UniformBitmap
 		FileInMemoryType SaveToJPG(int Quality) const;
 		FileInMemoryType SaveToHDR() const;
 
-		Image& operator=(const Image& rhs) = default;
-		Image& operator=(Image&& rhs) = default;
+		Image& operator=(const Image& rhs);
+		Image& operator=(Image&& rhs) noexcept;
+
+		// 更换布局与分配方式，并立即把现有的像素搬到按新方式分配的缓冲区里。复制出来的图像和之后缩放、旋转产生的缓冲区都沿用它
+		void SetBufferPolicy(const BufferPolicy& NewPolicy);
+		inline const BufferPolicy& GetBufferPolicy() const { return Policy; }
+
+		// 整幅或其中一块的视图，不复制像素，坐标是存储方向的；超出范围时抛出 std::out_of_range。
+		// 行指针不是等距排列时，非 const 版本先按行指针的顺序重排位图数据，const 版本抛出 std::logic_error
+		ImageView<PixelType> GetView();
+		ImageView<PixelType> GetView(uint32_t x, uint32_t y, uint32_t w, uint32_t h);
+		ConstImageView<PixelType> GetView() const;
+		ConstImageView<PixelType> GetView(uint32_t x, uint32_t y, uint32_t w, uint32_t h) const;
 
 	public:
 		void FlipH();
@@ -295,6 +572,15 @@ namespace UniformBitmap
 		void Rotate270_CW();
 		void Rotate270_CCW();
 
+		// 低内存模式的旋转：不另外分配整幅图像的缓冲区，峰值内存不会翻倍。
+		// 正方形图像分块交换，和普通旋转差不多快；非正方形图像沿置换环搬运像素，需要每像素 1 bit 的标记，明显比普通旋转慢
+		void Rotate90_CW_InPlace();
+		void Rotate270_CW_InPlace();
+
+		// 以视图里的像素为源旋转，结果替换这幅图像的内容，不需要先裁剪出一幅图像。Src 可以是这幅图像自己的视图
+		void Rotate90_CW(const ConstImageView<PixelType>& Src);
+		void Rotate270_CW(const ConstImageView<PixelType>& Src);
+
 		enum class RotationAngle
 		{
 			R_0 = 0,
@@ -314,6 +600,15 @@ namespace UniformBitmap
 		void Rotate_CCW(RotationAngle Angle);
 		void Rotate(RotationAngle Angle, RotationOrient Orient);
 
+		// 方向变换：以 ExifOrientationHandling::Defer 加载，或者调用 SetOrientation() 后，像素保持存储方向，
+		// 缩放、LinearSample()、GetAvreage() 和保存按显示方向进行，旋转与缩放在同一遍里完成；其余操作仍按存储方向进行
+		inline ExifOrientation GetOrientation() const { return Orientation; }
+		inline void SetOrientation(ExifOrientation NewOrientation) { Orientation = NewOrientation; }
+		inline uint32_t GetOrientedWidth() const { return Orientation >= ExifOrientation::MirrorH_Rotate270_CW ? Height : Width; }
+		inline uint32_t GetOrientedHeight() const { return Orientation >= ExifOrientation::MirrorH_Rotate270_CW ? Width : Height; }
+		PixelType GetOrientedPixel(uint32_t x, uint32_t y) const;
+		void ApplyOrientation();
+
 		bool WidthIs2N() const;
 		bool HeightIs2N() const;
 		bool WidthHeightIs2N() const;
@@ -325,21 +620,39 @@ namespace UniformBitmap
 		void ResizeLinear(uint32_t NewWidth, uint32_t NewHeight);
 
 		void ExpandResizeLinear(uint32_t NewWidth, uint32_t NewHeight);
+
+		// 面积平均缩小：输入按整数边界划分成块，每个输出像素是一块输入的平均值。宽、高恰好缩小 2、4、8 倍时走专门的快速路径
 		void ShrinkResize(uint32_t NewWidth, uint32_t NewHeight);
 
+		// 以视图里的像素为源面积平均缩小，结果替换这幅图像的内容。Src 可以是这幅图像自己的视图
+		void ShrinkResize(const ConstImageView<PixelType>& Src, uint32_t NewWidth, uint32_t NewHeight);
+
+		// 可分离的多抽头重采样：横向、纵向各一遍，先做哪一遍按开销估计决定；每个输出行、列的权重预先算成表，缩小时滤波器按比例展宽。
+		// 8 位图像使用 int16 定点运算和 SIMD，其它像素类型使用浮点。指定的指令集不被 CPU 支持时，使用支持的最好的指令集
+		void Resize(uint32_t NewWidth, uint32_t NewHeight, ResizeFilter Filter = ResizeFilter::Lanczos3, ResizeISA ISA = ResizeISA::Auto);
+
+		// 以视图里的像素为源重采样，结果替换这幅图像的内容，例如先裁剪再生成缩略图。Src 可以是这幅图像自己的视图
+		void Resize(const ConstImageView<PixelType>& Src, uint32_t NewWidth, uint32_t NewHeight, ResizeFilter Filter = ResizeFilter::Lanczos3, ResizeISA ISA = ResizeISA::Auto);
+
+		// 生成整串 mipmap，只需要一遍：第 0 级逐行复制，每一级的一行在它用到的上一级的行刚刚生成、还在缓存里时就立即生成
+		MipChain<PixelType> BuildMipChain(MipColorSpace ColorSpace = MipColorSpace::Linear) const;
+
 		PixelType LinearSample(float u, float v) const;
 		static PixelType LinearInterpolate(const PixelType& c1, const PixelType& c2, float s);
 		PixelType GetAvreage(int x0, int y0, int x1, int y1) const;
 
 	protected:
-		static PixelType LinearSample(uint32_t Width, uint32_t Height, const std::vector<PixelType*> RowPointers, float u, float v);
-		static PixelType GetAvreage(int x0, int y0, int x1, int y1, const std::vector<PixelType*> RowPointers);
+		static PixelType LinearSample(uint32_t Width, uint32_t Height, const std::vector<PixelType*>& RowPointers, const OrientationMap& Map, float u, float v);
+		static PixelType GetAvreage(int x0, int y0, int x1, int y1, const std::vector<PixelType*>& RowPointers, const OrientationMap& Map);
 
 	public:
 		void Paint(int x, int y, int w, int h, const Image& Src, int srcx, int srcy);
 		void Paint(const Image& Src, int x, int y, int w, int h, int srcx, int srcy);
 		void Paint(const Image& Src, int x, int y, int w, int h, int srcx, int srcy, void(*on_pixel)(PXR& dst, const CPXR& src));
 
+		// 把视图里的像素复制到 (x, y) 处，超出图像的部分被裁掉。Src 不能与这幅图像重叠
+		void Paint(const ConstImageView<PixelType>& Src, int x, int y);
+
 	public:
 		bool Verbose = true;
 	};
@@ -365,6 +678,50 @@ namespace UniformBitmap
 	extern template Image_RGBA32F::Image(const Image_RGBA16& from);
 	extern template Image_RGBA32F::Image(const Image_RGBA32& from);
 
+	// 一串 mipmap：所有级别放在同一块连续的内存里。第 0 级是原图，之后每级宽、高减半（最小为 1），直到 1x1。
+	// 每一级的像素按行紧密排列，行宽就是这一级的宽度
+	template<typename PixelType>
+	class MipChain
+	{
+	public:
+		struct Level
+		{
+			uint32_t Width;
+			uint32_t Height;
+			size_t Offset;
+		};
+
+	protected:
+		PixelBuffer<PixelType> Pixels; // 构造时不初始化，由 BuildMipChain() 写满每一级
+		std::vector<Level> Levels;
+
+	public:
+		MipChain(uint32_t Width, uint32_t Height);
+		MipChain(const MipChain& from);
+		MipChain(MipChain&& from) noexcept = default;
+		MipChain& operator=(const MipChain& rhs);
+		MipChain& operator=(MipChain&& rhs) noexcept = default;
+
+		inline size_t GetNumLevels() const { return Levels.size(); }
+		inline const Level& GetLevel(size_t i) const { return Levels[i]; }
+		inline uint32_t GetWidth(size_t i) const { return Levels[i].Width; }
+		inline uint32_t GetHeight(size_t i) const { return Levels[i].Height; }
+		inline PixelType* GetDataPtr() { return &Pixels[0]; }
+		inline const PixelType* GetDataPtr() const { return &Pixels[0]; }
+		inline size_t GetSizeInTotal() const { return Pixels.size() * sizeof(PixelType); }
+		inline PixelType* GetLevelRowPtr(size_t i, uint32_t y) { return &Pixels[Levels[i].Offset + size_t(y) * Levels[i].Width]; }
+		inline const PixelType* GetLevelRowPtr(size_t i, uint32_t y) const { return &Pixels[Levels[i].Offset + size_t(y) * Levels[i].Width]; }
+		inline PixelType GetPixel(size_t i, uint32_t x, uint32_t y) const { return GetLevelRowPtr(i, y)[x]; }
+
+		// 把一级复制成独立的图像，用于保存等
+		Image<PixelType> GetLevelImage(size_t i) const;
+	};
+
+	extern template class MipChain<Pixel_RGBA8>;
+	extern template class MipChain<Pixel_RGBA16>;
+	extern template class MipChain<Pixel_RGBA32>;
+	extern template class MipChain<Pixel_RGBA32F>;
+
 	// 从 Jpeg 文件里查找 Exif 信息块，更新到 ExifData 成员里
 	std::shared_ptr<TIFFHeader> FindExifDataFromJpeg(FileInMemoryType& JpegFile);
 	std::shared_ptr<TIFFHeader> FindExifDataFromJpeg(const std::string& FilePath);